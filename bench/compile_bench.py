@@ -0,0 +1,111 @@
+#!/usr/bin/env python3
+
+# Measures how long heliumc takes to compile a large generated program and
+# how much memory it needs (peak RSS). Pass --baseline to compare against
+# another build of the compiler, e.g. one built from an older commit.
+
+import argparse
+import os
+import subprocess
+import sys
+import tempfile
+import time
+
+# Configuration
+COMPILER = "bin/heliumc"  # Path to your compiler binary
+
+def generate_source(functions):
+	out = []
+	out.append("struct Pair {\n\ta: int,\n\tb: int,\n};\n\n")
+	for i in range(functions):
+		out.append(f"fn f{i}(a: int, b: int) -> int\n")
+		out.append("{\n")
+		out.append("\tint s = 0;\n")
+		out.append("\tPair p;\n")
+		out.append(f"\tp.a = a + {i};\n")
+		out.append("\tp.b = b * 3;\n")
+		out.append("\tfor j in 0..a {\n")
+		out.append(f"\t\ts = s + j * p.b + {i % 97};\n")
+		out.append("\t\tif s > 100000 {\n")
+		out.append("\t\t\ts = s % 9973;\n")
+		out.append("\t\t}\n")
+		out.append("\t}\n")
+		out.append("\twhile b > 0 {\n")
+		out.append("\t\tb = b - 1;\n")
+		out.append("\t\ts = s + (p.a << 2) - (b >> 1) + (2 * 8 + 1);\n")
+		out.append("\t}\n")
+		out.append("\treturn s;\n")
+		out.append("}\n\n")
+
+	# Call everything so dead code elimination keeps every function
+	out.append("fn main()\n{\n\tint t = 0;\n")
+	for i in range(functions):
+		out.append(f"\tt = t + f{i}(3, {i % 7});\n")
+	out.append("\treturn t % 256;\n}\n")
+	return "".join(out)
+
+def measure(compiler, source, output, extra_args):
+	# wait4() reports the child's own peak RSS, unlike getrusage() which
+	# accumulates the maximum over every child we have reaped so far.
+	start = time.perf_counter()
+	proc = subprocess.Popen([compiler, *extra_args, "-o", output, source], stderr=subprocess.PIPE)
+	_, status, usage = os.wait4(proc.pid, 0)
+	elapsed = time.perf_counter() - start
+	stderr = proc.stderr.read().decode()
+	proc.stderr.close()
+	proc.returncode = os.waitstatus_to_exitcode(status)
+	if proc.returncode != 0:
+		print(f"{compiler} failed:\n{stderr}")
+		sys.exit(1)
+	return elapsed, usage.ru_maxrss
+
+def bench(compiler, source, output, runs, extra_args):
+	best_time = None
+	peak_rss = 0
+	for _ in range(runs):
+		elapsed, rss = measure(compiler, source, output, extra_args)
+		best_time = elapsed if best_time is None else min(best_time, elapsed)
+		peak_rss = max(peak_rss, rss)
+	return best_time, peak_rss
+
+def main():
+	parser = argparse.ArgumentParser(description="Compile-time and peak memory benchmark for heliumc")
+	parser.add_argument("--compiler", default=COMPILER, help="compiler under test")
+	parser.add_argument("--baseline", help="second compiler to compare against")
+	parser.add_argument("--functions", type=int, default=4000, help="functions in the generated program")
+	parser.add_argument("--runs", type=int, default=3, help="runs per compiler (best time is reported)")
+	parser.add_argument("--jobs", type=int, help="pass -j JOBS to the compiler under test")
+	args = parser.parse_args()
+	extra_args = ["-j", str(args.jobs)] if args.jobs else []
+
+	compilers = [args.compiler] + ([args.baseline] if args.baseline else [])
+	for compiler in compilers:
+		if not os.path.exists(compiler):
+			print(f"Compiler not found at '{compiler}'! Run 'make' first.")
+			sys.exit(1)
+
+	with tempfile.TemporaryDirectory() as tmp:
+		source = os.path.join(tmp, "bench.he")
+		output = os.path.join(tmp, "bench.s")
+		with open(source, "w") as f:
+			f.write(generate_source(args.functions))
+
+		size_kib = os.path.getsize(source) // 1024
+		print(f"Input: {args.functions} functions, {size_kib} KiB, best of {args.runs} runs")
+		print(f"{'compiler':<32} {'time (s)':>10} {'peak RSS (KiB)':>16}")
+
+		results = []
+		for compiler in compilers:
+			# The baseline may predate -j, so it always runs with its defaults
+			elapsed, rss = bench(compiler, source, output, args.runs,
+								 extra_args if compiler == args.compiler else [])
+			results.append((elapsed, rss))
+			print(f"{compiler:<32} {elapsed:>10.3f} {rss:>16}")
+
+	if len(results) == 2:
+		(t_new, m_new), (t_old, m_old) = results
+		print("-" * 60)
+		print(f"time: {t_new / t_old:.2f}x baseline, peak RSS: {m_new / m_old:.2f}x baseline")
+
+if __name__ == "__main__":
+	main()
@@ -0,0 +1,228 @@
+#!/usr/bin/env python3
+
+# Runtime benchmarks for code generated by heliumc. Every bench/*.he program
+# is compiled, assembled and linked like a test, then run several times.
+# Results (best wall time, getrusage figures, binary size and the number of
+# instructions emitted) are written as JSON and compared against a stored
+# baseline; the run fails if anything got worse by more than --threshold.
+#
+# Programs use the same directives as tests/ to check their output, plus
+#   // bench-args: {input} {output}
+# where {input} is a generated data file and {output} a scratch path.
+
+import argparse
+import glob
+import json
+import os
+import platform
+import statistics
+import subprocess
+import sys
+import tempfile
+import time
+
+# Configuration
+COMPILER = "bin/heliumc"  # Path to your compiler binary
+BENCH_DIR = "bench"
+BASELINE = os.path.join(BENCH_DIR, "baseline.json")
+RESULTS = os.path.join(BENCH_DIR, "results.json")
+INPUT_SIZE = 32 * 1024 * 1024  # Bytes in the {input} file
+
+# Colors
+GREEN = "\033[92m"
+RED = "\033[91m"
+RESET = "\033[0m"
+
+# Lines of assembly that are data rather than instructions
+DATA_DIRECTIVES = {"db", "dw", "dd", "dq", "resb", "resw", "resd", "resq", "times"}
+
+# Time differences smaller than this are noise, whatever the ratio
+MIN_TIME_DELTA = 0.005
+
+def parse_directives(filepath):
+	expected_out = []
+	expected_exit = 0
+	args = []
+	with open(filepath, "r") as f:
+		for line in f:
+			line = line.strip()
+			if line.startswith("// expect-out:"):
+				expected_out.append(line.split(":", 1)[1].strip())
+			elif line.startswith("// expect-exit:"):
+				expected_exit = int(line.split(":", 1)[1].strip())
+			elif line.startswith("// bench-args:"):
+				args = line.split(":", 1)[1].split()
+	return "\n".join(expected_out), expected_exit, args
+
+def count_instructions(asm_file):
+	count = 0
+	with open(asm_file, "r") as f:
+		for line in f:
+			# Instructions are indented; labels and directives are not
+			if not line.startswith((" ", "\t")):
+				continue
+			words = line.split(None, 1)
+			if words and not words[0].startswith(";") and words[0] not in DATA_DIRECTIVES:
+				count += 1
+	return count
+
+def build(compiler, source, tmp):
+	name = os.path.splitext(os.path.basename(source))[0]
+	asm_file = os.path.join(tmp, name + ".s")
+	obj_file = os.path.join(tmp, name + ".o")
+	exe_file = os.path.join(tmp, name)
+	steps = [
+		[compiler, "-o", asm_file, source],
+		["nasm", "-f", "elf64", "-o", obj_file, asm_file],
+		["ld", "-o", exe_file, obj_file],
+	]
+	for step in steps:
+		result = subprocess.run(step, capture_output=True, text=True)
+		if result.returncode != 0:
+			return None, f"{step[0]} failed:\n{result.stderr}"
+	return exe_file, count_instructions(asm_file)
+
+def run_once(command, stdout_file):
+	# wait4() gives this child's own rusage rather than a running total. Its
+	# peak RSS can't be lower than ours at fork time, so keep this process small.
+	with open(stdout_file, "w") as out:
+		start = time.perf_counter()
+		proc = subprocess.Popen(command, stdout=out, stderr=subprocess.DEVNULL)
+		_, status, usage = os.wait4(proc.pid, 0)
+		elapsed = time.perf_counter() - start
+	return elapsed, os.waitstatus_to_exitcode(status), usage
+
+def bench(source, compiler, runs, tmp, input_file):
+	expected_out, expected_exit, args = parse_directives(source)
+	exe_file, info = build(compiler, source, tmp)
+	if exe_file is None:
+		return None, info
+
+	scratch = os.path.join(tmp, "scratch.out")
+	command = [exe_file] + [a.format(input=input_file, output=scratch) for a in args]
+	stdout_file = os.path.join(tmp, "stdout.txt")
+
+	times = []
+	best = None
+	for i in range(runs):
+		elapsed, code, usage = run_once(command, stdout_file)
+		if code != expected_exit:
+			return None, f"exit code {code}, expected {expected_exit}"
+		if i == 0 and expected_out:
+			with open(stdout_file, "r") as f:
+				actual_out = f.read().strip()
+			if actual_out != expected_out:
+				return None, f"output mismatch:\n  expected: {expected_out!r}\n  actual:   {actual_out!r}"
+		times.append(elapsed)
+		if best is None or elapsed < best[0]:
+			best = (elapsed, usage)
+
+	elapsed, usage = best
+	return {
+		"wall_s": round(elapsed, 6),
+		"wall_median_s": round(statistics.median(times), 6),
+		"user_s": round(usage.ru_utime, 6),
+		"sys_s": round(usage.ru_stime, 6),
+		"max_rss_kib": usage.ru_maxrss,
+		"minor_faults": usage.ru_minflt,
+		"major_faults": usage.ru_majflt,
+		"voluntary_switches": usage.ru_nvcsw,
+		"involuntary_switches": usage.ru_nivcsw,
+		"binary_bytes": os.path.getsize(exe_file),
+		"instructions": info,
+	}, None
+
+def regressions(name, new, old, threshold):
+	found = []
+	for key in ("wall_s", "binary_bytes", "instructions"):
+		if key not in old:
+			continue
+		limit = old[key] * (1 + threshold)
+		if key == "wall_s":
+			limit = max(limit, old[key] + MIN_TIME_DELTA)
+		if new[key] > limit:
+			found.append(f"{name}: {key} {old[key]} -> {new[key]} ({new[key] / old[key]:.2f}x)")
+	return found
+
+def main():
+	parser = argparse.ArgumentParser(description="Runtime benchmarks for programs compiled by heliumc")
+	parser.add_argument("programs", nargs="*", help="programs to run, e.g. fib (default: bench/*.he)")
+	parser.add_argument("--compiler", default=COMPILER, help="compiler under test")
+	parser.add_argument("--runs", type=int, default=5, help="runs per program (best time is compared)")
+	parser.add_argument("--baseline", default=BASELINE, help="baseline to compare against")
+	parser.add_argument("--output", default=RESULTS, help="where to write the results")
+	parser.add_argument("--threshold", type=float, default=0.10,
+						help="allowed slowdown or growth as a fraction (default: 0.10)")
+	parser.add_argument("--update-baseline", action="store_true", help="store these results as the baseline")
+	args = parser.parse_args()
+
+	if not os.path.exists(args.compiler):
+		print(f"Compiler not found at '{args.compiler}'! Run 'make' first.")
+		sys.exit(1)
+
+	programs = [p if p.endswith(".he") else os.path.join(BENCH_DIR, p + ".he") for p in args.programs]
+	programs = programs or sorted(glob.glob(os.path.join(BENCH_DIR, "*.he")))
+	baseline = {}
+	if os.path.exists(args.baseline) and not args.update_baseline:
+		with open(args.baseline, "r") as f:
+			baseline = json.load(f).get("programs", {})
+
+	results = {}
+	failures = []
+	found = []
+	print(f"{'program':<16} {'wall (s)':>10} {'baseline':>10} {'user (s)':>10} {'sys (s)':>10} "
+		  f"{'RSS (KiB)':>10} {'bytes':>8} {'insns':>6}")
+
+	with tempfile.TemporaryDirectory() as tmp:
+		input_file = os.path.join(tmp, "input.bin")
+		with open(input_file, "wb") as f:
+			block = bytes((i * 131 + (i >> 9)) & 255 for i in range(65536))
+			for _ in range(INPUT_SIZE // len(block)):
+				f.write(block)
+
+		for source in programs:
+			name = os.path.splitext(os.path.basename(source))[0]
+			result, error = bench(source, args.compiler, args.runs, tmp, input_file)
+			if result is None:
+				print(f"{RED}{name:<16} FAIL{RESET} {error}")
+				failures.append(name)
+				continue
+
+			results[name] = result
+			old = baseline.get(name)
+			problems = regressions(name, result, old, args.threshold) if old else []
+			found.extend(problems)
+			color = RED if problems else GREEN
+			base_time = f"{old['wall_s']:>10.3f}" if old else f"{'-':>10}"
+			print(f"{color}{name:<16}{RESET} {result['wall_s']:>10.3f} {base_time} {result['user_s']:>10.3f} "
+				  f"{result['sys_s']:>10.3f} {result['max_rss_kib']:>10} {result['binary_bytes']:>8} "
+				  f"{result['instructions']:>6}")
+
+	report = {
+		"machine": platform.machine(),
+		"kernel": platform.release(),
+		"runs": args.runs,
+		"programs": results,
+	}
+	with open(args.output, "w") as f:
+		json.dump(report, f, indent=2, sort_keys=True)
+		f.write("\n")
+	if args.update_baseline:
+		with open(args.baseline, "w") as f:
+			json.dump(report, f, indent=2, sort_keys=True)
+			f.write("\n")
+
+	print("-" * 30)
+	for problem in found:
+		print(f"{RED}regression{RESET} {problem}")
+	if args.update_baseline:
+		print(f"Baseline written to {args.baseline}")
+	elif not baseline:
+		print(f"No baseline at {args.baseline}; run with --update-baseline to create one")
+	print(f"Result: {len(results)}/{len(programs)} ran, {len(found)} regressions")
+
+	if failures or found:
+		sys.exit(1)
+
+if __name__ == "__main__":
+	main()
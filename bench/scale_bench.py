@@ -0,0 +1,216 @@
+#!/usr/bin/env python3
+
+# Compiles stress_gen.py inputs of doubling size and records the time of each
+# compiler phase (from --time-report=json) and peak RSS. For every shape it
+# fits a power law, time ~ size^k, over the sizes and fails if k is clearly
+# above 1, so quadratic behaviour is caught before anyone has to notice it.
+# A crash at some size (e.g. running out of stack) is reported as a failure.
+#
+# Results go to bench/scaling.json and one SVG chart per shape to
+# bench/scaling/, with log-log axes: a linear phase is a line of slope 1.
+
+import argparse
+import json
+import math
+import os
+import signal
+import subprocess
+import sys
+import tempfile
+
+sys.path.insert(0, os.path.dirname(os.path.abspath(__file__)))
+from stress_gen import SHAPES, generate
+
+# Configuration
+COMPILER = "bin/heliumc"  # Path to your compiler binary
+OUTPUT = "bench/scaling.json"
+PLOT_DIR = "bench/scaling"
+PHASES = ["preprocess", "parse", "optimize", "reachability", "codegen"]
+
+# Colors
+GREEN = "\033[92m"
+RED = "\033[91m"
+RESET = "\033[0m"
+
+def compile_once(compiler, source, output, extra_args):
+	# stderr goes to a file: a pipe would make the compiler wait on us
+	# whenever it prints many warnings
+	log = output + ".log"
+	with open(log, "w") as err:
+		proc = subprocess.run([compiler, *extra_args, "--time-report=json", "-o", output, source],
+							  stdout=subprocess.DEVNULL, stderr=err)
+	with open(log, "r") as f:
+		lines = f.read().strip().splitlines() or [""]
+	if proc.returncode != 0:
+		if proc.returncode < 0:
+			return None, f"killed by {signal.Signals(-proc.returncode).name}"
+		return None, f"exit code {proc.returncode}: {lines[-1]}"
+	# Warnings may precede the report, which is the last line
+	return json.loads(lines[-1]), None
+
+def measure(compiler, shape, size, runs, tmp, extra_args):
+	source = os.path.join(tmp, f"{shape}.he")
+	output = os.path.join(tmp, f"{shape}.s")
+	with open(source, "w") as f:
+		f.write(generate(shape, size))
+
+	best = None
+	for _ in range(runs):
+		report, error = compile_once(compiler, source, output, extra_args)
+		if report is None:
+			return None, error
+		if best is None or report["total_wall_ms"] < best["total_wall_ms"]:
+			best = report
+
+	point = {"size": size, "source_bytes": os.path.getsize(source)}
+	for phase in PHASES:
+		point[phase] = best["phases"][phase]["wall_ms"]
+	point["total"] = best["total_wall_ms"]
+	point["max_rss_kib"] = best["max_rss_kib"]
+	point["tokens"] = best["tokens"]
+	point["nodes"] = best["nodes"]
+	return point, None
+
+def fit_exponent(points, key, floor):
+	# Least-squares slope of log(value) against log(size). Values below the
+	# noise floor carry no information about growth and are left out.
+	xs = [math.log(p["size"]) for p in points if p[key] >= floor]
+	ys = [math.log(p[key]) for p in points if p[key] >= floor]
+	if len(xs) < 3:
+		return None
+	mx = sum(xs) / len(xs)
+	my = sum(ys) / len(ys)
+	var = sum((x - mx) ** 2 for x in xs)
+	return sum((x - mx) * (y - my) for x, y in zip(xs, ys)) / var
+
+# ========================================================================= #
+# SVG CHARTS
+# ========================================================================= #
+
+SERIES_COLORS = ["#1f77b4", "#ff7f0e", "#2ca02c", "#d62728", "#9467bd", "#000000"]
+
+def svg_panel(x0, title, points, keys, unit):
+	width, height, margin = 420, 300, 50
+	values = [p[k] for p in points for k in keys if p[k] > 0]
+	if not values:
+		return []
+	lo_x, hi_x = math.log(points[0]["size"]), math.log(points[-1]["size"])
+	lo_y, hi_y = math.log(min(values)), math.log(max(values))
+	if hi_x == lo_x: hi_x += 1
+	if hi_y == lo_y: hi_y += 1
+
+	def sx(v): return x0 + margin + (math.log(v) - lo_x) / (hi_x - lo_x) * (width - 2 * margin)
+	def sy(v): return height - margin - (math.log(v) - lo_y) / (hi_y - lo_y) * (height - 2 * margin)
+
+	out = [f'<text x="{x0 + width / 2}" y="20" text-anchor="middle">{title}</text>',
+		   f'<rect x="{x0 + margin}" y="{margin}" width="{width - 2 * margin}" '
+		   f'height="{height - 2 * margin}" fill="none" stroke="#888"/>',
+		   f'<text x="{x0 + width / 2}" y="{height - 10}" text-anchor="middle">size (log)</text>',
+		   f'<text x="{x0 + 5}" y="{margin - 8}">{unit} (log)</text>']
+	for p in points:
+		out.append(f'<text x="{sx(p["size"]):.1f}" y="{height - margin + 14}" '
+				   f'text-anchor="middle" font-size="10">{p["size"]}</text>')
+	for v in (min(values), max(values)):
+		out.append(f'<text x="{x0 + margin - 4}" y="{sy(v) + 4:.1f}" text-anchor="end" '
+				   f'font-size="10">{v:g}</text>')
+	for i, key in enumerate(keys):
+		color = SERIES_COLORS[i % len(SERIES_COLORS)]
+		coords = " ".join(f"{sx(p['size']):.1f},{sy(p[key]):.1f}" for p in points if p[key] > 0)
+		out.append(f'<polyline points="{coords}" fill="none" stroke="{color}" stroke-width="2"/>')
+		out.append(f'<text x="{x0 + width - margin + 4}" y="{margin + 14 * i + 10}" fill="{color}" '
+				   f'font-size="11">{key}</text>')
+	return out
+
+def write_svg(path, shape, points):
+	parts = ['<svg xmlns="http://www.w3.org/2000/svg" width="900" height="300" '
+			 'font-family="sans-serif" font-size="12">',
+			 '<rect width="100%" height="100%" fill="white"/>']
+	parts += svg_panel(0, f"{shape}: wall time per phase", points, PHASES + ["total"], "ms")
+	parts += svg_panel(460, f"{shape}: peak RSS", points, ["max_rss_kib"], "KiB")
+	parts.append("</svg>")
+	with open(path, "w") as f:
+		f.write("\n".join(parts) + "\n")
+
+# ========================================================================= #
+# MAIN
+# ========================================================================= #
+
+def main():
+	parser = argparse.ArgumentParser(description="Compile-time scaling benchmark for heliumc")
+	parser.add_argument("shapes", nargs="*", help=f"shapes to run (default: all of {', '.join(SHAPES)})")
+	parser.add_argument("--compiler", default=COMPILER, help="compiler under test")
+	parser.add_argument("--steps", type=int, default=5, help="sizes per shape, each double the last")
+	parser.add_argument("--scale", type=float, default=1.0, help="multiply every starting size by this")
+	parser.add_argument("--runs", type=int, default=3, help="compiles per size (best time is used)")
+	parser.add_argument("--jobs", type=int, help="pass -j JOBS to the compiler")
+	parser.add_argument("--tolerance", type=float, default=0.3,
+						help="fail when time grows faster than size^(1 + TOLERANCE) (default: 0.3)")
+	parser.add_argument("--noise-ms", type=float, default=2.0, help="ignore phases faster than this")
+	parser.add_argument("--output", default=OUTPUT, help="where to write the results")
+	parser.add_argument("--plot-dir", default=PLOT_DIR, help="where to write the SVG charts")
+	args = parser.parse_args()
+	extra_args = ["-j", str(args.jobs)] if args.jobs else []
+
+	if not os.path.exists(args.compiler):
+		print(f"Compiler not found at '{args.compiler}'! Run 'make' first.")
+		sys.exit(1)
+	for shape in args.shapes:
+		if shape not in SHAPES:
+			print(f"Unknown shape '{shape}'")
+			sys.exit(1)
+
+	os.makedirs(args.plot_dir, exist_ok=True)
+	results = {}
+	problems = []
+
+	with tempfile.TemporaryDirectory() as tmp:
+		for shape in args.shapes or SHAPES:
+			start = max(1, int(SHAPES[shape][1] * args.scale))
+			points = []
+			print(f"{shape}")
+			print(f"  {'size':>8} " + " ".join(f"{p[:8]:>8}" for p in PHASES) + f" {'total':>8} {'RSS KiB':>8}")
+			for step in range(args.steps):
+				size = start << step
+				point, error = measure(args.compiler, shape, size, args.runs, tmp, extra_args)
+				if point is None:
+					print(f"  {RED}{size:>8} FAIL{RESET} {error}")
+					problems.append(("failed", f"{shape}: size {size} failed to compile ({error})"))
+					break
+				points.append(point)
+				print(f"  {size:>8} " + " ".join(f"{point[p]:>8.2f}" for p in PHASES) +
+					  f" {point['total']:>8.2f} {point['max_rss_kib']:>8}")
+
+			exponents = {}
+			for key in PHASES + ["total", "max_rss_kib"]:
+				floor = args.noise_ms if key != "max_rss_kib" else 0
+				exponents[key] = fit_exponent(points, key, floor)
+
+			cells = []
+			for key in PHASES + ["total", "max_rss_kib"]:
+				k = exponents[key]
+				if k is None:
+					cells.append(f"{'-':>8}")
+				elif k > 1 + args.tolerance:
+					cells.append(f"{RED}{k:>8.2f}{RESET}")
+					problems.append(("superlinear", f"{shape}: {key} grows as size^{k:.2f}"))
+				else:
+					cells.append(f"{GREEN}{k:>8.2f}{RESET}")
+			print(f"  {'size^k':>8} " + " ".join(cells))
+
+			results[shape] = {"points": points, "exponents": exponents}
+			if points:
+				write_svg(os.path.join(args.plot_dir, f"{shape}.svg"), shape, points)
+
+	with open(args.output, "w") as f:
+		json.dump(results, f, indent=2, sort_keys=True)
+		f.write("\n")
+
+	print("-" * 30)
+	for kind, problem in problems:
+		print(f"{RED}{kind}{RESET} {problem}")
+	print(f"Result: {len(results)} shapes, {len(problems)} problems; charts in {args.plot_dir}/")
+	if problems:
+		sys.exit(1)
+
+if __name__ == "__main__":
+	main()
@@ -0,0 +1,120 @@
+#!/usr/bin/env python3
+
+# Generates large, deterministic Helium programs that stress one dimension
+# of the compiler each. The output for a given shape and size never changes,
+# so timings taken from different builds can be compared directly.
+#
+#   ./bench/stress_gen.py <shape> <size> [-o file.he]
+
+import argparse
+import os
+import sys
+
+sys.path.insert(0, os.path.dirname(os.path.abspath(__file__)))
+from compile_bench import generate_source
+
+def gen_functions(n):
+	# Many small functions, all called from main
+	return generate_source(n)
+
+def gen_block(n):
+	# One block with n statements: a long 'next' chain
+	out = ["fn main()\n{\n\tint x = 1;\n"]
+	for i in range(n):
+		out.append(f"\tx = x + {i % 7} + (x >> 3);\n")
+	out.append("\treturn x % 256;\n}\n")
+	return "".join(out)
+
+def gen_nesting(n):
+	# n nested blocks, alternating if, while and if/else. Nothing declares a
+	# variable (that is what "locals" measures), and lines are not indented
+	# by depth, which would make the source itself grow quadratically.
+	out = ["fn main()\n{\n\tint x = 0;\n"]
+	for i in range(n):
+		kind = i % 3
+		if kind == 0:
+			out.append(f"\tif x < {i + 1} {{\n")
+		elif kind == 1:
+			out.append(f"\twhile x < {i + 1} {{\n")
+		else:
+			out.append(f"\tif x > {i * 2} {{\n\tx = 0;\n\t}} else {{\n")
+		out.append("\tx = x + 1;\n")
+	out.append("\t}\n" * n)
+	out.append("\treturn x % 256;\n}\n")
+	return "".join(out)
+
+def gen_expression(n):
+	# One expression with n operands: a deep left-leaning tree
+	ops = ["+", "-", "*", "|", "&", "+"]
+	terms = ["a"]
+	for i in range(1, n):
+		terms.append(f" {ops[i % len(ops)]} {'a' if i % 2 else 'b'}")
+	return f"fn main()\n{{\n\tint a = 3;\n\tint b = 5;\n\tint x = {''.join(terms)};\n\treturn x % 256;\n}}\n"
+
+def gen_locals(n):
+	# One function with n live locals. Frames are fixed in size, so heliumc
+	# warns about the stack; only compiling the program is measured.
+	out = ["fn main()\n{\n"]
+	for i in range(n):
+		out.append(f"\tint v{i} = {i};\n")
+	out.append("\tint sum = 0;\n")
+	for i in range(n):
+		out.append(f"\tsum = sum + v{i};\n")
+	out.append("\treturn sum % 256;\n}\n")
+	return "".join(out)
+
+def gen_macros(n):
+	# n macros, each used once
+	out = []
+	for i in range(n):
+		out.append(f"#define M{i} {i * 3}\n")
+	out.append("\nfn main()\n{\n\tint x = 0;\n")
+	for i in range(n):
+		out.append(f"\tx = x + M{i};\n")
+	out.append("\treturn x % 256;\n}\n")
+	return "".join(out)
+
+def gen_structs(n):
+	# n struct types, each used by its own function
+	out = []
+	for i in range(n):
+		out.append(f"struct S{i} {{\n\ta: int,\n\tb: u32,\n\tc: u8,\n\tnext: ptr,\n}};\n\n")
+	for i in range(n):
+		out.append(f"fn use{i}(v: int) -> int\n{{\n\tS{i} s;\n\ts.a = v;\n\ts.b = v + {i};\n")
+		out.append("\ts.c = 1;\n\treturn s.a + s.b + s.c + sizeof(S" + str(i) + ");\n}\n\n")
+	out.append("fn main()\n{\n\tint t = 0;\n")
+	for i in range(n):
+		out.append(f"\tt = t + use{i}({i % 11});\n")
+	out.append("\treturn t % 256;\n}\n")
+	return "".join(out)
+
+# Shape name -> (generator, default smallest size)
+SHAPES = {
+	"functions": (gen_functions, 500),
+	"block": (gen_block, 2000),
+	"nesting": (gen_nesting, 200),
+	"expression": (gen_expression, 1000),
+	"locals": (gen_locals, 1000),
+	"macros": (gen_macros, 500),
+	"structs": (gen_structs, 100),
+}
+
+def generate(shape, size):
+	return SHAPES[shape][0](size)
+
+def main():
+	parser = argparse.ArgumentParser(description="Deterministic stress inputs for heliumc")
+	parser.add_argument("shape", choices=sorted(SHAPES))
+	parser.add_argument("size", type=int, help="functions, statements, nesting depth, ... depending on shape")
+	parser.add_argument("-o", "--output", help="output file (default: stdout)")
+	args = parser.parse_args()
+
+	source = generate(args.shape, args.size)
+	if args.output:
+		with open(args.output, "w") as f:
+			f.write(source)
+	else:
+		sys.stdout.write(source)
+
+if __name__ == "__main__":
+	main()
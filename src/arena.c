@@ -0,0 +1,51 @@
+#include "helium.h"
+
+/* ========================================================================= */
+/* ARENA ALLOCATOR															 */
+/* ========================================================================= */
+
+// Objects that live until the end of compilation (AST nodes, interned
+// names) are bump-allocated from large blocks and released all at once.
+
+struct ArenaBlock {
+	struct ArenaBlock *next;
+	size_t used;
+	size_t capacity;
+	_Alignas(16) char data[];
+};
+
+#define ARENA_BLOCK_SIZE (256 * 1024)
+
+void *arena_alloc(Arena *arena, size_t size, size_t align)
+{
+	ArenaBlock *block = arena->head;
+	size_t start = block ? (block->used + align - 1) & ~(align - 1) : 0;
+
+	if (!block || start + size > block->capacity) {
+		size_t capacity = size > ARENA_BLOCK_SIZE ? size : ARENA_BLOCK_SIZE;
+		block = malloc(sizeof(ArenaBlock) + capacity);
+		if (!block)
+			fatal("Error: Out of memory");
+		block->next = arena->head;
+		block->used = 0;
+		block->capacity = capacity;
+		arena->head = block;
+		arena->reserved += capacity;
+		start = 0;
+	}
+
+	block->used = start + size;
+	arena->allocated += size;
+	return block->data + start;
+}
+
+void arena_free(Arena *arena)
+{
+	while (arena->head) {
+		ArenaBlock *next = arena->head->next;
+		free(arena->head);
+		arena->head = next;
+	}
+	arena->allocated = 0;
+	arena->reserved = 0;
+}
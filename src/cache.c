@@ -0,0 +1,132 @@
+#include "helium.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/* ========================================================================= */
+/* COMPILATION CACHE														 */
+/* ========================================================================= */
+
+// With --cache-dir, generated assembly is stored under a hash of everything
+// that produced it:
+//   unit-<key>.s  A whole file, keyed by the preprocessed source. A hit is
+//                 copied out without lexing or parsing.
+//   fn-<key>.s    One function, keyed by its tokens (after macro expansion)
+//                 and the structs and globals it can see, so editing one
+//                 function leaves the others' entries valid.
+// Entries are written to a temporary file and renamed into place, so
+// concurrent compilers never see half an entry. Failing to read or write
+// the cache is never an error; the code is simply generated again.
+
+// 128-bit FNV-1a
+static const unsigned __int128 FNV_PRIME =
+	((unsigned __int128)1 << 88) | 0x13B;
+static const unsigned __int128 FNV_OFFSET =
+	((unsigned __int128)0x6c62272e07bb0142ul << 64) | 0x62b821756295c58dul;
+
+void cache_key_init(CacheKey *key)
+{
+	key->lo = (unsigned long)FNV_OFFSET;
+	key->hi = (unsigned long)(FNV_OFFSET >> 64);
+}
+
+void cache_key_add(CacheKey *key, const void *data, size_t len)
+{
+	unsigned __int128 h = ((unsigned __int128)key->hi << 64) | key->lo;
+	const unsigned char *p = data;
+	for (size_t i = 0; i < len; i++) {
+		h ^= p[i];
+		h *= FNV_PRIME;
+	}
+	key->lo = (unsigned long)h;
+	key->hi = (unsigned long)(h >> 64);
+}
+
+// Names are hashed by content: interned pointers differ from run to run
+void cache_key_add_token(CacheKey *key, const Token *token)
+{
+	int type = token->type;
+	cache_key_add(key, &type, sizeof(type));
+	cache_key_add(key, &token->value, sizeof(token->value));
+	if (token->name)
+		cache_key_add(key, token->name, strlen(token->name) + 1);
+}
+
+// Writes "<cache_dir>/<kind>-<key>.s" into 'path'. Returns -1 if it does not fit.
+static
+int cache_path(char *path, size_t size, const char *kind, const CacheKey *key)
+{
+	int n = snprintf(path, size, "%s/%s-%016lx%016lx.s", hc->cache_dir, kind, key->hi, key->lo);
+	return (n < 0 || (size_t)n >= size) ? -1 : 0;
+}
+
+// Returns the cached text (malloc'd, NUL-terminated) or NULL on a miss
+char *cache_load(const char *kind, const CacheKey *key, size_t *len)
+{
+	char path[4096];
+	if (cache_path(path, sizeof(path), kind, key) != 0)
+		return NULL;
+
+	int fd = open(path, O_RDONLY);
+	if (fd < 0) return NULL;
+
+	struct stat st;
+	char *text = NULL;
+	if (fstat(fd, &st) == 0 && (text = malloc(st.st_size + 1))) {
+		size_t done = 0;
+		while (done < (size_t)st.st_size) {
+			ssize_t n = read(fd, text + done, st.st_size - done);
+			if (n < 0 && errno == EINTR) continue;
+			if (n <= 0) break;
+			done += n;
+		}
+		if (done == (size_t)st.st_size) {
+			text[done] = '\0';
+			*len = done;
+		} else {
+			free(text);
+			text = NULL;
+		}
+	}
+	close(fd);
+	return text;
+}
+
+static
+int write_all(int fd, const char *text, size_t len)
+{
+	size_t done = 0;
+	while (done < len) {
+		ssize_t n = write(fd, text + done, len - done);
+		if (n < 0) {
+			if (errno == EINTR) continue;
+			return -1;
+		}
+		done += n;
+	}
+	return 0;
+}
+
+void cache_store(const char *kind, const CacheKey *key, const char *text, size_t len)
+{
+	static int temp_counter = 0;
+
+	char path[4096];
+	char temp[4096 + 64];
+	if (cache_path(path, sizeof(path), kind, key) != 0)
+		return;
+	snprintf(temp, sizeof(temp), "%s.%d.%d.tmp", path, (int)getpid(),
+			 __atomic_fetch_add(&temp_counter, 1, __ATOMIC_RELAXED));
+
+	int fd = open(temp, O_WRONLY | O_CREAT | O_EXCL, 0644);
+	if (fd < 0 && errno == ENOENT && mkdir(hc->cache_dir, 0755) == 0)
+		fd = open(temp, O_WRONLY | O_CREAT | O_EXCL, 0644);
+	if (fd < 0) return;
+
+	int failed = write_all(fd, text, len) != 0;
+	failed |= close(fd) != 0;
+	if (failed || rename(temp, path) != 0)
+		unlink(temp);
+}
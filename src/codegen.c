@@ -1,14 +1,39 @@
 #include "helium.h"
 
+#include <pthread.h>
+#include <unistd.h>
+
 #define MAX_STACK_SIZE 4096
 
-// Label generation for if/while/strings
-static int label_counter = 0;
+/* ========================================================================= */
+/* CODEGEN CONTEXT															 */
+/* ========================================================================= */
+
+// Everything that changes while a function is generated. Each thread has
+// its own, so reachable functions can be generated in parallel; the struct
+// and global tables are only read once parsing is over.
 
+typedef struct Symbol Symbol;
+
+typedef struct {
+	const char *func_name;	// Current function, for warnings
+	int label_counter;		// Restarts in every function
+	int stack_offset;
+	Table local_table;		// See "Locals" below
+	Symbol **local_stack;
+	int local_count;
+	int local_capacity;
+	Arena arena;			// Symbols of the current function
+} CodegenContext;
+
+static __thread CodegenContext *ctx = NULL;
+
+// Label generation for if/while/strings. NASM scopes '.L' labels to the
+// function label before them, so numbers only need to be unique per function.
 static
 int new_label()
 {
-	return label_counter++;
+	return ctx->label_counter++;
 }
 
 
@@ -16,48 +41,222 @@ int new_label()
 /* STRUCT REGISTRY															 */
 /* ========================================================================= */
 
-// Structs
-StructDef struct_registry[20];
-int struct_count = 0;
-
+// Structs are kept in hc->struct_table, keyed by name
 StructDef *get_struct(const char *name)
 {
-	for (int i = 0; i < struct_count; i++) {
-		if (strcmp(struct_registry[i].name, name) == 0)
-			return &struct_registry[i];
+	return table_get(&hc->struct_table, name);
+}
+
+StructDef *add_struct(const char *name)
+{
+	if (get_struct(name))
+		error_at_pos(hc->current_token.line, hc->current_token.column, hc->current_token.offset,
+					 "Struct '%s' is already defined", name);
+
+	StructDef *sdef = arena_alloc(&hc->ast_arena, sizeof(StructDef), _Alignof(StructDef));
+	memset(sdef, 0, sizeof(StructDef));
+	sdef->name = name;
+	table_put(&hc->struct_table, name, sdef);
+	return sdef;
+}
+
+// Returns a zeroed slot at the end of the member list
+StructMember *add_struct_member(StructDef *sdef)
+{
+	if (sdef->member_count == sdef->member_capacity) {
+		// Old arrays stay in the arena; structs are few and small
+		int capacity = sdef->member_capacity ? sdef->member_capacity * 2 : 8;
+		StructMember *members = arena_alloc(&hc->ast_arena, capacity * sizeof(StructMember),
+											_Alignof(StructMember));
+		if (sdef->member_count)
+			memcpy(members, sdef->members, sdef->member_count * sizeof(StructMember));
+		sdef->members = members;
+		sdef->member_capacity = capacity;
+	}
+
+	StructMember *member = &sdef->members[sdef->member_count++];
+	memset(member, 0, sizeof(StructMember));
+	return member;
+}
+
+static
+StructMember *find_member(StructDef *sdef, const char *name)
+{
+	for (int i = 0; i < sdef->member_count; i++) {
+		if (sdef->members[i].name == name)
+			return &sdef->members[i];
 	}
 	return NULL;
 }
 
 /* ========================================================================= */
-/* CODE GENERATOR															 */
+/* PRIMITIVE TYPES															 */
 /* ========================================================================= */
 
-// Symbol Table to map "x" -> stack offset
 typedef struct {
-	char name[256];
-	int offset; // e.g., -8, -16
-	char type_name[64]; // int, ptr, Point
-} Symbol;
+	const char *name;
+	int size;           // Bytes in memory
+	int is_unsigned;    // Use div/shr/seta/setb instead of idiv/sar/setg/setl
+	int sign_extends;   // Loads use movsx instead of movzx
+} PrimType;
+
+// 'char' keeps its historical behaviour: zero-extended loads, signed math
+static const PrimType prim_types[] = {
+	{"int",  8, 0, 0}, {"ptr",  8, 0, 0}, {"char", 1, 0, 0},
+	{"i8",   1, 0, 1}, {"i16",  2, 0, 1}, {"i32",  4, 0, 1}, {"i64",  8, 0, 0},
+	{"u8",   1, 1, 0}, {"u16",  2, 1, 0}, {"u32",  4, 1, 0}, {"u64",  8, 1, 0},
+};
+
+#define PRIM_TYPE_COUNT (sizeof(prim_types) / sizeof(prim_types[0]))
+
+// Registers asm operands can name
+static const char *const asm_registers[] = {
+	"rax", "rbx", "rcx", "rdx", "rsi", "rdi", "rbp", "rsp",
+	"r8", "r9", "r10", "r11", "r12", "r13", "r14", "r15",
+};
+
+#define ASM_REGISTER_COUNT (sizeof(asm_registers) / sizeof(asm_registers[0]))
+
+// Interns every name the parser and codegen compare against. Code
+// generation threads must never intern, since that would modify the table.
+void init_codegen(void)
+{
+	for (size_t i = 0; i < PRIM_TYPE_COUNT; i++)
+		table_put(&hc->prim_table, intern_cstr(prim_types[i].name), (void *)&prim_types[i]);
+	for (size_t i = 0; i < ASM_REGISTER_COUNT; i++) {
+		const char *name = intern_cstr(asm_registers[i]);
+		table_put(&hc->asm_register_table, name, (void *)name);
+	}
+	hc->name_int = intern_cstr("int");
+	hc->name_ptr = intern_cstr("ptr");
+	hc->name_u8 = intern_cstr("u8");
+	hc->name_rbp = intern_cstr("rbp");
+	hc->name_main = intern_cstr("main");
+	hc->name_flush_all = intern_cstr(EXIT_HOOK);
+	hc->name_rsp = intern_cstr("rsp");
+	hc->name_out = intern_cstr("out");
+	hc->name_clobber = intern_cstr("clobber");
+}
 
-Symbol symbols[100];
-int symbol_count = 0;
-int current_stack_offset = 0;
+static
+const PrimType *get_prim_type(const char *name)
+{
+	return table_get(&hc->prim_table, name);
+}
+
+// Size of a type in memory (primitives and structs)
+int type_size(const char *type)
+{
+	const PrimType *pt = get_prim_type(type);
+	if (pt)
+		return pt->size;
+
+	const StructDef *sdef = get_struct(type);
+	if (sdef)
+		return sdef->size;
+
+	return 8;
+}
 
+int type_is_unsigned(const char *type)
+{
+	const PrimType *pt = get_prim_type(type);
+	return pt && pt->is_unsigned;
+}
+
+// Load a 'type' value from [base + disp] into rax, widened to 64 bits.
+// Struct-typed slots hold a pointer, so anything non-primitive is 8 bytes.
 static
-Symbol *get_symbol(const char *name, int line, int col, int offset)
+void emit_load(const char *type, const char *base, int disp)
 {
-	for (int i = 0; i < symbol_count; i++) {
-		if (strcmp(symbols[i].name, name) == 0) {
-			return &symbols[i];
-		}
+	const PrimType *pt = get_prim_type(type);
+	int size = pt ? pt->size : 8;
+	int sign = pt && pt->sign_extends;
+
+	switch (size) {
+		case 1:
+			emitf(asm_out, "  %s rax, byte [%s + %d]\n", sign ? "movsx" : "movzx", base, disp);
+			break;
+		case 2:
+			emitf(asm_out, "  %s rax, word [%s + %d]\n", sign ? "movsx" : "movzx", base, disp);
+			break;
+		case 4:
+			if (sign)
+				emitf(asm_out, "  movsxd rax, dword [%s + %d]\n", base, disp);
+			else
+				emitf(asm_out, "  mov eax, dword [%s + %d]\n", base, disp); // Implicitly zero-extends
+			break;
+		default:
+			emitf(asm_out, "  mov rax, [%s + %d]\n", base, disp);
+			break;
 	}
+}
+
+// Store rax into a 'type' slot at [base + disp], truncating to its width
+static
+void emit_store(const char *type, const char *base, int disp)
+{
+	const PrimType *pt = get_prim_type(type);
+	int size = pt ? pt->size : 8;
+
+	switch (size) {
+		case 1: emitf(asm_out, "  mov [%s + %d], al\n", base, disp); break;
+		case 2: emitf(asm_out, "  mov [%s + %d], ax\n", base, disp); break;
+		case 4: emitf(asm_out, "  mov [%s + %d], eax\n", base, disp); break;
+		default: emitf(asm_out, "  mov [%s + %d], rax\n", base, disp); break;
+	}
+}
+
+/* ========================================================================= */
+/* CODE GENERATOR															 */
+/* ========================================================================= */
+
+// Symbol Table to map "x" -> stack offset
+struct Symbol {
+	const char *name;
+	int offset; // e.g., -8, -16 (0 for globals)
+	const char *type_name; // int, ptr, Point (element type for arrays)
+	const char *base;   // "rbp" for locals, "rel <name>" for globals
+	int is_array;
+	int is_const;
+	Symbol *shadowed;	// Outer binding of the same name, if any
+};
+
+// Locals: ctx->local_table maps each name to its innermost binding, and
+// ctx->local_stack records declaration order so leaving a scope can
+// restore shadowed names.
+
+// Globals outlive every function, so they get their own table
+// (hc->global_table)
+
+static
+Symbol *get_symbol(const char *name, int line, int col, int offset)
+{
+	Symbol *sym = table_get(&ctx->local_table, name);
+	if (!sym)
+		sym = table_get(&hc->global_table, name);
+	if (sym)
+		return sym;
 
 	char buffer[256];
 	snprintf(buffer, sizeof(buffer), "Undefined variable '%s'", name);
 	error_at_pos(line, col, offset, buffer);
+}
 
-	exit(1);
+// A scope is just a depth in local_stack
+static
+int enter_scope(void)
+{
+	return ctx->local_count;
+}
+
+static
+void leave_scope(int depth)
+{
+	while (ctx->local_count > depth) {
+		Symbol *sym = ctx->local_stack[--ctx->local_count];
+		table_put(&ctx->local_table, sym->name, sym->shadowed);
+	}
 }
 
 // Wrapper for old calls that just want the offset
@@ -68,21 +267,239 @@ int get_offset(const char *name)
 }
 
 static
-void add_symbol(const char *name, const char *type_name, int size)
+Symbol *add_symbol(const char *name, const char *type_name, int size)
 {
-	current_stack_offset -= size;  // Grow stack down by size bytes
+	ctx->stack_offset -= size;  // Grow stack down by size bytes
 
 	// WARNING CHECK
-	if ((-current_stack_offset) > MAX_STACK_SIZE) {
-		fprintf(stderr, "Warning: Stack overflow detected in function '%s'!\n", current_func_name);
+	if ((-ctx->stack_offset) > MAX_STACK_SIZE) {
+		fprintf(stderr, "Warning: Stack overflow detected in function '%s'!\n", ctx->func_name);
 		fprintf(stderr, "		  Variable '%s' pushes usage to %d bytes (Limit: %d)\n",
-				name, -current_stack_offset, MAX_STACK_SIZE);
+				name, -ctx->stack_offset, MAX_STACK_SIZE);
+	}
+
+	if (ctx->local_count == ctx->local_capacity) {
+		int capacity = ctx->local_capacity ? ctx->local_capacity * 2 : 64;
+		Symbol **stack = realloc(ctx->local_stack, capacity * sizeof(Symbol *));
+		if (!stack)
+			fatal("Error: Out of memory");
+		ctx->local_stack = stack;
+		ctx->local_capacity = capacity;
+	}
+
+	Symbol *sym = arena_alloc(&ctx->arena, sizeof(Symbol), _Alignof(Symbol));
+	sym->name = name;
+	sym->type_name = type_name;
+	sym->base = hc->name_rbp;
+	sym->offset = ctx->stack_offset;
+	sym->is_array = 0;
+	sym->is_const = 0;
+	sym->shadowed = table_get(&ctx->local_table, name);
+	table_put(&ctx->local_table, name, sym);
+	ctx->local_stack[ctx->local_count++] = sym;
+	return sym;
+}
+
+// Globals are addressed RIP-relative through their data label. The '$'
+// keeps NASM from reading a global named 'rcx' or 'byte' as a register or
+// keyword.
+static
+Symbol *add_global_symbol(const char *name, const char *type_name)
+{
+	char base[300];
+	snprintf(base, sizeof(base), "rel $%s", name);
+
+	Symbol *sym = arena_alloc(&hc->ast_arena, sizeof(Symbol), _Alignof(Symbol));
+	sym->name = name;
+	sym->type_name = type_name;
+	sym->base = intern_cstr(base);
+	sym->offset = 0;
+	sym->is_array = 0;
+	sym->is_const = 0;
+	sym->shadowed = NULL;
+	table_put(&hc->global_table, name, sym);
+	return sym;
+}
+
+static
+void check_writable(const Symbol *sym, const ASTNode *node)
+{
+	if (sym->is_const)
+		error_at_pos(node->line, node->column, node->offset,
+					 "Cannot assign to const '%s'", sym->name);
+}
+
+// Element type when indexing 'sym': arrays use their declared type,
+// plain pointers are indexed byte-wise like their arithmetic.
+static
+const char *element_type(const Symbol *sym)
+{
+	return sym->is_array ? sym->type_name : hc->name_u8;
+}
+
+// With the index in rbx, leave the address of element [rbx] of 'sym' in 'reg'
+static
+void emit_element_address(const Symbol *sym, const char *reg, const ASTNode *node)
+{
+	if (sym->is_array) {
+		emitf(asm_out, "  lea %s, [%s + %d]\n", reg, sym->base, sym->offset);
+	} else if (sym->type_name == hc->name_ptr) {
+		emitf(asm_out, "  mov %s, [%s + %d]\n", reg, sym->base, sym->offset);
+	} else {
+		error_at_pos(node->line, node->column, node->offset,
+					 "Variable '%s' is not an array or pointer", sym->name);
+	}
+
+	int scale = type_size(element_type(sym));
+	if (scale != 1)
+		emitf(asm_out, "  imul rbx, %d\n", scale);
+	emitf(asm_out, "  add %s, rbx\n", reg);
+}
+
+// Whether an expression should use unsigned division, shifts and comparisons
+static
+int expr_is_unsigned(ASTNode *node)
+{
+	switch (node->type) {
+		case NODE_VAR_REF: {
+			const Symbol *sym = get_symbol(node->var_name, node->line, node->column, node->offset);
+			return !sym->is_array && type_is_unsigned(sym->type_name);
+		}
+		case NODE_ARRAY_ACCESS: {
+			const Symbol *sym = get_symbol(node->var_name, node->line, node->column, node->offset);
+			return type_is_unsigned(element_type(sym));
+		}
+		case NODE_MEMBER_ACCESS: {
+			const Symbol *sym = get_symbol(node->left->var_name, node->line, node->column, node->offset);
+			StructDef *sdef = get_struct(sym->type_name);
+			const StructMember *member = sdef ? find_member(sdef, node->member_name) : NULL;
+			return member && type_is_unsigned(member->type_name);
+		}
+		case NODE_POST_INC:
+			return expr_is_unsigned(node->left);
+		case NODE_BINOP: {
+			// Every operator in a chain asks about its whole subtree, so
+			// remember the answer to keep long expressions linear
+			if (node->unsigned_known)
+				return node->is_unsigned;
+			// Shifts take their signedness from the value being shifted
+			if (node->op == '<' || node->op == '>')
+				node->is_unsigned = expr_is_unsigned(node->left);
+			else
+				node->is_unsigned = expr_is_unsigned(node->left) || expr_is_unsigned(node->right);
+			node->unsigned_known = 1;
+			return node->is_unsigned;
+		}
+		default:
+			return 0;
 	}
+}
+
+static
+int is_comparison(const ASTNode *node)
+{
+	return node->type == NODE_GT || node->type == NODE_LT ||
+		   node->type == NODE_EQ || node->type == NODE_NEQ;
+}
+
+// Evaluate a condition and jump to '.L<label>' when it is false.
+// Comparisons branch straight off the flags instead of materialising 0/1.
+static
+void gen_jump_if_false(ASTNode *cond, int label)
+{
+	if (!is_comparison(cond)) {
+		gen_asm(cond);
+		emitf(asm_out, "  pop rax\n");
+		emitf(asm_out, "  cmp rax, 0\n");
+		emitf(asm_out, "  je .L%d\n", label);
+		return;
+	}
+
+	int is_unsigned = expr_is_unsigned(cond->left) || expr_is_unsigned(cond->right);
+
+	gen_asm(cond->left);
+	gen_asm(cond->right);
+	emitf(asm_out, "  pop rbx\n");
+	emitf(asm_out, "  pop rax\n");
+	emitf(asm_out, "  cmp rax, rbx\n");
+
+	const char *jump = "jmp";
+	if (cond->type == NODE_EQ) jump = "jne";
+	if (cond->type == NODE_NEQ) jump = "je";
+	if (cond->type == NODE_GT) jump = is_unsigned ? "jbe" : "jle";
+	if (cond->type == NODE_LT) jump = is_unsigned ? "jae" : "jge";
+	emitf(asm_out, "  %s .L%d\n", jump, label);
+}
+
+// Whether 'val' can be used as a sign-extended 32-bit immediate
+static
+int fits_imm32(long val)
+{
+	return val >= -2147483648L && val <= 2147483647L;
+}
+
+/* ========================================================================= */
+/* INLINE ASSEMBLY															 */
+/* ========================================================================= */
+
+// Pop the pushed inputs of an asm into their registers, last one first
+static
+void pop_asm_inputs(const ASTNode *in)
+{
+	if (!in) return;
+	pop_asm_inputs(in->next);
+	emitf(asm_out, "  pop %s\n", in->member_name);
+}
+
+// Pop the pushed outputs of an asm into their variables, last one first
+static
+void store_asm_outputs(const ASTNode *out)
+{
+	if (!out) return;
+	store_asm_outputs(out->next);
+
+	const Symbol *sym = get_symbol(out->var_name, out->line, out->column, out->offset);
+	check_writable(sym, out);
+	if (sym->is_array)
+		error_at_pos(out->line, out->column, out->offset,
+					 "Cannot store an asm output in array '%s'", sym->name);
+	emitf(asm_out, "  pop rax\n");
+	emit_store(sym->type_name, sym->base, sym->offset);
+}
 
-	strcpy(symbols[symbol_count].name, name);
-	strcpy(symbols[symbol_count].type_name, type_name);
-	symbols[symbol_count].offset = current_stack_offset;
-	symbol_count++;
+// Write the template lines, each {name} replaced by the variable's memory
+// operand. The parser resolved the names in order into each line's 'left'.
+// {.name} becomes a local label numbered for this block, so the same name
+// can be used by every asm block and inside loops.
+static
+void emit_asm_template(const ASTNode *node)
+{
+	int block = new_label();
+	for (const ASTNode *line = node->increment; line; line = line->next) {
+		const ASTNode *operand = line->left;
+		const char *text = line->var_name;
+		emitf(asm_out, "  ");
+		while (*text) {
+			int len = asm_operand_length(text);
+			if (len && text[1] == '.') {
+				emitf(asm_out, ".L%d_", block);
+				emit_bytes(asm_out, text + 2, len - 3);
+				text += len;
+			} else if (len) {
+				const Symbol *sym = get_symbol(operand->var_name, operand->line,
+											   operand->column, operand->offset);
+				emitf(asm_out, "[%s + %d]", sym->base, sym->offset);
+				operand = operand->next;
+				text += len;
+			} else {
+				const char *start = text++;
+				while (*text && *text != '{')
+					text++;
+				emit_bytes(asm_out, start, text - start);
+			}
+		}
+		emitf(asm_out, "\n");
+	}
 }
 
 void gen_asm(ASTNode *node) {
@@ -90,43 +507,35 @@ void gen_asm(ASTNode *node) {
 
 	switch (node->type) {
 		case NODE_INT:
-			printf("  mov rax, %d\n", node->int_value); // Load immediate
-			printf("  push rax\n");
+			emitf(asm_out, "  mov rax, %ld\n", node->int_value); // Load immediate
+			emitf(asm_out, "  push rax\n");
 			break;
 
 		case NODE_VAR_REF: {
 			const Symbol *sym = get_symbol(node->var_name, node->line, node->column, node->offset);
 
-			// If it's a STRUCT, we push its address (like an array)
+			// If it's a STRUCT or ARRAY, we push its address
 			// If it's an INT/PTR, we push its value
 			const StructDef *sdef = get_struct(sym->type_name);
-			if (sdef) {
+			if (sdef || sym->is_array) {
 				// Struct: Push address (lea)
 				// This allows 'p = p2' to work via memcpy logic if we implemented it,
 				// but for now, passing structs by value isn't fully supported.
 				// We treat struct vars as their base address for member access.
-				printf("  lea rax, [rbp + %d]\n", sym->offset);
-			} else if (strcmp(sym->type_name, "char") == 0) {
-				printf("  movzx rax, byte [rbp + %d]\n", sym->offset);
+				emitf(asm_out, "  lea rax, [%s + %d]\n", sym->base, sym->offset);
 			} else {
-				printf("  mov rax, [rbp + %d]\n", sym->offset);
+				emit_load(sym->type_name, sym->base, sym->offset);
 			}
-			printf("  push rax\n");
+			emitf(asm_out, "  push rax\n");
 			break;
 		}
 
 		case NODE_VAR_DECL: {
 			// Determine Type & Size
 			const char *type = node->member_name;	// We stored type here in Parser
-			if (type == NULL) type = "int"; // Default safety
-
-			int size = 8;
-			if (strcmp(type, "char") == 0) size = 1;
+			if (type == NULL) type = hc->name_int; // Default safety
 
-			const StructDef *sdef = get_struct(type);
-			if (sdef) {
-				size = sdef->size;
-			}
+			int size = type_size(type);
 
 			// Evaluate Initializer (if any)
 			if (node->left) {
@@ -138,62 +547,46 @@ void gen_asm(ASTNode *node) {
 
 			// Move data from stack to variable slot
 			if (node->left) {
-				printf("  pop rax\n");
-
-				if (strcmp(type, "char") == 0)
-					printf("  mov [rbp + %d], al\n", get_offset(node->var_name));
-				else
-					printf("  mov [rbp + %d], rax\n", get_offset(node->var_name));
+				emitf(asm_out, "  pop rax\n");
+				emit_store(type, "rbp", get_offset(node->var_name));
 			}
 			break;
 		}
 
 		case NODE_MEMBER_ACCESS: {
-			if (node->left->type != NODE_VAR_REF) {
-				fprintf(stderr, "Error: Member access only supported on variables\n");
-				exit(1);
-			}
+			if (node->left->type != NODE_VAR_REF)
+				error_at_pos(node->line, node->column, node->offset,
+							 "Member access only supported on variables");
 
 			// Find variable info
 			const Symbol *sym = get_symbol(node->left->var_name, node->line, node->column, node->offset);
 			StructDef *sdef = get_struct(sym->type_name);
-			if (!sdef) {
-				fprintf(stderr, "Error: Variable '%s' is not a struct\n", sym->name);
-				exit(1);
-			}
+			if (!sdef)
+				error_at_pos(node->line, node->column, node->offset,
+							 "Variable '%s' is not a struct", sym->name);
 
 			// Find member offset
-			int mem_offset = -1;
-			for (int i = 0; i < sdef->member_count; i++) {
-				if (strcmp(sdef->members[i].name, node->member_name) == 0) {
-					mem_offset = sdef->members[i].offset;
-					break;
-				}
-			}
-			if (mem_offset == -1) {
-				fprintf(stderr, "Error: Struct '%s' has no member '%s'\n", sdef->name, node->member_name);
-				exit(1);
-			}
+			const StructMember *member = find_member(sdef, node->member_name);
+			if (!member)
+				error_at_pos(node->line, node->column, node->offset,
+							 "Struct '%s' has no member '%s'", sdef->name, node->member_name);
 
 			// GENERATE ADDRESS & LOAD
 			if (node->is_arrow_access) {
 				// HEAP ACCESS (p->x)
 				// Load the pointer address stored in the stack variable 'p'
-				printf("  mov rax, [rbp + %d]\n", sym->offset);
-
-				// Add the member offset
-				printf("  add rax, %d\n", mem_offset);
+				emitf(asm_out, "  mov rax, [%s + %d]\n", sym->base, sym->offset);
 
-				// Load the value AT that heap address
-				printf("  mov rax, [rax]\n");
+				// Load the value AT that heap address (plus the member offset)
+				emit_load(member->type_name, "rax", member->offset);
 			} else {
 				// STACK ACCESS (p.x)
 				// Calculate absolute stack address
-				int total_offset = sym->offset + mem_offset;
-				printf("  mov rax, [rbp + %d]\n", total_offset);
+				int total_offset = sym->offset + member->offset;
+				emit_load(member->type_name, sym->base, total_offset);
 			}
 
-			printf("  push rax\n");
+			emitf(asm_out, "  push rax\n");
 			break;
 		}
 
@@ -204,30 +597,31 @@ void gen_asm(ASTNode *node) {
 				const Symbol *sym = get_symbol(access->left->var_name, node->line, node->column, node->offset);
 				StructDef *sdef = get_struct(sym->type_name);
 
-				int mem_offset = 0;
-				for (int i=0; i<sdef->member_count; i++) {
-					 if (strcmp(sdef->members[i].name, access->member_name) == 0) {
-						 mem_offset = sdef->members[i].offset;
-						 break;
-					 }
-				}
+				const StructMember *member = find_member(sdef, access->member_name);
+				int mem_offset = member ? member->offset : 0;
 				int total_offset = sym->offset + mem_offset;
-				printf("  lea rax, [rbp + %d]\n", total_offset);
-				printf("  push rax\n");
+				emitf(asm_out, "  lea rax, [%s + %d]\n", sym->base, total_offset);
+				emitf(asm_out, "  push rax\n");
 				break;
 			}
 
 			// Standard variable &x
 			if (node->left->type == NODE_VAR_REF) {
-				int offset = get_offset(node->left->var_name);
-				printf("  lea rax, [rbp + %d]\n", offset);
-				printf("  push rax\n");
+				const ASTNode *var = node->left;
+				const Symbol *sym = get_symbol(var->var_name, var->line, var->column, var->offset);
+				emitf(asm_out, "  lea rax, [%s + %d]\n", sym->base, sym->offset);
+				emitf(asm_out, "  push rax\n");
 				break;
 			}
-			// If it's an array access (&arr[i]), we need to add the index
+			// Array element (&arr[i]): evaluate the index, then scale it
 			if (node->left->type == NODE_ARRAY_ACCESS) {
-			   // This is tricky because we need to evaluate the index first.
-			   // For simplicity, let's just support basic variable addresses for now.
+				const ASTNode *access = node->left;
+				const Symbol *sym = get_symbol(access->var_name, access->line, access->column, access->offset);
+
+				gen_asm(access->left); // Push Index
+				emitf(asm_out, "  pop rbx\n");
+				emit_element_address(sym, "rax", access);
+				emitf(asm_out, "  push rax\n");
 			}
 			break;
 		}
@@ -241,30 +635,24 @@ void gen_asm(ASTNode *node) {
 				const Symbol *sym = get_symbol(access->left->var_name, node->line, node->column, node->offset);
 				StructDef *sdef = get_struct(sym->type_name);
 
-				int mem_offset = 0;
-				for (int i=0; i<sdef->member_count; i++) {
-					 if (strcmp(sdef->members[i].name, access->member_name) == 0) {
-						 mem_offset = sdef->members[i].offset;
-						 break;
-					 }
-				}
+				const StructMember *member = find_member(sdef, access->member_name);
+				int mem_offset = member ? member->offset : 0;
+				const char *mem_type = member ? member->type_name : hc->name_int;
 
-				printf("  pop rax\n"); // Value
+				emitf(asm_out, "  pop rax\n"); // Value
 
 				if (access->is_arrow_access) {
 					// HEAP WRITE (p->x = val)
 					// 1. Load the pointer 'p' into rbx
-					printf("  mov rbx, [rbp + %d]\n", sym->offset);
-					
-					// 2. Add member offset
-					printf("  add rbx, %d\n", mem_offset);
-					
-					// 3. Write value (rax) to address (rbx)
-					printf("  mov [rbx], rax\n");
+					emitf(asm_out, "  mov rbx, [%s + %d]\n", sym->base, sym->offset);
+
+					// 2. Write value (rax) to address (rbx + member offset)
+					emit_store(mem_type, "rbx", mem_offset);
 				} else {
 					// STACK WRITE (p.x = val)
+					check_writable(sym, node);
 					int total_offset = sym->offset + mem_offset;
-					printf("  mov [rbp + %d], rax\n", total_offset);
+					emit_store(mem_type, sym->base, total_offset);
 				}
 			}
 			// POINTER ASSIGNMENT (*ptr = val)
@@ -272,100 +660,91 @@ void gen_asm(ASTNode *node) {
 				gen_asm(node->right);       // Generate Value (pushes to stack)
 				gen_asm(node->left->left);  // Generate Pointer Address (pushes to stack)
 
-				printf("  pop rax\n");      // Address
-				printf("  pop rbx\n");      // Value
-				printf("  mov [rax], rbx\n"); // Write Value to Address
+				emitf(asm_out, "  pop rax\n");      // Address
+				emitf(asm_out, "  pop rbx\n");      // Value
+				emitf(asm_out, "  mov [rax], rbx\n"); // Write Value to Address
 			}
 			// ARRAY ASSIGNMENT (x[i] = val)
 			else if (node->left && node->left->type == NODE_ARRAY_ACCESS) {
 				gen_asm(node->right);      // Push Value
 				gen_asm(node->left->left); // Push Index
 
-				int offset = get_offset(node->left->var_name);
-
-				// Check array type for scaling
 				const Symbol *sym = get_symbol(node->left->var_name, node->line, node->column, node->offset);
-				int is_char_arr = (strncmp(sym->type_name, "char", 4) == 0);
-				int scale = is_char_arr ? 1 : 8;
+				if (sym->is_array)
+					check_writable(sym, node);
 
-				printf("  pop rbx\n");        // Index
-				printf("  pop rax\n");        // Value
+				emitf(asm_out, "  pop rbx\n");        // Index
+				emitf(asm_out, "  pop rax\n");        // Value
 
-				// Calc Address: rbp + offset + (index * 8)
-				printf("  mov rcx, %d\n", offset);
-				printf("  imul rbx, %d\n", scale);
-				printf("  add rcx, rbx\n");
-				printf("  add rcx, rbp\n");
+				// Calc Address: base + (index * element size)
+				emit_element_address(sym, "rcx", node->left);
 
 				// Store based on type
-				if (is_char_arr)
-					printf("  mov [rcx], al\n");
-				else
-					printf("  mov [rcx], rax\n");
+				emit_store(element_type(sym), "rcx", 0);
 			}
 			// STANDARD VARIABLE ASSIGNMENT (x = val)
 			else {
-				if (node->var_name == NULL) {
-					 fprintf(stderr, "Compiler Error: Assignment with NULL variable name\n");
-					 exit(1);
-				}
+				if (node->var_name == NULL)
+					fatal("Compiler Error: Assignment with NULL variable name");
 
 				const Symbol *sym = get_symbol(node->var_name, node->line, node->column, node->offset);
 				int offset = sym->offset;
+				check_writable(sym, node);
 
 				// OPTIMIZATION: Immediate Assignment
 				// If right side is a constant INT, don't push/pop stack
 				if (node->right->type == NODE_INT) {
-					printf("  mov rax, %d\n", node->right->int_value);
-					
-					if (strcmp(sym->type_name, "char") == 0)
-						printf("  mov [rbp + %d], al\n", offset);
-					else
-						printf("  mov [rbp + %d], rax\n", offset);
-					
+					emitf(asm_out, "  mov rax, %ld\n", node->right->int_value);
+					emit_store(sym->type_name, sym->base, offset);
 					break; // Done!
 				}
 
 				// Standard way (for complex expressions)
 				gen_asm(node->right);
-				printf("  pop rax\n");
-
-				if (strcmp(sym->type_name, "char") == 0)
-					printf("  mov [rbp + %d], al\n", offset);
-				else
-					printf("  mov [rbp + %d], rax\n", offset);
+				emitf(asm_out, "  pop rax\n");
+				emit_store(sym->type_name, sym->base, offset);
 			}
 			break;
 
 		case NODE_RETURN:
 			gen_asm(node->left);        // Value to return is now on stack
-			printf("  pop rax\n");      // Move to rax
-			printf("  mov rsp, rbp\n"); // Restore stack pointer
-			printf("  pop rbp\n");      // Restore base pointer
-			printf("  ret\n");
+			emitf(asm_out, "  pop rax\n");      // Move to rax
+			emitf(asm_out, "  mov rsp, rbp\n"); // Restore stack pointer
+			emitf(asm_out, "  pop rbp\n");      // Restore base pointer
+			emitf(asm_out, "  ret\n");
 			break;
 
-		case NODE_BINOP:
+		case NODE_BINOP: {
+			int is_unsigned = expr_is_unsigned(node);
+
 			// If right side is a constant INT, skip stack operations
-			if (node->right->type == NODE_INT) {
+			if (node->right->type == NODE_INT && fits_imm32(node->right->int_value)) {
 				gen_asm(node->left); // Result in RAX (and pushed)
-				printf("  pop rax\n");
+				emitf(asm_out, "  pop rax\n");
 
-				int val = node->right->int_value;
-				if (node->op == '+') printf("  add rax, %d\n", val);
-				if (node->op == '-') printf("  sub rax, %d\n", val);
-				if (node->op == '*') printf("  imul rax, %d\n", val);
-				if (node->op == '&') printf("  and rax, %d\n", val);
-				if (node->op == '|') printf("  or rax, %d\n", val);
+				long val = node->right->int_value;
+				if (node->op == '+') emitf(asm_out, "  add rax, %ld\n", val);
+				if (node->op == '-') emitf(asm_out, "  sub rax, %ld\n", val);
+				if (node->op == '*') emitf(asm_out, "  imul rax, %ld\n", val);
+				if (node->op == '&') emitf(asm_out, "  and rax, %ld\n", val);
+				if (node->op == '|') emitf(asm_out, "  or rax, %ld\n", val);
+				if (node->op == '<') emitf(asm_out, "  shl rax, %ld\n", val & 63);
+				if (node->op == '>') emitf(asm_out, "  %s rax, %ld\n", is_unsigned ? "shr" : "sar", val & 63);
 
 				// Div requires specific registers, let's skip optimization for now
-				if (node->op == '/') {
-					printf("  mov rbx, %d\n", val);
-					printf("  cqo\n");
-					printf("  idiv rbx\n");
+				if (node->op == '/' || node->op == '%') {
+					emitf(asm_out, "  mov rbx, %ld\n", val);
+					if (is_unsigned) {
+						emitf(asm_out, "  xor edx, edx\n");
+						emitf(asm_out, "  div rbx\n");
+					} else {
+						emitf(asm_out, "  cqo\n");
+						emitf(asm_out, "  idiv rbx\n");
+					}
+					if (node->op == '%') emitf(asm_out, "  mov rax, rdx\n");
 				}
 
-				printf("  push rax\n");
+				emitf(asm_out, "  push rax\n");
 				break;
 			}
 
@@ -373,62 +752,92 @@ void gen_asm(ASTNode *node) {
 			gen_asm(node->left);
 			gen_asm(node->right);
 
-			printf("  pop rbx\n"); // Right operand
-			printf("  pop rax\n"); // Left operand
+			emitf(asm_out, "  pop rbx\n"); // Right operand
+			emitf(asm_out, "  pop rax\n"); // Left operand
 
-			if (node->op == '+') printf("  add rax, rbx\n");
-			if (node->op == '-') printf("  sub rax, rbx\n");
-			if (node->op == '*') printf("  imul rax, rbx\n");
-			if (node->op == '/') {
-				printf("  cqo\n");     // Sign extend rax to rdx:rax (NASM equivalent of cqto)
-				printf("  idiv rbx\n");
+			if (node->op == '+') emitf(asm_out, "  add rax, rbx\n");
+			if (node->op == '-') emitf(asm_out, "  sub rax, rbx\n");
+			if (node->op == '*') emitf(asm_out, "  imul rax, rbx\n");
+			if (node->op == '/' || node->op == '%') {
+				if (is_unsigned) {
+					emitf(asm_out, "  xor edx, edx\n"); // Zero-extend rax into rdx:rax
+					emitf(asm_out, "  div rbx\n");
+				} else {
+					emitf(asm_out, "  cqo\n");     // Sign extend rax to rdx:rax (NASM equivalent of cqto)
+					emitf(asm_out, "  idiv rbx\n");
+				}
+				if (node->op == '%') emitf(asm_out, "  mov rax, rdx\n"); // Remainder
+			}
+			if (node->op == '&') emitf(asm_out, "  and rax, rbx\n");
+			if (node->op == '|') emitf(asm_out, "  or rax, rbx\n");
+			if (node->op == '<' || node->op == '>') {
+				emitf(asm_out, "  mov rcx, rbx\n"); // Shift count must live in cl
+				if (node->op == '<') emitf(asm_out, "  shl rax, cl\n");
+				else emitf(asm_out, "  %s rax, cl\n", is_unsigned ? "shr" : "sar");
 			}
-			if (node->op == '&') printf("  and rax, rbx\n");
-			if (node->op == '|') printf("  or rax, rbx\n");
 
-			printf("  push rax\n");
+			emitf(asm_out, "  push rax\n");
 			break;
+		}
 
-		case NODE_BLOCK:
+		case NODE_BLOCK: {
+			// Locals declared in a block are visible until its closing brace.
+			// Their stack slots are not reused; the frame is a fixed size.
+			int scope = enter_scope();
 			ASTNode *stmt = node->left;
 			while (stmt) {
 				gen_asm(stmt);
 				stmt = stmt->next;
 			}
+			leave_scope(scope);
 			break;
+		}
 
 		case NODE_FUNCTION:
+			// Another object provides the code
+			if (node->is_extern) {
+				emitf(asm_out, "extern %s\n", node->var_name);
+				break;
+			}
+
 			// Set current function for warnings
-			current_func_name = node->var_name;
+			ctx->func_name = node->var_name;
 
-			// Reset symbol table
-			symbol_count = 0;
-			current_stack_offset = 0;
+			// Reset symbol table and labels
+			leave_scope(0);
+			ctx->stack_offset = 0;
+			ctx->label_counter = 0;
 
 			// Handle 'main' by generating a separate _start wrapper
-			if (strcmp(node->var_name, "main") == 0) {
-				printf("global _start\n");
-				printf("_start:\n");
+			if (node->var_name == hc->name_main) {
+				emitf(asm_out, "global _start\n");
+				emitf(asm_out, "_start:\n");
 				// Load argc (at [rsp]) into RDI
-				printf("  mov rdi, [rsp]\n");
+				emitf(asm_out, "  mov rdi, [rsp]\n");
 				// Load argv (address at [rsp + 8]) into RSI
-				printf("  lea rsi, [rsp + 8]\n");
-				printf("  call main\n");
-				// Exit with return value
-				printf("  mov rdi, rax\n");
-				printf("  mov rax, 60\n"); // SYS_exit
-				printf("  syscall\n");
+				emitf(asm_out, "  lea rsi, [rsp + 8]\n");
+				emitf(asm_out, "  call main\n");
+				// Exit with return value, after flushing output
+				if (hc->flush_at_exit) {
+					emitf(asm_out, "  push rax\n");
+					emitf(asm_out, "  call %s\n", EXIT_HOOK);
+					emitf(asm_out, "  pop rax\n");
+				}
+				emitf(asm_out, "  mov rdi, rax\n");
+				emitf(asm_out, "  mov rax, 60\n"); // SYS_exit
+				emitf(asm_out, "  syscall\n");
 
 				// Generate the actual main label below
-				printf("main:\n");
+				emitf(asm_out, "main:\n");
 			} else {
-				printf("global %s\n", node->var_name);
-				printf("%s:\n", node->var_name);
+				if (!node->is_static)
+					emitf(asm_out, "global %s\n", node->var_name);
+				emitf(asm_out, "%s:\n", node->var_name);
 			}
 
-			printf("  push rbp\n");
-			printf("  mov rbp, rsp\n");
-			printf("  sub rsp, %d\n", MAX_STACK_SIZE); // Reserve stack space
+			emitf(asm_out, "  push rbp\n");
+			emitf(asm_out, "  mov rbp, rsp\n");
+			emitf(asm_out, "  sub rsp, %d\n", MAX_STACK_SIZE); // Reserve stack space
 
 			// Handle Parameters
 			ASTNode *param = node->left;
@@ -438,12 +847,12 @@ void gen_asm(ASTNode *node) {
 			while (param) {
 				// For params, type is usually int/ptr.
 				// We use member_name as type (see parser).
-				const char *type = param->member_name ? param->member_name : "int";
+				const char *type = param->member_name ? param->member_name : hc->name_int;
 				add_symbol(param->var_name, type, 8); // Params are always 8 bytes on stack
 
 				int offset = get_offset(param->var_name);
 				if (param_idx < 6) {
-					printf("  mov [rbp + %d], %s\n", offset, regs[param_idx]);
+					emitf(asm_out, "  mov [rbp + %d], %s\n", offset, regs[param_idx]);
 				}
 				param = param->next;
 				param_idx++;
@@ -452,29 +861,26 @@ void gen_asm(ASTNode *node) {
 			gen_asm(node->body);
 
 			// Epilogue safety
-			printf("  mov rsp, rbp\n");
-			printf("  pop rbp\n");
-			printf("  ret\n");
+			emitf(asm_out, "  mov rsp, rbp\n");
+			emitf(asm_out, "  pop rbp\n");
+			emitf(asm_out, "  ret\n");
 			break;
 
 		case NODE_IF: {
 			int label_else = new_label();
 			int label_end = new_label();
 
-			gen_asm(node->left); // Condition
-			printf("  pop rax\n");
-			printf("  cmp rax, 0\n");
-			printf("  je .L%d\n", label_else); // Jump if 0 (False)
+			gen_jump_if_false(node->left, label_else); // Jump if 0 (False)
 
 			gen_asm(node->body);
-			printf("  jmp .L%d\n", label_end);
+			emitf(asm_out, "  jmp .L%d\n", label_end);
 
-			printf(".L%d:\n", label_else);
+			emitf(asm_out, ".L%d:\n", label_else);
 			if (node->right) {
 				gen_asm(node->right);
 			}
 
-			printf(".L%d:\n", label_end);
+			emitf(asm_out, ".L%d:\n", label_end);
 			break;
 		}
 
@@ -482,38 +888,38 @@ void gen_asm(ASTNode *node) {
 			int label_start = new_label();
 			int label_end = new_label();
 
-			printf(".L%d:\n", label_start);
+			emitf(asm_out, ".L%d:\n", label_start);
 
-			gen_asm(node->left);
-			printf("  pop rax\n");
-			printf("  cmp rax, 0\n");
-			printf("  je .L%d\n", label_end);
+			gen_jump_if_false(node->left, label_end);
 
 			gen_asm(node->body);
-			printf("  jmp .L%d\n", label_start);
+			emitf(asm_out, "  jmp .L%d\n", label_start);
 
-			printf(".L%d:\n", label_end);
+			emitf(asm_out, ".L%d:\n", label_end);
 			break;
 		}
 
 		case NODE_GT:
 		case NODE_LT:
 		case NODE_EQ:
-		case NODE_NEQ:
+		case NODE_NEQ: {
+			int is_unsigned = expr_is_unsigned(node->left) || expr_is_unsigned(node->right);
+
 			gen_asm(node->left);
 			gen_asm(node->right);
-			printf("  pop rbx\n");
-			printf("  pop rax\n");
-			printf("  cmp rax, rbx\n");
+			emitf(asm_out, "  pop rbx\n");
+			emitf(asm_out, "  pop rax\n");
+			emitf(asm_out, "  cmp rax, rbx\n");
 
-			if (node->type == NODE_EQ) printf("  sete al\n");
-			if (node->type == NODE_NEQ) printf("  setne al\n");
-			if (node->type == NODE_GT) printf("  setg al\n");
-			if (node->type == NODE_LT) printf("  setl al\n");
+			if (node->type == NODE_EQ) emitf(asm_out, "  sete al\n");
+			if (node->type == NODE_NEQ) emitf(asm_out, "  setne al\n");
+			if (node->type == NODE_GT) emitf(asm_out, "  %s al\n", is_unsigned ? "seta" : "setg");
+			if (node->type == NODE_LT) emitf(asm_out, "  %s al\n", is_unsigned ? "setb" : "setl");
 
-			printf("  movzx rax, al\n"); // Zero-extend byte
-			printf("  push rax\n");
+			emitf(asm_out, "  movzx rax, al\n"); // Zero-extend byte
+			emitf(asm_out, "  push rax\n");
 			break;
+		}
 
 		case NODE_SYSCALL: {
 			int arg_count = 0;
@@ -528,39 +934,41 @@ void gen_asm(ASTNode *node) {
 
 			for (int i = arg_count - 1; i >= 0; i--) {
 				if (i == 0) {
-					printf("  pop rax\n"); // Syscall number
+					emitf(asm_out, "  pop rax\n"); // Syscall number
 				} else {
 					if (i-1 < 6) {
-						printf("  pop %s\n", regs[i-1]);
+						emitf(asm_out, "  pop %s\n", regs[i-1]);
 					}
 				}
 			}
 
-			printf("  syscall\n");
-			printf("  push rax\n"); // Return value
+			emitf(asm_out, "  syscall\n");
+			emitf(asm_out, "  push rax\n"); // Return value
 			break;
 		}
 
 		case NODE_POST_INC: {
-			const char *var_name = node->left->var_name;
-			int offset = get_offset(var_name);
+			const ASTNode *var = node->left;
+			const Symbol *sym = get_symbol(var->var_name, var->line, var->column, var->offset);
+
+			check_writable(sym, node);
 
-			printf("  mov rax, [rbp + %d]\n", offset);
-			printf("  inc rax\n");
-			printf("  mov [rbp + %d], rax\n", offset);
+			emit_load(sym->type_name, sym->base, sym->offset);
+			emitf(asm_out, "  inc rax\n");
+			emit_store(sym->type_name, sym->base, sym->offset);
 			break;
 		}
 
 		case NODE_STRING: {
 			int label = new_label();
 
-			printf("  section .rodata\n");
+			emitf(asm_out, "  section .rodata\n");
 			// NASM string syntax: db "string", 0
-			printf(".LC%d: db `%s`, 0\n", label, node->var_name);
+			emitf(asm_out, ".LC%d: db `%s`, 0\n", label, node->var_name);
 
-			printf("  section .text\n");
-			printf("  lea rax, [rel .LC%d]\n", label); // Position Independent Code (PIC) access
-			printf("  push rax\n");
+			emitf(asm_out, "  section .text\n");
+			emitf(asm_out, "  lea rax, [rel .LC%d]\n", label); // Position Independent Code (PIC) access
+			emitf(asm_out, "  push rax\n");
 			break;
 		}
 
@@ -568,50 +976,36 @@ void gen_asm(ASTNode *node) {
 			int size = node->int_value;
 
 			// Calculate size based on type
-			const char *type = node->member_name ? node->member_name : "int";
-			int elem_size = (strcmp(type, "char") == 0) ? 1 : 8;
-			int total_size = size * elem_size;
+			const char *type = node->member_name ? node->member_name : hc->name_int;
+			int total_size = size * type_size(type);
 
-			// Store type as "char[]" or "int[]" for symbol table
-			char type_sig[64];
-			snprintf(type_sig, 64, "%s[]", type);
-
-			add_symbol(node->var_name, type_sig, total_size);
+			// The symbol keeps the element type for loads, stores and scaling
+			Symbol *sym = add_symbol(node->var_name, type, total_size);
+			sym->is_array = 1;
 			break;
 		}
 
 		case NODE_ARRAY_ACCESS: {
 			gen_asm(node->left); // Push Index
 
-			int offset = get_offset(node->var_name);
-
-			// Determine scale
 			const Symbol *sym = get_symbol(node->var_name, node->line, node->column, node->offset);
-			int is_char_arr = (strncmp(sym->type_name, "char", 4) == 0);
-			int scale = is_char_arr ? 1 : 8;
 
-			printf("  pop rbx\n"); // Index
-			printf("  mov rax, %d\n", offset);
-			printf("  imul rbx, %d\n", scale);
-			printf("  add rax, rbx\n");
-			printf("  add rax, rbp\n");
+			emitf(asm_out, "  pop rbx\n"); // Index
+			emit_element_address(sym, "rax", node);
 
 			// Dereference based on size
-			if (is_char_arr)
-				printf("  movzx rax, byte [rax]\n");
-			else
-				printf("  mov rax, [rax]\n");
+			emit_load(element_type(sym), "rax", 0);
 
-			printf("  push rax\n");
+			emitf(asm_out, "  push rax\n");
 			break;
 		}
 
 		case NODE_DEREF:
 			gen_asm(node->left); // Evaluate the pointer (puts address in rax)
 
-			printf("  pop rax\n");         // Get Address
-			printf("  mov rax, [rax]\n");  // Load value AT that address
-			printf("  push rax\n");
+			emitf(asm_out, "  pop rax\n");         // Get Address
+			emitf(asm_out, "  mov rax, [rax]\n");  // Load value AT that address
+			emitf(asm_out, "  push rax\n");
 			break;
 
 		case NODE_FUNC_CALL: {
@@ -626,12 +1020,12 @@ void gen_asm(ASTNode *node) {
 			const char* regs[] = {"rdi", "rsi", "rdx", "rcx", "r8", "r9"};
 			for (int i = arg_count - 1; i >= 0; i--) {
 				if (i < 6) {
-					printf("  pop %s\n", regs[i]);
+					emitf(asm_out, "  pop %s\n", regs[i]);
 				}
 			}
 
-			printf("  call %s\n", node->var_name);
-			printf("  push rax\n");
+			emitf(asm_out, "  call %s\n", node->var_name);
+			emitf(asm_out, "  push rax\n");
 			break;
 		}
 
@@ -639,19 +1033,18 @@ void gen_asm(ASTNode *node) {
 			int label_start = new_label();
 			int label_end = new_label();
 
+			// The loop variable belongs to the loop
+			int scope = enter_scope();
+
 			// Execute Initialization (e.g., int i = 0;)
 			if (node->left)
 				gen_asm(node->left);
 
-			printf(".L%d:\n", label_start);
+			emitf(asm_out, ".L%d:\n", label_start);
 
 			// Check Condition
-			if (node->right) {
-				gen_asm(node->right);
-				printf("  pop rax\n");
-				printf("  cmp rax, 0\n");
-				printf("  je .L%d\n", label_end); // Exit if condition is false
-			}
+			if (node->right)
+				gen_jump_if_false(node->right, label_end); // Exit if condition is false
 
 			// Execute Body
 			if (node->body)
@@ -662,9 +1055,10 @@ void gen_asm(ASTNode *node) {
 				gen_asm(node->increment);
 
 			// Loop back
-			printf("  jmp .L%d\n", label_start);
+			emitf(asm_out, "  jmp .L%d\n", label_start);
 
-			printf(".L%d:\n", label_end);
+			emitf(asm_out, ".L%d:\n", label_end);
+			leave_scope(scope);
 			break;
 		}
 
@@ -674,26 +1068,26 @@ void gen_asm(ASTNode *node) {
 
 			// Evaluate LHS
 			gen_asm(node->left);
-			printf("  pop rax\n");
-			printf("  cmp rax, 0\n");
-			printf("  je .L%d\n", label_false); // SHORT-CIRCUIT: If LHS is 0, skip RHS
+			emitf(asm_out, "  pop rax\n");
+			emitf(asm_out, "  cmp rax, 0\n");
+			emitf(asm_out, "  je .L%d\n", label_false); // SHORT-CIRCUIT: If LHS is 0, skip RHS
 
 			// Evaluate RHS
 			gen_asm(node->right);
-			printf("  pop rax\n");
-			printf("  cmp rax, 0\n");
-			printf("  je .L%d\n", label_false);
+			emitf(asm_out, "  pop rax\n");
+			emitf(asm_out, "  cmp rax, 0\n");
+			emitf(asm_out, "  je .L%d\n", label_false);
 
 			// Both are true
-			printf("  mov rax, 1\n");
-			printf("  jmp .L%d\n", label_end);
+			emitf(asm_out, "  mov rax, 1\n");
+			emitf(asm_out, "  jmp .L%d\n", label_end);
 
 			// False path
-			printf(".L%d:\n", label_false);
-			printf("  mov rax, 0\n");
+			emitf(asm_out, ".L%d:\n", label_false);
+			emitf(asm_out, "  mov rax, 0\n");
 
-			printf(".L%d:\n", label_end);
-			printf("  push rax\n");
+			emitf(asm_out, ".L%d:\n", label_end);
+			emitf(asm_out, "  push rax\n");
 			break;
 		}
 
@@ -703,31 +1097,343 @@ void gen_asm(ASTNode *node) {
 
 			// Evaluate LHS
 			gen_asm(node->left);
-			printf("  pop rax\n");
-			printf("  cmp rax, 0\n");
-			printf("  jne .L%d\n", label_true); // SHORT-CIRCUIT: If LHS is 1, skip RHS!
+			emitf(asm_out, "  pop rax\n");
+			emitf(asm_out, "  cmp rax, 0\n");
+			emitf(asm_out, "  jne .L%d\n", label_true); // SHORT-CIRCUIT: If LHS is 1, skip RHS!
 
 			// Evaluate RHS
 			gen_asm(node->right);
-			printf("  pop rax\n");
-			printf("  cmp rax, 0\n");
-			printf("  jne .L%d\n", label_true);
+			emitf(asm_out, "  pop rax\n");
+			emitf(asm_out, "  cmp rax, 0\n");
+			emitf(asm_out, "  jne .L%d\n", label_true);
 
 			// Both are false
-			printf("  mov rax, 0\n");
-			printf("  jmp .L%d\n", label_end);
+			emitf(asm_out, "  mov rax, 0\n");
+			emitf(asm_out, "  jmp .L%d\n", label_end);
 
 			// True path
-			printf(".L%d:\n", label_true);
-			printf("  mov rax, 1\n");
+			emitf(asm_out, ".L%d:\n", label_true);
+			emitf(asm_out, "  mov rax, 1\n");
 
-			printf(".L%d:\n", label_end);
-			printf("  push rax\n");
+			emitf(asm_out, ".L%d:\n", label_end);
+			emitf(asm_out, "  push rax\n");
+			break;
+		}
+
+		case NODE_ASM: {
+			// Every input is computed before any register is loaded, so
+			// computing one can't overwrite another
+			for (ASTNode *in = node->left; in; in = in->next)
+				gen_asm(in->left);
+			pop_asm_inputs(node->left);
+
+			emit_asm_template(node);
+
+			// The value of an asm expression is rax
+			if (node->int_value)
+				emitf(asm_out, "  push rax\n");
+
+			// Registers may be stored into variables that share them, so
+			// all of them are saved first
+			for (ASTNode *out = node->right; out; out = out->next)
+				emitf(asm_out, "  push %s\n", out->member_name);
+			store_asm_outputs(node->right);
+
+			// node->body lists the clobbered registers. No value lives in
+			// a register across statements, so none needs saving today.
+			break;
+		}
+
+		case NODE_GLOBAL_DECL: {
+			const char *type = node->member_name;
+			int elem_size = type_size(type);
+			int count = node->int_value ? node->int_value : 1;
+
+			Symbol *sym = add_global_symbol(node->var_name, type);
+			sym->is_array = node->int_value != 0;
+			sym->is_const = node->is_const;
+
+			// Zero-filled data costs nothing in the file, so it goes to .bss
+			if (node->is_const)
+				emitf(asm_out, "  section .rodata\n");
+			else if (node->left)
+				emitf(asm_out, "  section .data\n");
+			else
+				emitf(asm_out, "  section .bss\n");
+
+			int align = (elem_size == 1 || elem_size == 2 || elem_size == 4) ? elem_size : 8;
+			emitf(asm_out, "  %s %d\n", node->left || node->is_const ? "align" : "alignb", align);
+			emitf(asm_out, "$%s:\n", node->var_name);
+
+			if (!node->left && !node->is_const) {
+				emitf(asm_out, "  resb %d\n", count * elem_size);
+			} else {
+				int emitted = 0;
+				if (node->left && node->left->type == NODE_STRING) {
+					emitf(asm_out, "  db `%s`, 0\n", node->left->var_name);
+					emitted = node->left->int_value; // Bytes including the terminator
+
+				} else {
+					const char *directive = "dq";
+					if (elem_size == 1) directive = "db";
+					if (elem_size == 2) directive = "dw";
+					if (elem_size == 4) directive = "dd";
+
+					// A handful of values per line keeps big tables readable
+					for (const ASTNode *value = node->left; value; value = value->next) {
+						if (emitted % 8 == 0)
+							emitf(asm_out, "%s  %s %ld", emitted ? "\n" : "", directive, value->int_value);
+						else
+							emitf(asm_out, ", %ld", value->int_value);
+						emitted++;
+					}
+					if (emitted)
+						emitf(asm_out, "\n");
+				}
+
+				if (emitted < count)
+					emitf(asm_out, "  times %d db 0\n", (count - emitted) * elem_size);
+			}
+
+			emitf(asm_out, "  section .text\n");
 			break;
 		}
 
 		// Struct definitions are handled entireley by the parser. They do not
 		// generate any assembly code.
 		case NODE_STRUCT_DEFN: break;
+		case NODE_ASM_OPERAND: break;	// Handled by NODE_ASM
+	}
+}
+
+/* ========================================================================= */
+/* PARALLEL CODE GENERATION													 */
+/* ========================================================================= */
+
+// Each thread reuses one context; gen_function() resets it
+static __thread CodegenContext thread_context;
+
+// Generates one function into 'out' with a fresh context. Returns -1 if an
+// error was reported, after releasing what the context had allocated.
+static
+int gen_function(ASTNode *func, Emitter *out)
+{
+	ctx = &thread_context;
+	asm_out = out;
+
+	jmp_buf here;
+	jmp_buf *saved_jump = error_jump;
+	error_jump = &here;
+
+	int failed = setjmp(here);
+	if (!failed)
+		gen_asm(func);
+	error_jump = saved_jump;
+
+	free(ctx->local_stack);
+	table_free(&ctx->local_table);
+	arena_free(&ctx->arena);
+	memset(ctx, 0, sizeof(*ctx));
+	ctx = NULL;
+	return failed ? -1 : 0;
+}
+
+// Produces one function's text, from the cache when it has an entry.
+// Returns -1 if an error was reported.
+static
+int gen_function_text(ASTNode *func, char **text, size_t *len)
+{
+	CacheKey *key = hc->cache_dir ? table_get(&hc->function_keys, func) : NULL;
+	if (key && (*text = cache_load("fn", key, len))) {
+		__atomic_fetch_add(&hc->cache_stats.function_hits, 1, __ATOMIC_RELAXED);
+		return 0;
+	}
+
+	Emitter out;
+	emit_init_memory(&out);
+	if (gen_function(func, &out) != 0) {
+		emit_close(&out);
+		*text = NULL;
+		*len = 0;
+		return -1;
+	}
+	*text = emit_take(&out, len);
+
+	if (key) {
+		__atomic_fetch_add(&hc->cache_stats.function_misses, 1, __ATOMIC_RELAXED);
+		cache_store("fn", key, *text, *len);
+	}
+	return 0;
+}
+
+typedef struct {
+	char *text;
+	size_t len;
+	int done;
+} FunctionOutput;
+
+typedef struct {
+	HeliumCompiler *compiler;
+	ASTNode **funcs;
+	FunctionOutput *outputs;
+	int count;
+	int next;				// Next function to claim (atomic)
+	int written;			// Functions already copied to the output
+	int window;				// How far workers may run ahead of the writer
+	int failed;				// Someone reported an error; stop early
+	pthread_mutex_t lock;
+	pthread_cond_t finished;	// A function's text is ready
+	pthread_cond_t drained;		// The writer caught up
+} CodegenJobs;
+
+static
+void *codegen_worker(void *arg)
+{
+	CodegenJobs *jobs = arg;
+	hc = jobs->compiler;
+
+	PhaseClock clock;
+	phase_begin(&clock);
+
+	for (;;) {
+		int i = __atomic_fetch_add(&jobs->next, 1, __ATOMIC_RELAXED);
+		if (i >= jobs->count) break;
+
+		// Bound the memory held by finished-but-unwritten functions
+		pthread_mutex_lock(&jobs->lock);
+		while (i >= jobs->written + jobs->window && !jobs->failed)
+			pthread_cond_wait(&jobs->drained, &jobs->lock);
+		int stop = jobs->failed;
+		pthread_mutex_unlock(&jobs->lock);
+		if (stop) break;
+
+		size_t len;
+		char *text;
+		int failed = gen_function_text(jobs->funcs[i], &text, &len);
+
+		pthread_mutex_lock(&jobs->lock);
+		jobs->outputs[i].text = text;
+		jobs->outputs[i].len = len;
+		jobs->outputs[i].done = 1;
+		if (failed) {
+			jobs->failed = 1;
+			pthread_cond_broadcast(&jobs->drained);
+		}
+		pthread_cond_broadcast(&jobs->finished);
+		pthread_mutex_unlock(&jobs->lock);
+		if (failed) break;
 	}
-}
\ No newline at end of file
+	phase_add_cpu(PHASE_CODEGEN, &clock);
+	return NULL;
+}
+
+int default_jobs(void)
+{
+	long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	return cpus > 0 ? (int)cpus : 1;
+}
+
+// Copies finished functions to 'out' in source order. Returns -1 if a
+// worker or the output itself failed.
+static
+int write_function_outputs(CodegenJobs *jobs, Emitter *out)
+{
+	jmp_buf here;
+	jmp_buf *saved_jump = error_jump;
+	error_jump = &here;
+
+	// A failed write unwinds to here, so the workers can still be stopped
+	volatile int failed = setjmp(here);
+	for (int i = 0; !failed && i < jobs->count; i++) {
+		pthread_mutex_lock(&jobs->lock);
+		while (!jobs->outputs[i].done && !jobs->failed)
+			pthread_cond_wait(&jobs->finished, &jobs->lock);
+		failed = jobs->failed;
+		pthread_mutex_unlock(&jobs->lock);
+		if (failed) break;
+
+		emit_bytes(out, jobs->outputs[i].text, jobs->outputs[i].len);
+		free(jobs->outputs[i].text);
+		jobs->outputs[i].text = NULL;
+
+		pthread_mutex_lock(&jobs->lock);
+		jobs->written = i + 1;
+		pthread_cond_broadcast(&jobs->drained);
+		pthread_mutex_unlock(&jobs->lock);
+	}
+	error_jump = saved_jump;
+
+	if (failed) {
+		pthread_mutex_lock(&jobs->lock);
+		jobs->failed = 1;
+		pthread_cond_broadcast(&jobs->drained);
+		pthread_mutex_unlock(&jobs->lock);
+	}
+	return failed ? -1 : 0;
+}
+
+// Generates 'count' functions into 'out' in the order given, using up to
+// 'thread_count' threads. The output does not depend on the thread count.
+void gen_functions(ASTNode **funcs, int count, int thread_count, Emitter *out)
+{
+	if (thread_count > count)
+		thread_count = count;
+
+	if (thread_count <= 1) {
+		for (int i = 0; i < count; i++) {
+			if (!hc->cache_dir) {
+				if (gen_function(funcs[i], out) != 0)
+					helium_raise();
+				continue;
+			}
+
+			// Cache entries need each function's text on its own
+			size_t len;
+			char *text;
+			if (gen_function_text(funcs[i], &text, &len) != 0)
+				helium_raise();
+			emit_bytes(out, text, len);
+			free(text);
+		}
+		asm_out = out;
+		return;
+	}
+
+	CodegenJobs jobs;
+	memset(&jobs, 0, sizeof(jobs));
+	jobs.compiler = hc;
+	jobs.funcs = funcs;
+	jobs.count = count;
+	jobs.window = thread_count * 16;
+	jobs.outputs = arena_alloc(&hc->ast_arena, count * sizeof(FunctionOutput), _Alignof(FunctionOutput));
+	memset(jobs.outputs, 0, count * sizeof(FunctionOutput));
+	pthread_t *threads = arena_alloc(&hc->ast_arena, thread_count * sizeof(pthread_t), _Alignof(pthread_t));
+	pthread_mutex_init(&jobs.lock, NULL);
+	pthread_cond_init(&jobs.finished, NULL);
+	pthread_cond_init(&jobs.drained, NULL);
+
+	// If threads cannot be started, the ones that did start do all the work
+	int started = 0;
+	while (started < thread_count &&
+		   pthread_create(&threads[started], NULL, codegen_worker, &jobs) == 0)
+		started++;
+	if (started == 0)
+		fatal("Error: Could not start code generation threads");
+
+	int failed = write_function_outputs(&jobs, out);
+
+	for (int t = 0; t < started; t++)
+		pthread_join(threads[t], NULL);
+
+	// Functions finished after a failure are never written
+	for (int i = 0; i < count; i++)
+		free(jobs.outputs[i].text);
+
+	pthread_cond_destroy(&jobs.finished);
+	pthread_cond_destroy(&jobs.drained);
+	pthread_mutex_destroy(&jobs.lock);
+	asm_out = out;
+
+	if (failed)
+		helium_raise();
+}
@@ -0,0 +1,556 @@
+#include "helium.h"
+
+/* ========================================================================= */
+/* COMPILER CONTEXT															 */
+/* ========================================================================= */
+
+// All compiler state lives in a HeliumCompiler. The code reaches the one it
+// is working for through 'hc', which is per thread, so separate compilers
+// can run side by side (see --batch) and a host program can embed one.
+
+__thread HeliumCompiler *hc = NULL;
+__thread jmp_buf *error_jump = NULL;
+
+HeliumCompiler *helium_new(void)
+{
+	HeliumCompiler *compiler = calloc(1, sizeof(HeliumCompiler));
+	if (!compiler)
+		return NULL;
+
+	compiler->current_filename = "unknown";
+	compiler->current_line = 1;
+	compiler->current_col = 1;
+	compiler->jobs = 1;
+	pthread_mutex_init(&compiler->error_lock, NULL);
+	return compiler;
+}
+
+// 'dir' must outlive the compiler
+void helium_add_include_path(HeliumCompiler *compiler, const char *dir)
+{
+	const char **paths = realloc(compiler->include_paths,
+								 (compiler->include_path_count + 1) * sizeof(char *));
+	if (!paths) {
+		fprintf(stderr, "Error: Out of memory\n");
+		exit(1);
+	}
+	paths[compiler->include_path_count++] = dir;
+	compiler->include_paths = paths;
+}
+
+// The first diagnostic reported, or NULL if compilation succeeded
+const char *helium_error(const HeliumCompiler *compiler)
+{
+	return compiler->failed ? compiler->error : NULL;
+}
+
+void helium_free(HeliumCompiler *compiler)
+{
+	if (!compiler) return;
+
+	free_preprocessor(compiler);
+	table_free(&compiler->macro_table);
+	table_free(&compiler->struct_table);
+	table_free(&compiler->global_table);
+	table_free(&compiler->prim_table);
+	table_free(&compiler->asm_register_table);
+	table_free(&compiler->lexed_structs);
+	table_free(&compiler->function_keys);
+	free(compiler->cache_out.data);
+	free(compiler->tokens);
+	free(compiler->token_files);
+	free(compiler->pch_loads);
+	free(compiler->source_code);
+	arena_free(&compiler->ast_arena);
+	free_interned(&compiler->names);
+	free(compiler->include_paths);
+	pthread_mutex_destroy(&compiler->error_lock);
+	free(compiler);
+}
+
+/* ========================================================================= */
+/* COMPILATION																 */
+/* ========================================================================= */
+
+// Cache keys start from the compiler version and hc->module, the only
+// option that changes the generated code (-I only changes the preprocessed
+// source, which is hashed).
+#define CACHE_SALT NAME " " VERSION
+
+// Whole-file cache lookup. On a hit the cached assembly is written to 'out'
+// and 1 is returned; on a miss code is generated into hc->cache_out instead.
+static
+int load_cached_unit(const CacheKey *unit_key, Emitter *out)
+{
+	size_t len;
+	char *text = cache_load("unit", unit_key, &len);
+	if (!text) {
+		hc->cache_stats.unit_misses++;
+		emit_init_memory(&hc->cache_out);
+		return 0;
+	}
+
+	// Owned by hc->cache_out so that a failed write does not leak it
+	hc->cache_stats.unit_hits++;
+	hc->cache_out = (Emitter){text, len, len + 1, -1, 0};
+	emit_bytes(out, hc->cache_out.data, hc->cache_out.len);
+	emit_close(&hc->cache_out);
+	hc->report.asm_bytes = out->flushed + out->len;
+	return 1;
+}
+
+// The top-level functions and globals of a file, in source order
+typedef struct {
+	ASTNode **items;
+	const char **files;		// The file each item came from
+	int count;
+	int capacity;
+} Program;
+
+static
+void add_item(Program *program, ASTNode *item, const char *file)
+{
+	if (program->count == program->capacity) {
+		int capacity = program->capacity ? program->capacity * 2 : 64;
+		ASTNode **items = arena_alloc(&hc->ast_arena, capacity * sizeof(ASTNode *), _Alignof(ASTNode *));
+		const char **files = arena_alloc(&hc->ast_arena, capacity * sizeof(char *), _Alignof(char *));
+		if (program->count) {
+			memcpy(items, program->items, program->count * sizeof(ASTNode *));
+			memcpy(files, program->files, program->count * sizeof(char *));
+		}
+		program->items = items;
+		program->files = files;
+		program->capacity = capacity;
+	}
+	program->files[program->count] = file;
+	program->items[program->count++] = item;
+}
+
+// Globals and functions are labels in one namespace, so a global can't
+// share its name with a function or another global. Functions may
+// repeat, as extern declarations do. The error points at the global (the
+// later one of two globals), which is the name the program can change.
+static
+void check_top_level_names(const Program *program)
+{
+	Table seen = {0};	// Name -> index + 1 of its first item
+	int clash = -1, global = -1;
+	for (int i = 0; i < program->count && clash < 0; i++) {
+		const ASTNode *item = program->items[i];
+		long first = (long)table_get(&seen, item->var_name);
+		if (!first) {
+			table_put(&seen, item->var_name, (void *)(long)(i + 1));
+		} else if (item->type != NODE_FUNCTION) {
+			clash = first - 1;
+			global = i;
+		} else if (program->items[first - 1]->type != NODE_FUNCTION) {
+			clash = i;
+			global = first - 1;
+		}
+	}
+	table_free(&seen);
+	if (clash < 0) return;
+
+	const ASTNode *node = program->items[global];
+	const char *other = program->items[clash]->type == NODE_FUNCTION ? "function" : "global";
+	hc->current_filename = program->files[global];
+	error_at_pos(node->line, node->column, node->offset,
+				 "Global '%s' has the same name as a %s", node->var_name, other);
+}
+
+// In a module (-c), functions from #included files belong to the objects
+// built from those files; this one only refers to them. Static functions
+// are private, so every module keeps its own copy.
+static
+void import_function(ASTNode *func)
+{
+	if (hc->module && func->type == NODE_FUNCTION && !func->is_static) {
+		func->is_extern = 1;
+		func->body = NULL;
+	}
+}
+
+// Parses the whole file. With 'hash_tokens', each function's tokens are
+// hashed into hc->function_keys and struct and global tokens into
+// hc->context_key. With 'use_pch', includes with a fresh precompiled header
+// are loaded instead of parsed.
+static
+Program parse_program(const char *input_filename, int hash_tokens, int use_pch)
+{
+	Program program = {NULL, NULL, 0, 0};
+	PhaseClock parse_clock, optimize_clock;
+	phase_begin(&parse_clock);
+
+	// Prime the lexer
+	lex_begin(use_pch);
+	advance();
+
+	// Keep parsing until end of file
+	while (hc->current_token.type != TOKEN_EOF) {
+		const char *item_file = hc->current_filename;
+		if (hc->current_token.type == TOKEN_FN || hc->current_token.type == TOKEN_STATIC ||
+			hc->current_token.type == TOKEN_EXTERN) {
+			int included = strcmp(hc->current_filename, input_filename) != 0;
+			CacheKey func_key;
+			cache_key_init(&func_key);
+			hc->token_hash = hash_tokens ? &func_key : NULL;
+			ASTNode* func = parse_function();
+			hc->token_hash = NULL;
+
+			phase_end(PHASE_PARSE, &parse_clock);
+			phase_begin(&optimize_clock);
+			optimize_ast(func);
+			phase_end(PHASE_OPTIMIZE, &optimize_clock);
+			phase_begin(&parse_clock);
+
+			if (hash_tokens) {
+				CacheKey *key = arena_alloc(&hc->ast_arena, sizeof(CacheKey), _Alignof(CacheKey));
+				*key = func_key;
+				table_put(&hc->function_keys, func, key);
+			}
+			if (included)
+				import_function(func);
+			add_item(&program, func, item_file);
+
+		} else if (hc->current_token.type == TOKEN_STRUCT) {
+			// Struct layouts and globals are part of every function's key
+			hc->token_hash = hash_tokens ? &hc->context_key : NULL;
+			parse_struct_definition();
+			hc->token_hash = NULL;
+		} else if (hc->current_token.type == TOKEN_PCH) {
+			// Loaded by the lexer, which skipped the text it replaces
+			const PchLoad *load = &hc->pch_loads[hc->current_token.value];
+			for (int i = 0; i < load->count; i++) {
+				import_function(load->items[i]);
+				add_item(&program, load->items[i], item_file);
+			}
+			advance();
+		} else if (is_declaration_start()) {
+			hc->token_hash = hash_tokens ? &hc->context_key : NULL;
+			ASTNode *global = parse_global_declaration();
+			hc->token_hash = NULL;
+			add_item(&program, global, item_file);
+		} else {
+			advance();
+		}
+	}
+
+	check_top_level_names(&program);
+	phase_end(PHASE_PARSE, &parse_clock);
+	return program;
+}
+
+static
+void compile_unit(const char *input_filename, Emitter *out)
+{
+	init_codegen();
+	asm_out = out;
+
+	// Read Input
+	PhaseClock clock;
+	phase_begin(&clock);
+	hc->source_code = preprocess_file(input_filename);
+	phase_end(PHASE_PREPROCESS, &clock);
+
+	// Nothing is lexed or parsed for a file compiled before
+	CacheKey unit_key;
+	Emitter *final_out = out;
+	if (hc->cache_dir) {
+		cache_key_init(&unit_key);
+		cache_key_add(&unit_key, CACHE_SALT, sizeof(CACHE_SALT));
+		cache_key_add(&unit_key, &hc->module, sizeof(hc->module));
+		cache_key_add(&unit_key, hc->source_code, strlen(hc->source_code));
+		if (load_cached_unit(&unit_key, out))
+			return;
+		out = asm_out = &hc->cache_out;
+
+		cache_key_init(&hc->context_key);
+		cache_key_add(&hc->context_key, CACHE_SALT, sizeof(CACHE_SALT));
+		cache_key_add(&hc->context_key, &hc->module, sizeof(hc->module));
+	}
+
+	Program program = parse_program(input_filename, hc->cache_dir != NULL, 1);
+
+	// Write the assembly header (required for linking)
+	emitf(asm_out, "section .text\n");
+
+	// List to hold all functions
+	ASTNode *func_list_head = NULL;
+	ASTNode *func_list_tail = NULL;
+
+	// List to hold all global variables
+	ASTNode *global_list_head = NULL;
+	ASTNode *global_list_tail = NULL;
+
+	for (int i = 0; i < program.count; i++) {
+		ASTNode *item = program.items[i];
+		item->next = NULL;
+
+		if (item->type == NODE_FUNCTION) {
+			// Initialize reachable flag
+			item->is_reachable = 0;
+
+			if (!func_list_head) {
+				func_list_head = item;
+				func_list_tail = item;
+			} else {
+				func_list_tail->next = item;
+				func_list_tail = item;
+			}
+		} else if (!global_list_head) {
+			global_list_head = item;
+			global_list_tail = item;
+		} else {
+			global_list_tail->next = item;
+			global_list_tail = item;
+		}
+	}
+
+	// Dead Code Elimination
+	phase_begin(&clock);
+	analyze_reachability(func_list_head, hc->module);
+	phase_end(PHASE_REACHABILITY, &clock);
+
+	// Globals are registered (and their storage emitted) before any function uses them
+	phase_begin(&clock);
+	ASTNode *global = global_list_head;
+	while (global) {
+		gen_asm(global);
+		global = global->next;
+	}
+
+	// Code Generation
+	// Only generate if used! Reachable functions are independent of each
+	// other, so they are generated in parallel and written in source order.
+	int func_count = 0;
+	for (ASTNode *curr = func_list_head; curr; curr = curr->next) {
+		func_count += curr->is_reachable;
+		if (!curr->is_extern) {
+			hc->report.functions_emitted += curr->is_reachable;
+			hc->report.functions_eliminated += !curr->is_reachable;
+		}
+	}
+
+	ASTNode **funcs = arena_alloc(&hc->ast_arena, (func_count + 1) * sizeof(ASTNode *),
+								  _Alignof(ASTNode *));
+	func_count = 0;
+	for (ASTNode *curr = func_list_head; curr; curr = curr->next) {
+		if (curr->is_reachable)
+			funcs[func_count++] = curr;
+	}
+
+	// A function's final key covers its tokens and its context
+	if (hc->cache_dir) {
+		// main's _start differs with the exit hook
+		cache_key_add(&hc->context_key, &hc->flush_at_exit, sizeof(hc->flush_at_exit));
+		for (int i = 0; i < func_count; i++) {
+			CacheKey *key = table_get(&hc->function_keys, funcs[i]);
+			CacheKey tokens = *key;
+			*key = hc->context_key;
+			cache_key_add(key, &tokens, sizeof(tokens));
+		}
+	}
+
+	gen_functions(funcs, func_count, hc->jobs, out);
+	phase_end(PHASE_CODEGEN, &clock);
+
+	if (hc->cache_dir) {
+		cache_store("unit", &unit_key, hc->cache_out.data, hc->cache_out.len);
+		emit_bytes(final_out, hc->cache_out.data, hc->cache_out.len);
+		emit_close(&hc->cache_out);
+	}
+	hc->report.asm_bytes = final_out->flushed + final_out->len;
+}
+
+// Parses a header and writes its precompiled form (see pch.c) to 'out'
+static
+void compile_header(const char *input_filename, Emitter *out)
+{
+	init_codegen();
+
+	PhaseClock clock;
+	phase_begin(&clock);
+	hc->source_code = preprocess_file(input_filename);
+	phase_end(PHASE_PREPROCESS, &clock);
+
+	// The blob carries every function's token hash for --cache-dir users,
+	// and every name the header lexes
+	Table names = {0};
+	hc->pch_names = &names;
+	cache_key_init(&hc->context_key);
+	Program program = parse_program(input_filename, 1, 0);
+	hc->pch_names = NULL;
+
+	CacheKey *keys = arena_alloc(&hc->ast_arena, (program.count + 1) * sizeof(CacheKey),
+								 _Alignof(CacheKey));
+	for (int i = 0; i < program.count; i++) {
+		CacheKey *key = table_get(&hc->function_keys, program.items[i]);
+		if (key)
+			keys[i] = *key;
+		else
+			memset(&keys[i], 0, sizeof(CacheKey));
+	}
+
+	pch_write(out, hc->source_code, &names, &hc->context_key, program.items, program.files, keys,
+			  program.count);
+	table_free(&names);
+}
+
+// Runs one compilation step for 'compiler', catching its errors
+static
+int run_compiler(HeliumCompiler *compiler, void (*step)(const char *, Emitter *),
+				 const char *input_filename, Emitter *out)
+{
+	HeliumCompiler *saved_compiler = hc;
+	jmp_buf *saved_jump = error_jump;
+	Emitter *saved_out = asm_out;
+
+	jmp_buf here;
+	hc = compiler;
+	error_jump = &here;
+	compiler->current_filename = input_filename;
+
+	int status = 0;
+	if (setjmp(here) == 0)
+		step(input_filename, out);
+	else
+		status = -1;
+
+	hc = saved_compiler;
+	error_jump = saved_jump;
+	asm_out = saved_out;
+	return status;
+}
+
+// Compiles one file into 'out' (a file or memory emitter). Returns 0 on
+// success, or -1 with the diagnostic in helium_error(). A compiler is good
+// for one compilation; make a new one for the next file.
+int helium_compile(HeliumCompiler *compiler, const char *input_filename, Emitter *out)
+{
+	return run_compiler(compiler, compile_unit, input_filename, out);
+}
+
+// Writes the precompiled header for 'input_filename' to 'out'. Same
+// conventions as helium_compile().
+int helium_compile_header(HeliumCompiler *compiler, const char *input_filename, Emitter *out)
+{
+	return run_compiler(compiler, compile_header, input_filename, out);
+}
+
+/* ========================================================================= */
+/* ERROR HANDLING															 */
+/* ========================================================================= */
+
+// Appends to hc->error, truncating if it is full
+static
+void error_append(size_t *len, const char *fmt, ...)
+{
+	size_t capacity = sizeof(hc->error);
+	if (*len >= capacity - 1) return;
+
+	va_list args;
+	va_start(args, fmt);
+	int n = vsnprintf(hc->error + *len, capacity - *len, fmt, args);
+	va_end(args);
+
+	if (n > 0)
+		*len = (*len + n < capacity - 1) ? *len + n : capacity - 1;
+}
+
+// Unwinds to the innermost helium_compile() (or code generation worker).
+// Outside of any compilation, prints the error and exits.
+void helium_raise(void)
+{
+	if (error_jump)
+		longjmp(*error_jump, 1);
+
+	if (hc && hc->failed)
+		fputs(hc->error, stderr);
+	exit(1);
+}
+
+// Only the first error is kept; later ones (from other threads) are dropped.
+// Returns 1 if the caller should write its diagnostic into hc->error.
+static
+int claim_error(void)
+{
+	pthread_mutex_lock(&hc->error_lock);
+	int first = !hc->failed;
+	hc->failed = 1;
+	pthread_mutex_unlock(&hc->error_lock);
+	return first;
+}
+
+void error_at_pos(int line_num, int col_num, int offset, const char *fmt, ...)
+{
+	if (!hc) {
+		fprintf(stderr, "Error: %s\n", fmt);
+		exit(1);
+	}
+
+	if (claim_error()) {
+		size_t len = 0;
+
+		// Print Header: "file:line:col: "
+		error_append(&len, "%s:%d:%d: \n", hc->current_filename, line_num, col_num);
+
+		// Print the formatted message
+		va_list args;
+		va_start(args, fmt);
+		char message[1024];
+		vsnprintf(message, sizeof(message), fmt, args);
+		va_end(args);
+		error_append(&len, "%s\n", message);
+
+		// Scan backwards from offset to find start of line
+		const char *source = hc->source_code;
+		int line_start = offset;
+		while (line_start > 0 && source[line_start - 1] != '\n')
+			line_start--;
+
+		// Scan forwards from offset to find end of line
+		int line_end = offset;
+		while (source[line_end] != '\0' && source[line_end] != '\n')
+			line_end++;
+
+		// Print the Source Line
+		error_append(&len, "\t%.*s\n", line_end - line_start, source + line_start);
+
+		// Print the Caret
+		// Calculate actual column distance based on offset
+		int caret_col = offset - line_start;
+		error_append(&len, "\t%*s^\n", caret_col, "");
+	}
+
+	helium_raise();
+}
+
+void error_at(Token token, const char *message) {
+	error_at_pos(token.line, token.column, token.offset, "%s", message);
+}
+
+void error(const char *message)
+{
+	error_at(hc->current_token, message);
+}
+
+// An error with no source position (I/O, out of memory, internal errors)
+void fatal(const char *fmt, ...)
+{
+	va_list args;
+	va_start(args, fmt);
+
+	if (!hc) {
+		vfprintf(stderr, fmt, args);
+		fprintf(stderr, "\n");
+		exit(1);
+	}
+
+	if (claim_error()) {
+		vsnprintf(hc->error, sizeof(hc->error) - 1, fmt, args);
+		strcat(hc->error, "\n");
+	}
+	va_end(args);
+
+	helium_raise();
+}
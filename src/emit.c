@@ -0,0 +1,181 @@
+#include "helium.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+
+/* ========================================================================= */
+/* ASSEMBLY OUTPUT															 */
+/* ========================================================================= */
+
+// Generated assembly is appended to one large buffer. A file emitter hands
+// the buffer to write() whenever it passes EMIT_FLUSH_SIZE; a memory
+// emitter keeps everything so the caller can take the text afterwards.
+
+#define EMIT_FLUSH_SIZE (1024 * 1024)
+
+__thread Emitter *asm_out = NULL;
+
+static
+void emit_reserve(Emitter *e, size_t extra)
+{
+	if (e->len + extra <= e->capacity) return;
+
+	// Memory emitters are often small (one function each), so start small
+	size_t capacity = e->capacity ? e->capacity : e->fd >= 0 ? EMIT_FLUSH_SIZE + 4096 : 4096;
+	while (e->len + extra > capacity)
+		capacity *= 2;
+
+	char *data = realloc(e->data, capacity);
+	if (!data)
+		fatal("Error: Out of memory");
+	e->data = data;
+	e->capacity = capacity;
+}
+
+void emit_init_fd(Emitter *e, int fd)
+{
+	e->data = NULL;
+	e->len = 0;
+	e->capacity = 0;
+	e->fd = fd;
+	e->flushed = 0;
+	emit_reserve(e, 1);
+}
+
+void emit_init_memory(Emitter *e)
+{
+	emit_init_fd(e, -1);
+}
+
+// Returns 0 on success, -1 if the file could not be written
+int emit_flush(Emitter *e)
+{
+	if (e->fd < 0) return 0;
+
+	size_t done = 0;
+	while (done < e->len) {
+		ssize_t n = write(e->fd, e->data + done, e->len - done);
+		if (n < 0) {
+			if (errno == EINTR) continue;
+			return -1;
+		}
+		done += n;
+	}
+	e->flushed += e->len;
+	e->len = 0;
+	return 0;
+}
+
+static
+void emit_maybe_flush(Emitter *e)
+{
+	if (e->fd >= 0 && e->len >= EMIT_FLUSH_SIZE && emit_flush(e) != 0)
+		fatal("Error: Could not write assembly: %s", strerror(errno));
+}
+
+// Flushes a file emitter and releases the buffer
+int emit_close(Emitter *e)
+{
+	int status = emit_flush(e);
+	free(e->data);
+	e->data = NULL;
+	e->len = e->capacity = 0;
+	return status;
+}
+
+// For memory emitters: the NUL-terminated text, owned by the caller
+char *emit_take(Emitter *e, size_t *len)
+{
+	emit_reserve(e, 1);
+	e->data[e->len] = '\0';
+	if (len) *len = e->len;
+
+	char *text = e->data;
+	e->data = NULL;
+	e->len = e->capacity = 0;
+	return text;
+}
+
+void emit_bytes(Emitter *e, const char *s, size_t n)
+{
+	emit_reserve(e, n);
+	memcpy(e->data + e->len, s, n);
+	e->len += n;
+	emit_maybe_flush(e);
+}
+
+// Formats into the buffer without going through stdio. Supports %s, %d,
+// %ld, %c and %%, which is everything the code generator needs.
+void emitf(Emitter *e, const char *fmt, ...)
+{
+	va_list args;
+	va_start(args, fmt);
+
+	const char *p = fmt;
+	while (*p) {
+		// Copy the literal run up to the next directive in one go
+		const char *run = p;
+		while (*p && *p != '%') p++;
+		if (p > run) {
+			size_t n = p - run;
+			emit_reserve(e, n);
+			memcpy(e->data + e->len, run, n);
+			e->len += n;
+		}
+		if (!*p) break;
+
+		p++; // Skip '%'
+		switch (*p) {
+			case 's': {
+				const char *s = va_arg(args, const char *);
+				size_t n = strlen(s);
+				emit_reserve(e, n);
+				memcpy(e->data + e->len, s, n);
+				e->len += n;
+				break;
+			}
+			case 'd':
+			case 'l': {
+				long v;
+				if (*p == 'l') {
+					p++; // %ld
+					v = va_arg(args, long);
+				} else {
+					v = va_arg(args, int);
+				}
+
+				// Digits are produced backwards into a scratch buffer
+				char digits[24];
+				int i = sizeof(digits);
+				unsigned long u = v < 0 ? -(unsigned long)v : (unsigned long)v;
+				do {
+					digits[--i] = '0' + u % 10;
+					u /= 10;
+				} while (u);
+				if (v < 0) digits[--i] = '-';
+
+				size_t n = sizeof(digits) - i;
+				emit_reserve(e, n);
+				memcpy(e->data + e->len, digits + i, n);
+				e->len += n;
+				break;
+			}
+			case 'c':
+				emit_reserve(e, 1);
+				e->data[e->len++] = (char)va_arg(args, int);
+				break;
+			case '%':
+				emit_reserve(e, 1);
+				e->data[e->len++] = '%';
+				break;
+			default:
+				va_end(args);
+				fatal("Compiler Error: Unsupported emitf directive '%%%c'", *p);
+		}
+		p++;
+	}
+
+	va_end(args);
+	emit_maybe_flush(e);
+}
@@ -4,11 +4,18 @@
 #define NAME "heliumc"
 #define VERSION "0.5.1"
 
+// Called after main returns, just before the process exits, if the program
+// has it (lib/std.he does, to flush buffered output)
+#define EXIT_HOOK "flush_all"
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <ctype.h>
 #include <string.h>
 #include <stdarg.h>
+#include <setjmp.h>
+#include <pthread.h>
+#include <time.h>
 
 /* ========================================================================= */
 /* TYPES & ENUMS                                                             */
@@ -23,7 +30,11 @@ typedef enum {
 	TOKEN_CHAR,         // 'a'
 	TOKEN_CHAR_TYPE,    // char
 	TOKEN_PTR_TYPE,     // ptr
+	TOKEN_SIZED_TYPE,   // u8, u16, u32, u64, i8, i16, i32, i64
 	TOKEN_STRUCT,       // struct
+	TOKEN_CONST,        // const
+	TOKEN_EXTERN,       // extern
+	TOKEN_STATIC,       // static
 	TOKEN_RETURN,       // return
 	TOKEN_LPAREN,       // (
 	TOKEN_RPAREN,       // )
@@ -41,6 +52,9 @@ typedef enum {
 	TOKEN_MINUS,        // -
 	TOKEN_STAR,         // *
 	TOKEN_SLASH,        // /
+	TOKEN_PERCENT,      // %
+	TOKEN_SHL,          // <<
+	TOKEN_SHR,          // >>
 	TOKEN_PIPE,         // |
 	TOKEN_OR,           // ||
 	TOKEN_AMP,          // &
@@ -58,13 +72,20 @@ typedef enum {
 	TOKEN_DOTDOT,		// ..
 	TOKEN_SYSCALL,      // syscall()
 	TOKEN_SIZEOF,		// sizeof()
+	TOKEN_ASM,			// asm { ... }
 	TOKEN_STRING,       // "string"
+	TOKEN_PCH,          // An include with a precompiled header (see pch.c)
 } TokenType;
 
+// All names (identifiers, keywords, type names, string literals) are
+// interned: two equal names are the same pointer, so compare with ==.
+
+// The lexer works ahead of the parser in batches of these (see advance),
+// so they are kept to 32 bytes with no padding.
 typedef struct {
-	char *name;         // To store "main", "count", "int", exc.
+	const char *name;   // To store "main", "count", "int", exc. (interned)
+	long value;         // For integers
 	TokenType type;     // To store the "TOKEN_" type
-	int value;          // For integers
 	int line;           // For error handling
 	int column;         // For error handling
 	int offset;         // For error handling
@@ -98,85 +119,335 @@ typedef enum {
 	NODE_FUNC_CALL,     // add(1, 2);
 	NODE_ADDR,          // &x (Address of)
 	NODE_DEREF,         // *x (Dereference)
+	NODE_GLOBAL_DECL,   // Top-level int x = 1; OR char t[4] = {...};
+	NODE_ASM,           // asm in(rdi = x) { "..." }
+	NODE_ASM_OPERAND,   // One register of an asm's in(), out() or clobber()
 } NodeType;
 
+// Laid out hot-first: the child pointers every pass walks share the first
+// cache line, and the kind, operator and flags are packed into one word.
 typedef struct ASTNode {
-	NodeType type;
-	int int_value;				// For literals
-	char *var_name;				// For references/declarations
-	char *member_name;			// For p.x, this stores "x"
-	char op;					// For binary ops
 	struct ASTNode *left;		// Left child
 	struct ASTNode *right;		// Right child
-	struct ASTNode *increment;	// For loops
 	struct ASTNode *body;		// For functions
 	struct ASTNode *next;		// For linked lists in blocks
+	struct ASTNode *increment;	// For loops
+	long int_value;				// For literals
+	const char *var_name;		// For references/declarations (interned)
+	const char *member_name;	// For p.x, this stores "x" (interned)
 	int line;					// For error handling
 	int column;					// For error handling
 	int offset;					// For error handling
-	int is_reachable;			// Tracks reachability
-	int is_arrow_access;		// 1 = p->x, 0 = p.x
+	NodeType type : 8;
+	char op;					// For binary ops ('<' is <<, '>' is >>)
+	unsigned is_reachable : 1;		// Tracks reachability
+	unsigned is_arrow_access : 1;	// 1 = p->x, 0 = p.x
+	unsigned is_const : 1;			// Read-only globals live in .rodata
+	unsigned is_static : 1;			// Function not visible outside this object
+	unsigned is_extern : 1;			// Function defined in another object
+	unsigned unsigned_known : 1;	// Codegen: is_unsigned below has been computed
+	unsigned is_unsigned : 1;		// Codegen: expression uses unsigned arithmetic
 } ASTNode;
 
+// A precompiled header loaded while lexing (see pch_load)
+typedef struct {
+	ASTNode **items;
+	int count;
+} PchLoad;
+
 // --- Struct Registry ---
 typedef struct {
-	char name[64];
+	const char *name;
+	const char *type_name; // int, u8, Point, ...
 	int offset;     // Offset from the start of the struct
 } StructMember;
 
 typedef struct {
-	char name[64];
-	StructMember members[20];   // Max of 20 for now
+	const char *name;
+	StructMember *members;      // Grows with add_struct_member()
 	int member_count;
+	int member_capacity;
 	int size;                   // Total size (bytes)
 } StructDef;
 
+// --- Hash Table ---
+// Keyed by interned name pointers
+typedef struct {
+	const void *key;
+	void *value;
+} TableEntry;
+
+typedef struct {
+	TableEntry *entries;
+	int capacity;	// Always a power of two
+	int count;
+} Table;
+
+// --- Preprocessor Statistics (--stats) ---
+typedef struct {
+	long files_opened;
+	long bytes_read;
+	long includes_skipped;  // Repeat includes of '#pragma once' files
+	long headers_loaded;    // Includes replaced by their precompiled header
+} PreprocessStats;
+
+// --- Compilation Cache (--cache-dir) ---
+typedef struct {
+	unsigned long lo, hi;	// 128-bit FNV-1a
+} CacheKey;
+
+typedef struct {
+	long unit_hits;			// Whole files copied from the cache
+	long unit_misses;
+	long function_hits;		// Functions whose code came from the cache
+	long function_misses;
+} CacheStats;
+
+// --- Assembly Output ---
+typedef struct {
+	char *data;
+	size_t len;
+	size_t capacity;
+	int fd;         // Destination file, or -1 to keep the text in memory
+	size_t flushed; // Bytes already written to the file
+} Emitter;
+
+// --- In-Memory Code (--run) ---
+typedef struct {
+	char *base;					// One mapping: text, read-only data, then data and bss
+	size_t size;
+	long (*enter)(long *stack);	// Calls main on a _start-style stack (see jit.c)
+} JitImage;
+
+// --- Time Report (--time-report) ---
+typedef enum {
+	PHASE_PREPROCESS,
+	PHASE_PARSE,			// Lexing and parsing (including precompiled headers)
+	PHASE_OPTIMIZE,
+	PHASE_REACHABILITY,
+	PHASE_CODEGEN,
+	PHASE_COUNT
+} Phase;
+
+typedef struct {
+	long wall_ns;
+	long cpu_ns;			// Summed over every thread that worked on the phase
+} PhaseTime;
+
+typedef struct {
+	int enabled;
+	PhaseTime phases[PHASE_COUNT];
+	long tokens;			// Tokens consumed by the parser
+	long nodes;				// AST nodes created or loaded
+	long functions_emitted;
+	long functions_eliminated;	// Dropped by dead code elimination
+	long asm_bytes;
+	long peak_heap;			// Heap in use, sampled at phase boundaries
+} CompileReport;
+
+typedef struct {
+	struct timespec wall;
+	struct timespec cpu;
+} PhaseClock;
+
+// --- Arena ---
+typedef struct ArenaBlock ArenaBlock;
+
+typedef struct {
+	ArenaBlock *head;
+	size_t allocated;	// Bytes handed out
+	size_t reserved;	// Bytes obtained from malloc
+} Arena;
+
+// --- Interner ---
+typedef struct {
+	struct InternEntry *table;
+	int capacity;		// Always a power of two
+	int count;
+	Arena arena;		// Holds the string bytes
+} Interner;
+
+/* ========================================================================= */
+/* COMPILER CONTEXT                                                          */
+/* ========================================================================= */
+
+// Everything one compilation needs. Compilers are independent of each
+// other, so several can run at once on different threads.
+typedef struct HeliumCompiler {
+	// Options
+	const char **include_paths;	// Searched in order for #include
+	int include_path_count;
+	int jobs;					// Code generation threads
+	const char *cache_dir;		// Reuse earlier output from here (or NULL)
+	int module;					// -c: compile one object of a larger program
+
+	// Lexer
+	Token current_token;
+	char *source_code;
+	const char *current_filename;
+	int src_pos;
+	int current_line;
+	int current_col;
+	Table macro_table;
+	CacheKey *token_hash;		// advance() hashes consumed tokens here (or NULL)
+
+	// Tokens lexed ahead of the parser (see advance)
+	Token *tokens;
+	const char **token_files;	// The file each token came from
+	int token_count;
+	int token_capacity;
+	int token_next;				// Index of the token after current_token
+	int use_pch;				// Load fresh precompiled headers
+	Table lexed_structs;		// Every name lexed right after 'struct'
+	int after_struct;			// The last token lexed was 'struct'
+	Table *pch_names;			// --emit-pch: every name the header lexes
+	PchLoad *pch_loads;			// Indexed by a TOKEN_PCH token's value
+	int pch_load_count;
+	int pch_load_capacity;
+
+	// Preprocessor
+	struct Span *spans;
+	int span_count;
+	int span_capacity;
+	Table file_cache;			// Canonical path -> SourceFile
+	PreprocessStats stats;
+
+	// Names and AST
+	Interner names;
+	Arena ast_arena;			// AST nodes live here until the end
+
+	// Codegen tables (read-only once parsing is over)
+	Table struct_table;
+	Table global_table;
+	Table prim_table;			// Interned type name -> PrimType
+	Table asm_register_table;	// Interned names of the registers asm operands can use
+	const char *name_int, *name_ptr, *name_u8, *name_rbp, *name_main, *name_flush_all;
+	const char *name_rsp, *name_out, *name_clobber;
+	int flush_at_exit;			// main's caller calls EXIT_HOOK
+
+	// --time-report
+	CompileReport report;
+
+	// Compilation cache
+	CacheStats cache_stats;
+	CacheKey context_key;		// Everything besides its own tokens a function depends on
+	Table function_keys;		// Function node -> CacheKey
+	Emitter cache_out;			// The whole unit, kept to be stored on success
+
+	// Errors
+	pthread_mutex_t error_lock;
+	int failed;
+	char error[2048];			// The first diagnostic, ready to print
+} HeliumCompiler;
+
 /* ========================================================================= */
 /* GLOBAL VARIABLES                                                          */
 /* ========================================================================= */
 
-extern Token current_token;
-extern char *source_code;
-extern char *current_filename;
-extern char *current_func_name;
-extern int src_pos;
-extern int current_col;
-extern int current_line;
-extern int filename_allocated;
+// The compiler this thread is working for
+extern __thread HeliumCompiler *hc;
 
-// Struct Registry Globals
-extern StructDef struct_registry[20];
-extern int struct_count;
+// Where errors unwind to on this thread (set by helium_compile())
+extern __thread jmp_buf *error_jump;
+
+// Where gen_asm() writes (each code generation thread has its own)
+extern __thread Emitter *asm_out;
 
 /* ========================================================================= */
 /* FUNCTION PROTOTYPES                                                       */
 /* ========================================================================= */
 
+// Compiler
+HeliumCompiler *helium_new(void);
+void helium_add_include_path(HeliumCompiler *compiler, const char *dir);
+int helium_compile(HeliumCompiler *compiler, const char *input_filename, Emitter *out);
+int helium_compile_header(HeliumCompiler *compiler, const char *input_filename, Emitter *out);
+const char *helium_error(const HeliumCompiler *compiler);
+void helium_free(HeliumCompiler *compiler);
+
 // Lexer
+void add_macro(const char *name, Token value);
 Token get_next_token(void);
-Token peek_next_token(void);
+void lex_begin(int use_pch);
+Token peek_token(int distance);
 void advance(void);
-void free_macros(void);
 
 // Parser
 ASTNode *create_node(NodeType type);
 ASTNode *parse_function(void);
 ASTNode *parse_struct_definition(void);
-void free_ast(ASTNode *node);
+ASTNode *parse_global_declaration(void);
+int is_declaration_start(void);
+int asm_operand_length(const char *text);
 void optimize_ast(ASTNode *node);
-void analyze_reachability(ASTNode *all_funcs);
+void analyze_reachability(ASTNode *all_funcs, int keep_exported);
 
 // Codegen
+void init_codegen(void);
 void gen_asm(ASTNode *node);
+void gen_functions(ASTNode **funcs, int count, int thread_count, Emitter *out);
+int default_jobs(void);
 StructDef *get_struct(const char *name);
+StructDef *add_struct(const char *name);
+StructMember *add_struct_member(StructDef *sdef);
+int type_size(const char *type);
+int type_is_unsigned(const char *type);
+
+// JIT (--run)
+int helium_jit(HeliumCompiler *compiler, const char *input_filename, JitImage *image);
+int jit_run(const JitImage *image, int argc, char **argv);
+void jit_free(JitImage *image);
+
+// Arena
+void *arena_alloc(Arena *arena, size_t size, size_t align);
+void arena_free(Arena *arena);
+
+// Assembly Output
+void emit_init_fd(Emitter *e, int fd);
+void emit_init_memory(Emitter *e);
+int emit_flush(Emitter *e);
+int emit_close(Emitter *e);
+char *emit_take(Emitter *e, size_t *len);
+void emit_bytes(Emitter *e, const char *s, size_t n);
+void emitf(Emitter *e, const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+
+// Hash Tables
+void *table_get(const Table *table, const void *key);
+void table_put(Table *table, const void *key, void *value);
+void table_free(Table *table);
+
+// Interner
+const char *intern(const char *s, int len);
+const char *intern_cstr(const char *s);
+void free_interned(Interner *names);
+
+// Time Report
+void phase_begin(PhaseClock *clock);
+void phase_end(Phase phase, const PhaseClock *clock);
+void phase_add_cpu(Phase phase, const PhaseClock *clock);
+void helium_write_report(const HeliumCompiler *compiler, const char *input_filename, FILE *out, int json);
+
+// Compilation Cache
+void cache_key_init(CacheKey *key);
+void cache_key_add(CacheKey *key, const void *data, size_t len);
+void cache_key_add_token(CacheKey *key, const Token *token);
+char *cache_load(const char *kind, const CacheKey *key, size_t *len);
+void cache_store(const char *kind, const CacheKey *key, const char *text, size_t len);
 
+// Precompiled Headers
+void pch_write(Emitter *out, const char *text, const Table *names, const CacheKey *context_hash,
+			   ASTNode **items, const char **item_files, const CacheKey *item_keys, int item_count);
+int pch_load(Token marker, ASTNode ***items, int *item_count);
 
 // Preprocessor
 char *preprocess_file(const char *filename);
+void free_preprocessor(HeliumCompiler *compiler);
 
-// Utils
-void error(const char *message);
-void error_at(Token token, const char *message);
-void error_at_pos(int line, int col, int offset, const char *fmt, ...);
+// Utils (none of these return; they unwind to helium_compile())
+_Noreturn void error(const char *message);
+_Noreturn void error_at(Token token, const char *message);
+_Noreturn void error_at_pos(int line, int col, int offset, const char *fmt, ...);
+_Noreturn void fatal(const char *fmt, ...) __attribute__((format(printf, 1, 2)));
+_Noreturn void helium_raise(void);
 
 #endif /* HELIUM_H */
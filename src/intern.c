@@ -0,0 +1,106 @@
+#include "helium.h"
+
+/* ========================================================================= */
+/* STRING INTERNING															 */
+/* ========================================================================= */
+
+// Every identifier, keyword, type name and string literal is stored exactly
+// once. Later phases compare names by pointer instead of with strcmp().
+
+// Each compiler has its own table (hc->names), so no locking is needed
+
+typedef struct InternEntry {
+	const char *str;
+	unsigned int hash;
+	int len;
+} InternEntry;
+
+// FNV-1a
+static
+unsigned int hash_bytes(const char *s, int len)
+{
+	unsigned int h = 2166136261u;
+	for (int i = 0; i < len; i++) {
+		h ^= (unsigned char)s[i];
+		h *= 16777619u;
+	}
+	return h;
+}
+
+static
+char *intern_store(Interner *names, const char *s, int len)
+{
+	char *copy = arena_alloc(&names->arena, (size_t)len + 1, 1);
+	memcpy(copy, s, len);
+	copy[len] = '\0';
+	return copy;
+}
+
+static
+void intern_grow(Interner *names)
+{
+	int old_capacity = names->capacity;
+	InternEntry *old_table = names->table;
+
+	InternEntry *table = calloc(old_capacity ? old_capacity * 2 : 1024, sizeof(InternEntry));
+	if (!table)
+		fatal("Error: Out of memory interning strings");
+	names->table = table;
+	names->capacity = old_capacity ? old_capacity * 2 : 1024;
+
+	// Re-insert with the cached hashes; no string is touched
+	for (int i = 0; i < old_capacity; i++) {
+		if (!old_table[i].str) continue;
+		int slot = old_table[i].hash & (names->capacity - 1);
+		while (names->table[slot].str)
+			slot = (slot + 1) & (names->capacity - 1);
+		names->table[slot] = old_table[i];
+	}
+	free(old_table);
+}
+
+// Return the unique copy of s[0..len)
+const char *intern(const char *s, int len)
+{
+	Interner *names = &hc->names;
+	unsigned int hash = hash_bytes(s, len);
+
+	// Finding an existing string never modifies the table
+	if (names->capacity) {
+		int slot = hash & (names->capacity - 1);
+		while (names->table[slot].str) {
+			const InternEntry *e = &names->table[slot];
+			if (e->hash == hash && e->len == len && memcmp(e->str, s, len) == 0)
+				return e->str;
+			slot = (slot + 1) & (names->capacity - 1);
+		}
+	}
+
+	// Keep the load factor at or below 1/2
+	if ((names->count + 1) * 2 > names->capacity)
+		intern_grow(names);
+
+	int slot = hash & (names->capacity - 1);
+	while (names->table[slot].str)
+		slot = (slot + 1) & (names->capacity - 1);
+
+	names->table[slot].str = intern_store(names, s, len);
+	names->table[slot].hash = hash;
+	names->table[slot].len = len;
+	names->count++;
+	return names->table[slot].str;
+}
+
+const char *intern_cstr(const char *s)
+{
+	return intern(s, strlen(s));
+}
+
+void free_interned(Interner *names)
+{
+	arena_free(&names->arena);
+	free(names->table);
+	names->table = NULL;
+	names->capacity = 0;
+	names->count = 0;
+}
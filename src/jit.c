@@ -0,0 +1,1464 @@
+#include "helium.h"
+
+#include <errno.h>
+#include <stdint.h>
+#include <strings.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+extern char **environ;
+
+/* ========================================================================= */
+/* IN-MEMORY ASSEMBLER														 */
+/* ========================================================================= */
+
+// 'heliumc --run' assembles the text that would have gone to out.s straight
+// into memory, so no file is written and neither nasm nor ld is needed. It
+// reads the NASM that codegen emits plus the rest of the common integer
+// instruction set: labels with NASM's '.local' scoping, section, align,
+// global, extern, times, and the data and reserve directives. Symbols are
+// always addressed RIP-relative, as if 'default rel' were in effect.
+
+typedef enum {
+	SEC_TEXT,
+	SEC_RODATA,
+	SEC_DATA,
+	SEC_BSS,		// Only has a length
+	SEC_COUNT
+} SectionId;
+
+static const char *const section_names[SEC_COUNT] = {".text", ".rodata", ".data", ".bss"};
+
+typedef struct {
+	SectionId section;
+	size_t offset;
+} JitSymbol;
+
+// A rel32 to patch once every label has an address
+typedef struct {
+	SectionId section;
+	size_t at;				// Where the 32 bits go
+	size_t end;				// End of the instruction, which rel32 counts from
+	const char *name;		// Target (interned)
+	long addend;
+} Fixup;
+
+typedef struct {
+	Emitter sections[SEC_BSS];	// Bytes of .text, .rodata and .data
+	size_t bss_size;
+	SectionId current;
+	Table symbols;				// Interned name -> JitSymbol
+	Fixup *fixups;
+	int fixup_count;
+	int fixup_capacity;
+	const char *scope;			// Last non-local label, which '.name' labels belong to
+	const char *line;			// Line being assembled, for errors
+	int line_len;
+} Assembler;
+
+typedef enum {
+	OP_REG,
+	OP_IMM,
+	OP_MEM,
+	OP_LABEL,
+} OperandKind;
+
+#define BASE_RIP 16
+
+typedef struct {
+	OperandKind kind;
+	int size;			// Register width, or a memory operand's size keyword (0 if none)
+	int reg;			// OP_REG
+	long value;			// Immediate, displacement, or a label's addend
+	int base;			// OP_MEM base register, BASE_RIP, or -1
+	int index;			// OP_MEM index register, or -1
+	int scale;
+	int rip;			// 'rel' was written
+	int reg_size;		// Width of the last register parsed
+	const char *symbol;	// OP_LABEL target, or what a RIP-relative OP_MEM addresses
+} Operand;
+
+typedef struct {
+	const char *p;
+	const char *end;
+} Cursor;
+
+static
+_Noreturn void asm_error(const Assembler *as, const char *fmt, ...)
+{
+	char message[512];
+	va_list args;
+	va_start(args, fmt);
+	vsnprintf(message, sizeof(message), fmt, args);
+	va_end(args);
+	fatal("Error: --run could not assemble '%.*s': %s", as->line_len, as->line, message);
+}
+
+static
+size_t section_size(const Assembler *as, SectionId section)
+{
+	return section == SEC_BSS ? as->bss_size : as->sections[section].len;
+}
+
+static
+void put_bytes(Assembler *as, const void *bytes, size_t n)
+{
+	if (as->current != SEC_BSS) {
+		emit_bytes(&as->sections[as->current], bytes, n);
+		return;
+	}
+	for (size_t i = 0; i < n; i++) {
+		if (((const unsigned char *)bytes)[i] != 0)
+			asm_error(as, "only zeros can go in .bss");
+	}
+	as->bss_size += n;
+}
+
+static
+void put_fill(Assembler *as, size_t n, unsigned char fill)
+{
+	if (as->current == SEC_BSS && fill == 0) {
+		as->bss_size += n;
+		return;
+	}
+	unsigned char chunk[64];
+	memset(chunk, fill, sizeof(chunk));
+	while (n > 0) {
+		size_t step = n < sizeof(chunk) ? n : sizeof(chunk);
+		put_bytes(as, chunk, step);
+		n -= step;
+	}
+}
+
+/* ========================================================================= */
+/* PARSING																	 */
+/* ========================================================================= */
+
+static
+void skip_space(Cursor *c)
+{
+	while (c->p < c->end && isspace((unsigned char)*c->p))
+		c->p++;
+}
+
+static
+int accept(Cursor *c, char ch)
+{
+	skip_space(c);
+	if (c->p < c->end && *c->p == ch) {
+		c->p++;
+		return 1;
+	}
+	return 0;
+}
+
+static
+int is_name_char(char ch)
+{
+	return isalnum((unsigned char)ch) || ch == '_' || ch == '.' || ch == '$' || ch == '?' || ch == '@';
+}
+
+// Reads a label, mnemonic or register name. Returns its length (0 if there is none).
+static
+int read_name(Cursor *c, const char **name)
+{
+	skip_space(c);
+	*name = c->p;
+	if (c->p >= c->end || isdigit((unsigned char)*c->p) || !is_name_char(*c->p))
+		return 0;
+	while (c->p < c->end && is_name_char(*c->p))
+		c->p++;
+	return c->p - *name;
+}
+
+static
+int name_is(const char *name, int len, const char *word)
+{
+	return (int)strlen(word) == len && strncasecmp(name, word, len) == 0;
+}
+
+static const char *const legacy_registers[4][8] = {
+	{"al", "cl", "dl", "bl", "spl", "bpl", "sil", "dil"},
+	{"ax", "cx", "dx", "bx", "sp", "bp", "si", "di"},
+	{"eax", "ecx", "edx", "ebx", "esp", "ebp", "esi", "edi"},
+	{"rax", "rcx", "rdx", "rbx", "rsp", "rbp", "rsi", "rdi"},
+};
+
+// Returns the register's number (0-15) and width, or -1
+static
+int parse_register(const char *name, int len, int *size)
+{
+	for (int w = 0; w < 4; w++) {
+		for (int r = 0; r < 8; r++) {
+			if (name_is(name, len, legacy_registers[w][r])) {
+				*size = 1 << w;
+				return r;
+			}
+		}
+	}
+
+	// r8-r15, with a 'd', 'w' or 'b' suffix for the narrower widths
+	if (len < 2 || len > 4 || tolower((unsigned char)name[0]) != 'r' || !isdigit((unsigned char)name[1]))
+		return -1;
+	int n = 0, i = 1;
+	while (i < len && isdigit((unsigned char)name[i]))
+		n = n * 10 + name[i++] - '0';
+	if (n < 8 || n > 15)
+		return -1;
+	if (i == len) *size = 8;
+	else if (i + 1 == len && tolower((unsigned char)name[i]) == 'd') *size = 4;
+	else if (i + 1 == len && tolower((unsigned char)name[i]) == 'w') *size = 2;
+	else if (i + 1 == len && tolower((unsigned char)name[i]) == 'b') *size = 1;
+	else return -1;
+	return n;
+}
+
+static
+int digit_value(char ch)
+{
+	if (isdigit((unsigned char)ch)) return ch - '0';
+	if (ch >= 'a' && ch <= 'f') return ch - 'a' + 10;
+	if (ch >= 'A' && ch <= 'F') return ch - 'A' + 10;
+	return -1;
+}
+
+// Decimal, 0x hex, 0b binary or a 'c' character constant
+static
+long parse_number(Assembler *as, Cursor *c)
+{
+	skip_space(c);
+	if (c->p < c->end && *c->p == '\'') {
+		if (c->end - c->p < 3 || c->p[2] != '\'')
+			asm_error(as, "bad character constant");
+		long value = (unsigned char)c->p[1];
+		c->p += 3;
+		return value;
+	}
+
+	int base = 10;
+	if (c->end - c->p > 2 && c->p[0] == '0' && (c->p[1] == 'x' || c->p[1] == 'X')) {
+		base = 16;
+		c->p += 2;
+	} else if (c->end - c->p > 2 && c->p[0] == '0' && (c->p[1] == 'b' || c->p[1] == 'B')) {
+		base = 2;
+		c->p += 2;
+	}
+
+	unsigned long value = 0;
+	int digits = 0;
+	for (; c->p < c->end; c->p++) {
+		if (*c->p == '_') continue;
+		int d = digit_value(*c->p);
+		if (d < 0 || d >= base) break;
+		value = value * base + d;
+		digits++;
+	}
+	if (!digits || (c->p < c->end && is_name_char(*c->p)))
+		asm_error(as, "bad number");
+	return (long)value;
+}
+
+// Local labels ('.name') belong to the last ordinary label before them.
+// A '$' in front marks a name that would otherwise read as a register or
+// keyword, and is not part of it.
+static
+const char *symbol_name(const Assembler *as, const char *name, int len)
+{
+	if (name[0] == '$' && len > 1) {
+		name++;
+		len--;
+	}
+	if (name[0] != '.' || !as->scope)
+		return intern(name, len);
+
+	char buffer[512];
+	int n = snprintf(buffer, sizeof(buffer), "%s%.*s", as->scope, len, name);
+	if (n >= (int)sizeof(buffer))
+		asm_error(as, "label name is too long");
+	return intern(buffer, n);
+}
+
+static
+void add_register(Assembler *as, Operand *op, int reg, int size, long scale, int sign)
+{
+	if (sign < 0)
+		asm_error(as, "registers cannot be subtracted");
+	op->reg_size = size;
+	if (scale == 1 && op->base < 0) {
+		op->base = reg;
+	} else if (op->index < 0 && (scale == 1 || scale == 2 || scale == 4 || scale == 8)) {
+		op->index = reg;
+		op->scale = scale;
+	} else {
+		asm_error(as, "bad address");
+	}
+}
+
+static
+void parse_term(Assembler *as, Cursor *c, Operand *op, int sign)
+{
+	skip_space(c);
+	if (c->p < c->end && (isdigit((unsigned char)*c->p) || *c->p == '\'')) {
+		long value = parse_number(as, c);
+		const char *name;
+		if (accept(c, '*')) {
+			int size, len = read_name(c, &name);
+			int reg = parse_register(name, len, &size);
+			if (reg < 0)
+				asm_error(as, "expected a register after '*'");
+			add_register(as, op, reg, size, value, sign);
+		} else {
+			op->value += sign * value;
+		}
+		return;
+	}
+
+	const char *name;
+	int size, len = read_name(c, &name);
+	if (!len)
+		asm_error(as, "expected an operand");
+
+	int reg = parse_register(name, len, &size);
+	if (reg >= 0) {
+		long scale = accept(c, '*') ? parse_number(as, c) : 1;
+		add_register(as, op, reg, size, scale, sign);
+		return;
+	}
+
+	if (sign < 0 || op->symbol)
+		asm_error(as, "an operand can only add one label");
+	op->symbol = symbol_name(as, name, len);
+}
+
+// A sum of registers, numbers and at most one label
+static
+void parse_terms(Assembler *as, Cursor *c, Operand *op)
+{
+	int sign = accept(c, '-') ? -1 : 1;
+	for (;;) {
+		parse_term(as, c, op, sign);
+		if (accept(c, '+')) sign = 1;
+		else if (accept(c, '-')) sign = -1;
+		else break;
+		if (accept(c, '-')) sign = -sign;	// Codegen writes [rbp + -8]
+	}
+}
+
+static
+void parse_operand(Assembler *as, Cursor *c, Operand *op)
+{
+	memset(op, 0, sizeof(*op));
+	op->base = op->index = -1;
+
+	// Memory size keyword
+	Cursor start = *c;
+	const char *name;
+	int len = read_name(c, &name);
+	if (name_is(name, len, "byte")) op->size = 1;
+	else if (name_is(name, len, "word")) op->size = 2;
+	else if (name_is(name, len, "dword")) op->size = 4;
+	else if (name_is(name, len, "qword")) op->size = 8;
+	else *c = start;
+
+	if (!accept(c, '[')) {
+		if (op->size)
+			asm_error(as, "size keywords only apply to memory operands");
+		parse_terms(as, c, op);
+		if (op->base >= 0 && op->index < 0 && op->value == 0 && !op->symbol) {
+			op->kind = OP_REG;
+			op->reg = op->base;
+			op->size = op->reg_size;
+		} else if (op->base >= 0 || op->index >= 0) {
+			asm_error(as, "bad operand");
+		} else {
+			op->kind = op->symbol ? OP_LABEL : OP_IMM;
+		}
+		return;
+	}
+
+	op->kind = OP_MEM;
+	start = *c;
+	len = read_name(c, &name);
+	if (name_is(name, len, "rel"))
+		op->rip = 1;
+	else
+		*c = start;
+
+	parse_terms(as, c, op);
+	if (!accept(c, ']'))
+		asm_error(as, "expected ']'");
+
+	if (op->symbol || op->rip) {
+		if (op->base >= 0 || op->index >= 0)
+			asm_error(as, "labels are addressed RIP-relative and cannot add registers");
+		op->base = BASE_RIP;
+	}
+	if ((op->base >= 0 && op->base != BASE_RIP && op->reg_size != 8) || op->index == 4)
+		asm_error(as, "bad address");
+	if (op->value < INT32_MIN || op->value > INT32_MAX)
+		asm_error(as, "displacement does not fit in 32 bits");
+}
+
+// A number (possibly a sum) for directives
+static
+long parse_constant(Assembler *as, Cursor *c)
+{
+	Operand op;
+	parse_operand(as, c, &op);
+	if (op.kind != OP_IMM)
+		asm_error(as, "expected a number");
+	return op.value;
+}
+
+/* ========================================================================= */
+/* ENCODING																	 */
+/* ========================================================================= */
+
+// One instruction: [66] [prefix] [REX] opcode [ModRM [SIB] [disp]] [imm]
+typedef struct {
+	int size;					// Operand size: 2 adds 0x66, 8 sets REX.W
+	unsigned char prefix;		// Mandatory prefix (0xF3) or 0
+	int force_rex;				// spl, bpl, sil or dil is used
+	unsigned char opcode[3];
+	int opcode_len;
+	int plus_reg;				// Register added to the last opcode byte, or -1
+	int reg;					// ModRM.reg: a register or an opcode extension
+	const Operand *rm;			// ModRM.rm, or NULL for none
+	int imm_size;				// Bytes of immediate: 0, 1, 2, 4 or 8
+	long imm;
+	const char *target;			// Branch target: the immediate is a rel32 to it
+	long target_addend;
+} Insn;
+
+static
+Insn new_insn(const Operand *ops, int count)
+{
+	Insn in;
+	memset(&in, 0, sizeof(in));
+	in.plus_reg = -1;
+	for (int i = 0; i < count; i++) {
+		if (ops[i].kind == OP_REG && ops[i].size == 1 && ops[i].reg >= 4 && ops[i].reg < 8)
+			in.force_rex = 1;
+	}
+	return in;
+}
+
+static
+void set_opcode(Insn *in, int a, int b, int c)
+{
+	in->opcode_len = 0;
+	in->opcode[in->opcode_len++] = a;
+	if (b >= 0) in->opcode[in->opcode_len++] = b;
+	if (c >= 0) in->opcode[in->opcode_len++] = c;
+}
+
+static
+void add_fixup(Assembler *as, size_t at, size_t end, const char *name, long addend)
+{
+	if (as->fixup_count == as->fixup_capacity) {
+		int capacity = as->fixup_capacity ? as->fixup_capacity * 2 : 256;
+		Fixup *fixups = realloc(as->fixups, capacity * sizeof(Fixup));
+		if (!fixups)
+			fatal("Error: Out of memory");
+		as->fixups = fixups;
+		as->fixup_capacity = capacity;
+	}
+	as->fixups[as->fixup_count++] = (Fixup){as->current, at, end, name, addend};
+}
+
+static
+int put_le(unsigned char *code, int len, long value, int size)
+{
+	for (int i = 0; i < size; i++)
+		code[len++] = (unsigned long)value >> (8 * i);
+	return len;
+}
+
+static
+int fits_int8(long value)
+{
+	return value >= -128 && value <= 127;
+}
+
+// ModRM, SIB and displacement for 'rm'. Sets *fixup_at for a label's disp32.
+static
+int put_modrm(unsigned char *code, int len, int reg, const Operand *rm, int *fixup_at)
+{
+	reg = (reg & 7) << 3;
+	if (rm->kind == OP_REG) {
+		code[len++] = 0xC0 | reg | (rm->reg & 7);
+		return len;
+	}
+
+	long disp = rm->value;
+	if (rm->base == BASE_RIP) {
+		code[len++] = 0x05 | reg;
+		if (rm->symbol)
+			*fixup_at = len;
+		return put_le(code, len, rm->symbol ? 0 : disp, 4);
+	}
+
+	if (rm->base < 0) {
+		// No base: disp32, with or without an index
+		code[len++] = 0x04 | reg;
+		int index = rm->index >= 0 ? rm->index & 7 : 4;
+		int scale = rm->index >= 0 ? __builtin_ctz(rm->scale) : 0;
+		code[len++] = scale << 6 | index << 3 | 5;
+		return put_le(code, len, disp, 4);
+	}
+
+	// rbp and r13 have no disp-less form
+	int mod = 2;
+	if (disp == 0 && (rm->base & 7) != 5) mod = 0;
+	else if (fits_int8(disp)) mod = 1;
+
+	if (rm->index >= 0) {
+		code[len++] = mod << 6 | reg | 4;
+		code[len++] = __builtin_ctz(rm->scale) << 6 | (rm->index & 7) << 3 | (rm->base & 7);
+	} else if ((rm->base & 7) == 4) {
+		// rsp and r12 always need a SIB byte
+		code[len++] = mod << 6 | reg | 4;
+		code[len++] = 0x24;
+	} else {
+		code[len++] = mod << 6 | reg | (rm->base & 7);
+	}
+	if (mod == 1) len = put_le(code, len, disp, 1);
+	if (mod == 2) len = put_le(code, len, disp, 4);
+	return len;
+}
+
+static
+void emit_insn(Assembler *as, const Insn *in)
+{
+	int rex = in->size == 8 ? 0x08 : 0;
+	if (in->rm) {
+		if (in->reg & 8) rex |= 0x04;
+		if (in->rm->kind == OP_REG && (in->rm->reg & 8)) rex |= 0x01;
+		if (in->rm->kind == OP_MEM && in->rm->index >= 8) rex |= 0x02;
+		if (in->rm->kind == OP_MEM && in->rm->base >= 8 && in->rm->base != BASE_RIP) rex |= 0x01;
+	}
+	if (in->plus_reg >= 8) rex |= 0x01;
+
+	unsigned char code[32];
+	int len = 0;
+	if (in->size == 2) code[len++] = 0x66;
+	if (in->prefix) code[len++] = in->prefix;
+	if (rex || in->force_rex) code[len++] = 0x40 | rex;
+	memcpy(code + len, in->opcode, in->opcode_len);
+	len += in->opcode_len;
+	if (in->plus_reg >= 0) code[len - 1] += in->plus_reg & 7;
+
+	int disp_at = -1;
+	if (in->rm)
+		len = put_modrm(code, len, in->reg, in->rm, &disp_at);
+	int imm_at = len;
+	len = put_le(code, len, in->imm, in->imm_size);
+
+	size_t start = section_size(as, as->current);
+	if (disp_at >= 0)
+		add_fixup(as, start + disp_at, start + len, in->rm->symbol, in->rm->value);
+	if (in->target)
+		add_fixup(as, start + imm_at, start + len, in->target, in->target_addend);
+	put_bytes(as, code, len);
+}
+
+/* ========================================================================= */
+/* INSTRUCTIONS																 */
+/* ========================================================================= */
+
+static const struct {
+	const char *name;
+	unsigned char bytes[3];
+	int len;
+} simple_instructions[] = {
+	{"ret", {0xC3}, 1},			{"syscall", {0x0F, 0x05}, 2},	{"nop", {0x90}, 1},
+	{"cqo", {0x48, 0x99}, 2},	{"cdq", {0x99}, 1},				{"cdqe", {0x48, 0x98}, 2},
+	{"leave", {0xC9}, 1},		{"int3", {0xCC}, 1},			{"ud2", {0x0F, 0x0B}, 2},
+	{"pause", {0xF3, 0x90}, 2},	{"cld", {0xFC}, 1},				{"std", {0xFD}, 1},
+	{"movsb", {0xA4}, 1},		{"movsq", {0x48, 0xA5}, 2},		{"stosb", {0xAA}, 1},
+	{"stosq", {0x48, 0xAB}, 2},	{"lodsb", {0xAC}, 1},			{"cmpsb", {0xA6}, 1},
+	{"scasb", {0xAE}, 1},		{"rdtsc", {0x0F, 0x31}, 2},		{"mfence", {0x0F, 0xAE, 0xF0}, 3},
+	{"cpuid", {0x0F, 0xA2}, 2},
+};
+
+#define SIMPLE_INSTRUCTION_COUNT (sizeof(simple_instructions) / sizeof(simple_instructions[0]))
+
+static const char *const alu_names[] = {"add", "or", "adc", "sbb", "and", "sub", "xor", "cmp"};
+static const char *const shift_names[] = {"rol", "ror", "rcl", "rcr", "shl", "shr", "sal", "sar"};
+static const char *const unary_names[] = {"test", NULL, "not", "neg", "mul", "imul", "div", "idiv"};
+static const char *const condition_names[] = {
+	"o", "no", "b", "ae", "e", "ne", "be", "a", "s", "ns", "p", "np", "l", "ge", "le", "g",
+	NULL, NULL, "c", "nb", "z", "nz", "na", "nbe", NULL, NULL, "pe", "po", "nge", "nl", "ng", "nle",
+};
+
+static
+int find_name(const char *const *names, int count, const char *name)
+{
+	for (int i = 0; i < count; i++) {
+		if (names[i] && strcmp(names[i], name) == 0)
+			return i;
+	}
+	return -1;
+}
+
+// The condition code of 'je', 'setne', 'cmovbe', ... (after the prefix)
+static
+int condition_code(const char *suffix)
+{
+	int n = find_name(condition_names, 32, suffix);
+	if (n < 0) return -1;
+	if (n >= 16) {
+		// Aliases: c = b, nb = ae, z = e, ...
+		static const int alias[16] = {0, 0, 2, 3, 4, 5, 6, 7, 0, 0, 10, 11, 12, 13, 14, 15};
+		return alias[n - 16];
+	}
+	return n;
+}
+
+// The operation size of a two-operand instruction
+static
+int operand_size(Assembler *as, const Operand *ops, int count)
+{
+	int size = 0;
+	for (int i = 0; i < count; i++) {
+		if (ops[i].kind != OP_REG && ops[i].kind != OP_MEM) continue;
+		if (!ops[i].size) continue;
+		if (size && ops[i].size != size)
+			asm_error(as, "operand sizes do not match");
+		size = ops[i].size;
+	}
+	if (!size)
+		asm_error(as, "operation size not specified");
+	return size;
+}
+
+// An immediate for a 'size'-wide operation: bytes beyond 32 are sign-extended
+static
+long check_imm(Assembler *as, long value, int size)
+{
+	long lo = size == 1 ? -128 : size == 2 ? -32768 : INT32_MIN;
+	long hi = size == 1 ? 255 : size == 2 ? 65535 : size == 4 ? UINT32_MAX : INT32_MAX;
+	if (value < lo || value > hi)
+		asm_error(as, "immediate does not fit");
+	if (size == 1) return (signed char)value;
+	if (size == 2) return (short)value;
+	return (int)value;
+}
+
+static
+void expect_operands(Assembler *as, int count, int expected)
+{
+	if (count != expected)
+		asm_error(as, "expected %d operand%s", expected, expected == 1 ? "" : "s");
+}
+
+static
+int is_rm(const Operand *op)
+{
+	return op->kind == OP_REG || op->kind == OP_MEM;
+}
+
+static
+void assemble_instruction(Assembler *as, const char *mnemonic, Operand *ops, int count)
+{
+	Insn in = new_insn(ops, count);
+	int n;
+
+	for (size_t i = 0; i < SIMPLE_INSTRUCTION_COUNT; i++) {
+		if (strcmp(mnemonic, simple_instructions[i].name) == 0) {
+			expect_operands(as, count, 0);
+			put_bytes(as, simple_instructions[i].bytes, simple_instructions[i].len);
+			return;
+		}
+	}
+
+	// add, or, adc, sbb, and, sub, xor, cmp
+	if ((n = find_name(alu_names, 8, mnemonic)) >= 0) {
+		expect_operands(as, count, 2);
+		in.size = operand_size(as, ops, 2);
+		if (ops[1].kind == OP_IMM && is_rm(&ops[0])) {
+			long imm = check_imm(as, ops[1].value, in.size);
+			in.reg = n;
+			in.rm = &ops[0];
+			if (in.size == 1) {
+				set_opcode(&in, 0x80, -1, -1);
+				in.imm_size = 1;
+			} else if (fits_int8(imm)) {
+				set_opcode(&in, 0x83, -1, -1);
+				in.imm_size = 1;
+			} else {
+				set_opcode(&in, 0x81, -1, -1);
+				in.imm_size = in.size == 2 ? 2 : 4;
+			}
+			in.imm = imm;
+		} else if (ops[1].kind == OP_REG && is_rm(&ops[0])) {
+			set_opcode(&in, n * 8 + (in.size == 1 ? 0 : 1), -1, -1);
+			in.reg = ops[1].reg;
+			in.rm = &ops[0];
+		} else if (ops[0].kind == OP_REG && ops[1].kind == OP_MEM) {
+			set_opcode(&in, n * 8 + (in.size == 1 ? 2 : 3), -1, -1);
+			in.reg = ops[0].reg;
+			in.rm = &ops[1];
+		} else {
+			asm_error(as, "bad operands");
+		}
+		emit_insn(as, &in);
+		return;
+	}
+
+	if (strcmp(mnemonic, "mov") == 0) {
+		expect_operands(as, count, 2);
+		in.size = operand_size(as, ops, 2);
+		if (ops[0].kind == OP_REG && ops[1].kind == OP_IMM) {
+			long imm = ops[1].value;
+			in.plus_reg = ops[0].reg;
+			if (in.size == 8 && imm >= 0 && imm <= UINT32_MAX) {
+				in.size = 4;	// Writing the low half zero-extends
+			} else if (in.size == 8 && imm >= INT32_MIN && imm <= INT32_MAX) {
+				set_opcode(&in, 0xC7, -1, -1);
+				in.plus_reg = -1;
+				in.rm = &ops[0];
+				in.imm_size = 4;
+				in.imm = imm;
+				emit_insn(as, &in);
+				return;
+			}
+			if (in.size != 8)
+				imm = check_imm(as, imm, in.size);
+			set_opcode(&in, in.size == 1 ? 0xB0 : 0xB8, -1, -1);
+			in.imm_size = in.size;
+			in.imm = imm;
+		} else if (ops[0].kind == OP_MEM && ops[1].kind == OP_IMM) {
+			set_opcode(&in, in.size == 1 ? 0xC6 : 0xC7, -1, -1);
+			in.rm = &ops[0];
+			in.imm = check_imm(as, ops[1].value, in.size);
+			in.imm_size = in.size == 8 ? 4 : in.size;
+		} else if (ops[1].kind == OP_REG && is_rm(&ops[0])) {
+			set_opcode(&in, in.size == 1 ? 0x88 : 0x89, -1, -1);
+			in.reg = ops[1].reg;
+			in.rm = &ops[0];
+		} else if (ops[0].kind == OP_REG && ops[1].kind == OP_MEM) {
+			set_opcode(&in, in.size == 1 ? 0x8A : 0x8B, -1, -1);
+			in.reg = ops[0].reg;
+			in.rm = &ops[1];
+		} else {
+			asm_error(as, "bad operands");
+		}
+		emit_insn(as, &in);
+		return;
+	}
+
+	if (strcmp(mnemonic, "movzx") == 0 || strcmp(mnemonic, "movsx") == 0) {
+		expect_operands(as, count, 2);
+		if (ops[0].kind != OP_REG || !is_rm(&ops[1]) || (ops[1].size != 1 && ops[1].size != 2))
+			asm_error(as, "bad operands");
+		int sign = strcmp(mnemonic, "movsx") == 0;
+		set_opcode(&in, 0x0F, (sign ? 0xBE : 0xB6) + (ops[1].size == 2), -1);
+		in.size = ops[0].size;
+		in.reg = ops[0].reg;
+		in.rm = &ops[1];
+		emit_insn(as, &in);
+		return;
+	}
+
+	if (strcmp(mnemonic, "movsxd") == 0) {
+		expect_operands(as, count, 2);
+		if (ops[0].kind != OP_REG || ops[0].size != 8 || !is_rm(&ops[1]) || ops[1].size != 4)
+			asm_error(as, "bad operands");
+		set_opcode(&in, 0x63, -1, -1);
+		in.size = 8;
+		in.reg = ops[0].reg;
+		in.rm = &ops[1];
+		emit_insn(as, &in);
+		return;
+	}
+
+	if (strcmp(mnemonic, "lea") == 0) {
+		expect_operands(as, count, 2);
+		if (ops[0].kind != OP_REG || ops[0].size == 1 || ops[1].kind != OP_MEM)
+			asm_error(as, "bad operands");
+		set_opcode(&in, 0x8D, -1, -1);
+		in.size = ops[0].size;
+		in.reg = ops[0].reg;
+		in.rm = &ops[1];
+		emit_insn(as, &in);
+		return;
+	}
+
+	if (strcmp(mnemonic, "push") == 0 || strcmp(mnemonic, "pop") == 0) {
+		expect_operands(as, count, 1);
+		int push = mnemonic[1] == 'u';
+		if (ops[0].kind == OP_REG && ops[0].size == 8) {
+			set_opcode(&in, push ? 0x50 : 0x58, -1, -1);
+			in.plus_reg = ops[0].reg;
+		} else if (ops[0].kind == OP_MEM && (ops[0].size == 8 || ops[0].size == 0)) {
+			set_opcode(&in, push ? 0xFF : 0x8F, -1, -1);
+			in.reg = push ? 6 : 0;
+			in.rm = &ops[0];
+		} else if (push && ops[0].kind == OP_IMM) {
+			in.imm = check_imm(as, ops[0].value, 8);
+			in.imm_size = fits_int8(in.imm) ? 1 : 4;
+			set_opcode(&in, in.imm_size == 1 ? 0x6A : 0x68, -1, -1);
+		} else {
+			asm_error(as, "bad operand");
+		}
+		emit_insn(as, &in);
+		return;
+	}
+
+	// rol, ror, rcl, rcr, shl, shr, sal, sar
+	if ((n = find_name(shift_names, 8, mnemonic)) >= 0) {
+		expect_operands(as, count, 2);
+		if (!is_rm(&ops[0]) || !ops[0].size)
+			asm_error(as, "bad operands");
+		in.size = ops[0].size;
+		in.reg = n == 6 ? 4 : n;
+		in.rm = &ops[0];
+		int wide = in.size != 1;
+		if (ops[1].kind == OP_REG && ops[1].reg == 1 && ops[1].size == 1) {
+			set_opcode(&in, 0xD2 + wide, -1, -1);
+		} else if (ops[1].kind == OP_IMM && ops[1].value == 1) {
+			set_opcode(&in, 0xD0 + wide, -1, -1);
+		} else if (ops[1].kind == OP_IMM && ops[1].value >= 0 && ops[1].value < 256) {
+			set_opcode(&in, 0xC0 + wide, -1, -1);
+			in.imm = ops[1].value;
+			in.imm_size = 1;
+		} else {
+			asm_error(as, "shift counts are 'cl' or a number");
+		}
+		emit_insn(as, &in);
+		return;
+	}
+
+	// imul with two or three operands
+	if (strcmp(mnemonic, "imul") == 0 && count > 1) {
+		if (ops[0].kind != OP_REG || ops[0].size == 1)
+			asm_error(as, "bad operands");
+		const Operand *src = &ops[1];
+		const Operand *imm = count == 3 ? &ops[2] : NULL;
+		if (count == 2 && ops[1].kind == OP_IMM) {
+			src = &ops[0];
+			imm = &ops[1];
+		}
+		if (!is_rm(src) || (imm && imm->kind != OP_IMM) || count > 3)
+			asm_error(as, "bad operands");
+		in.size = ops[0].size;
+		in.reg = ops[0].reg;
+		in.rm = src;
+		if (!imm) {
+			set_opcode(&in, 0x0F, 0xAF, -1);
+		} else {
+			in.imm = check_imm(as, imm->value, in.size);
+			in.imm_size = fits_int8(in.imm) ? 1 : in.size == 2 ? 2 : 4;
+			set_opcode(&in, in.imm_size == 1 ? 0x6B : 0x69, -1, -1);
+		}
+		emit_insn(as, &in);
+		return;
+	}
+
+	if (strcmp(mnemonic, "test") == 0) {
+		expect_operands(as, count, 2);
+		in.size = operand_size(as, ops, 2);
+		in.rm = &ops[0];
+		if (ops[1].kind == OP_IMM && is_rm(&ops[0])) {
+			set_opcode(&in, in.size == 1 ? 0xF6 : 0xF7, -1, -1);
+			in.imm = check_imm(as, ops[1].value, in.size);
+			in.imm_size = in.size == 8 ? 4 : in.size;
+		} else if (ops[1].kind == OP_REG && is_rm(&ops[0])) {
+			set_opcode(&in, in.size == 1 ? 0x84 : 0x85, -1, -1);
+			in.reg = ops[1].reg;
+		} else {
+			asm_error(as, "bad operands");
+		}
+		emit_insn(as, &in);
+		return;
+	}
+
+	if (strcmp(mnemonic, "xchg") == 0) {
+		expect_operands(as, count, 2);
+		in.size = operand_size(as, ops, 2);
+		const Operand *reg = ops[1].kind == OP_REG ? &ops[1] : &ops[0];
+		const Operand *rm = reg == &ops[1] ? &ops[0] : &ops[1];
+		if (reg->kind != OP_REG || !is_rm(rm))
+			asm_error(as, "bad operands");
+		set_opcode(&in, in.size == 1 ? 0x86 : 0x87, -1, -1);
+		in.reg = reg->reg;
+		in.rm = rm;
+		emit_insn(as, &in);
+		return;
+	}
+
+	// not, neg, mul, imul, div, idiv, inc, dec
+	n = find_name(unary_names, 8, mnemonic);
+	int incdec = strcmp(mnemonic, "inc") == 0 ? 0 : strcmp(mnemonic, "dec") == 0 ? 1 : -1;
+	if (n > 0 || incdec >= 0) {
+		expect_operands(as, count, 1);
+		if (!is_rm(&ops[0]) || !ops[0].size)
+			asm_error(as, "bad operand");
+		in.size = ops[0].size;
+		in.rm = &ops[0];
+		in.reg = incdec >= 0 ? incdec : n;
+		if (incdec >= 0)
+			set_opcode(&in, in.size == 1 ? 0xFE : 0xFF, -1, -1);
+		else
+			set_opcode(&in, in.size == 1 ? 0xF6 : 0xF7, -1, -1);
+		emit_insn(as, &in);
+		return;
+	}
+
+	// bsf, bsr, tzcnt, lzcnt, popcnt
+	static const char *const bit_names[] = {"bsf", "bsr", "tzcnt", "lzcnt", "popcnt"};
+	static const unsigned char bit_opcodes[] = {0xBC, 0xBD, 0xBC, 0xBD, 0xB8};
+	if ((n = find_name(bit_names, 5, mnemonic)) >= 0) {
+		expect_operands(as, count, 2);
+		if (ops[0].kind != OP_REG || !is_rm(&ops[1]) || ops[0].size == 1)
+			asm_error(as, "bad operands");
+		in.size = operand_size(as, ops, 2);
+		in.prefix = n >= 2 ? 0xF3 : 0;
+		set_opcode(&in, 0x0F, bit_opcodes[n], -1);
+		in.reg = ops[0].reg;
+		in.rm = &ops[1];
+		emit_insn(as, &in);
+		return;
+	}
+
+	// crc32 r32, r/m8/32 and crc32 r64, r/m8/64
+	if (strcmp(mnemonic, "crc32") == 0) {
+		expect_operands(as, count, 2);
+		int source = ops[1].size ? ops[1].size : ops[0].size;
+		if (ops[0].kind != OP_REG || ops[0].size < 4 || !is_rm(&ops[1]) ||
+			(source != 1 && source != ops[0].size))
+			asm_error(as, "bad operands");
+		in.size = ops[0].size;
+		in.prefix = 0xF2;
+		set_opcode(&in, 0x0F, 0x38, source == 1 ? 0xF0 : 0xF1);
+		in.reg = ops[0].reg;
+		in.rm = &ops[1];
+		emit_insn(as, &in);
+		return;
+	}
+
+	if (strcmp(mnemonic, "bswap") == 0) {
+		expect_operands(as, count, 1);
+		if (ops[0].kind != OP_REG || ops[0].size < 4)
+			asm_error(as, "bad operand");
+		in.size = ops[0].size;
+		set_opcode(&in, 0x0F, 0xC8, -1);
+		in.plus_reg = ops[0].reg;
+		emit_insn(as, &in);
+		return;
+	}
+
+	// jmp, call and jcc: labels are always reached with a rel32
+	int cc = mnemonic[0] == 'j' ? condition_code(mnemonic + 1) : -1;
+	int jump = strcmp(mnemonic, "jmp") == 0;
+	int call = strcmp(mnemonic, "call") == 0;
+	if (jump || call || cc >= 0) {
+		expect_operands(as, count, 1);
+		if (ops[0].kind == OP_LABEL) {
+			if (cc >= 0)
+				set_opcode(&in, 0x0F, 0x80 + cc, -1);
+			else
+				set_opcode(&in, call ? 0xE8 : 0xE9, -1, -1);
+			in.imm_size = 4;
+			in.target = ops[0].symbol;
+			in.target_addend = ops[0].value;
+		} else if (cc < 0 && is_rm(&ops[0]) && (ops[0].size == 8 || ops[0].kind == OP_MEM)) {
+			set_opcode(&in, 0xFF, -1, -1);
+			in.reg = call ? 2 : 4;
+			in.rm = &ops[0];
+		} else {
+			asm_error(as, "bad operand");
+		}
+		emit_insn(as, &in);
+		return;
+	}
+
+	if (strncmp(mnemonic, "set", 3) == 0 && (cc = condition_code(mnemonic + 3)) >= 0) {
+		expect_operands(as, count, 1);
+		if (!is_rm(&ops[0]) || (ops[0].size != 1 && ops[0].size != 0))
+			asm_error(as, "bad operand");
+		set_opcode(&in, 0x0F, 0x90 + cc, -1);
+		in.rm = &ops[0];
+		emit_insn(as, &in);
+		return;
+	}
+
+	if (strncmp(mnemonic, "cmov", 4) == 0 && (cc = condition_code(mnemonic + 4)) >= 0) {
+		expect_operands(as, count, 2);
+		if (ops[0].kind != OP_REG || ops[0].size == 1 || !is_rm(&ops[1]))
+			asm_error(as, "bad operands");
+		in.size = operand_size(as, ops, 2);
+		set_opcode(&in, 0x0F, 0x40 + cc, -1);
+		in.reg = ops[0].reg;
+		in.rm = &ops[1];
+		emit_insn(as, &in);
+		return;
+	}
+
+	asm_error(as, "unknown instruction '%s'", mnemonic);
+}
+
+/* ========================================================================= */
+/* DIRECTIVES AND LINES														 */
+/* ========================================================================= */
+
+// Decodes one NASM backquote escape (after the backslash) into 'out'.
+// Returns the number of bytes written.
+static
+int decode_escape(Assembler *as, Cursor *c, unsigned char *out)
+{
+	if (c->p >= c->end)
+		asm_error(as, "unterminated string");
+	char e = *c->p++;
+	switch (e) {
+		case 'n': *out = '\n'; return 1;
+		case 't': *out = '\t'; return 1;
+		case 'r': *out = '\r'; return 1;
+		case 'a': *out = 7; return 1;
+		case 'b': *out = 8; return 1;
+		case 'v': *out = 11; return 1;
+		case 'f': *out = 12; return 1;
+		case 'e': *out = 27; return 1;
+		case 'x': {
+			int value = 0, digits = 0;
+			while (digits < 2 && c->p < c->end && digit_value(*c->p) >= 0)
+				value = value * 16 + digit_value(*c->p++), digits++;
+			*out = value;
+			return 1;
+		}
+		case 'u':
+		case 'U': {
+			// A code point, written as UTF-8
+			unsigned long cp = 0;
+			for (int i = 0; i < (e == 'u' ? 4 : 8) && c->p < c->end && digit_value(*c->p) >= 0; i++)
+				cp = cp * 16 + digit_value(*c->p++);
+			if (cp < 0x80) { out[0] = cp; return 1; }
+			if (cp < 0x800) { out[0] = 0xC0 | cp >> 6; out[1] = 0x80 | (cp & 63); return 2; }
+			if (cp < 0x10000) {
+				out[0] = 0xE0 | cp >> 12; out[1] = 0x80 | ((cp >> 6) & 63); out[2] = 0x80 | (cp & 63);
+				return 3;
+			}
+			out[0] = 0xF0 | cp >> 18; out[1] = 0x80 | ((cp >> 12) & 63);
+			out[2] = 0x80 | ((cp >> 6) & 63); out[3] = 0x80 | (cp & 63);
+			return 4;
+		}
+		default:
+			if (e >= '0' && e <= '7') {
+				int value = e - '0';
+				for (int i = 0; i < 2 && c->p < c->end && *c->p >= '0' && *c->p <= '7'; i++)
+					value = value * 8 + *c->p++ - '0';
+				*out = value;
+				return 1;
+			}
+			*out = e;	// \\, \`, \', \" and \?
+			return 1;
+	}
+}
+
+// A quoted string in a 'db'. Backquoted strings understand escapes, which
+// the lexer passes through untouched.
+static
+void put_string(Assembler *as, Cursor *c)
+{
+	char quote = *c->p++;
+	const char *run = c->p;
+	while (c->p < c->end && *c->p != quote) {
+		if (*c->p != '\\' || quote != '`') {
+			c->p++;
+			continue;
+		}
+		put_bytes(as, run, c->p - run);
+		c->p++;
+		unsigned char bytes[4];
+		put_bytes(as, bytes, decode_escape(as, c, bytes));
+		run = c->p;
+	}
+	if (c->p >= c->end)
+		asm_error(as, "unterminated string");
+	put_bytes(as, run, c->p - run);
+	c->p++;
+}
+
+static
+void assemble_data(Assembler *as, Cursor *c, int width)
+{
+	do {
+		skip_space(c);
+		if (c->p < c->end && (*c->p == '`' || *c->p == '"' || (*c->p == '\'' && width == 1))) {
+			if (width != 1)
+				asm_error(as, "strings are only supported in 'db'");
+			put_string(as, c);
+			continue;
+		}
+		unsigned char bytes[8];
+		put_le(bytes, 0, parse_constant(as, c), width);
+		put_bytes(as, bytes, width);
+	} while (accept(c, ','));
+}
+
+static
+int data_width(const char *mnemonic, char prefix)
+{
+	if (mnemonic[0] != prefix || strlen(mnemonic) != (size_t)(prefix == 'd' ? 2 : 4))
+		return 0;
+	const char *unit = mnemonic + (prefix == 'd' ? 1 : 3);
+	switch (*unit) {
+		case 'b': return 1;
+		case 'w': return 2;
+		case 'd': return 4;
+		case 'q': return 8;
+		default: return 0;
+	}
+}
+
+static
+void assemble_statement(Assembler *as, Cursor *c)
+{
+	const char *word;
+	int len = read_name(c, &word);
+	if (!len || len >= 16)
+		asm_error(as, "expected an instruction");
+	char mnemonic[16];
+	for (int i = 0; i < len; i++)
+		mnemonic[i] = tolower((unsigned char)word[i]);
+	mnemonic[len] = '\0';
+
+	if (strcmp(mnemonic, "section") == 0 || strcmp(mnemonic, "segment") == 0) {
+		len = read_name(c, &word);
+		for (int s = 0; s < SEC_COUNT; s++) {
+			if (name_is(word, len, section_names[s])) {
+				as->current = s;
+				return;
+			}
+		}
+		asm_error(as, "unknown section");
+	}
+
+	// Symbols are all visible to each other; nothing else is linked
+	if (strcmp(mnemonic, "global") == 0 || strcmp(mnemonic, "extern") == 0 ||
+		strcmp(mnemonic, "default") == 0 || strcmp(mnemonic, "bits") == 0)
+		return;
+
+	if (strcmp(mnemonic, "align") == 0 || strcmp(mnemonic, "alignb") == 0) {
+		long align = parse_constant(as, c);
+		if (align <= 0 || (align & (align - 1)) != 0 || align > 4096)
+			asm_error(as, "alignment must be a power of two up to 4096");
+		size_t size = section_size(as, as->current);
+		put_fill(as, (align - size % align) % align, as->current == SEC_TEXT ? 0x90 : 0);
+		return;
+	}
+
+	int width;
+	if ((width = data_width(mnemonic, 'd')) != 0) {
+		assemble_data(as, c, width);
+		return;
+	}
+	if ((width = data_width(mnemonic, 'r')) != 0 && strncmp(mnemonic, "res", 3) == 0) {
+		long count = parse_constant(as, c);
+		if (count < 0)
+			asm_error(as, "negative size");
+		put_fill(as, count * width, 0);
+		return;
+	}
+
+	if (strcmp(mnemonic, "times") == 0) {
+		long count = parse_constant(as, c);
+		Cursor rest = *c;
+		for (long i = 0; i < count; i++) {
+			*c = rest;
+			assemble_statement(as, c);
+		}
+		return;
+	}
+
+	// Prefixes go in front of the instruction that follows them
+	static const char *const prefixes[] = {"rep", "repe", "repz", "repne", "repnz", "lock"};
+	static const unsigned char prefix_bytes[] = {0xF3, 0xF3, 0xF3, 0xF2, 0xF2, 0xF0};
+	int n = find_name(prefixes, 6, mnemonic);
+	if (n >= 0) {
+		put_bytes(as, &prefix_bytes[n], 1);
+		assemble_statement(as, c);
+		return;
+	}
+
+	Operand ops[3];
+	int count = 0;
+	skip_space(c);
+	if (c->p < c->end) {
+		do {
+			if (count == 3)
+				asm_error(as, "too many operands");
+			parse_operand(as, c, &ops[count++]);
+		} while (accept(c, ','));
+	}
+	skip_space(c);
+	if (c->p < c->end)
+		asm_error(as, "unexpected '%c'", *c->p);
+	assemble_instruction(as, mnemonic, ops, count);
+}
+
+static
+void define_label(Assembler *as, const char *name, int len)
+{
+	const char *symbol = symbol_name(as, name, len);
+	if (table_get(&as->symbols, symbol))
+		asm_error(as, "label '%s' is defined twice", symbol);
+
+	JitSymbol *sym = arena_alloc(&hc->ast_arena, sizeof(JitSymbol), _Alignof(JitSymbol));
+	sym->section = as->current;
+	sym->offset = section_size(as, as->current);
+	table_put(&as->symbols, symbol, sym);
+	if (name[0] != '.')
+		as->scope = symbol;
+}
+
+// Where a ';' comment starts (outside of quotes), or 'end'
+static
+const char *comment_start(const char *p, const char *end)
+{
+	char quote = 0;
+	for (; p < end; p++) {
+		if (quote) {
+			if (*p == '\\' && quote == '`' && p + 1 < end) p++;
+			else if (*p == quote) quote = 0;
+		} else if (*p == '"' || *p == '\'' || *p == '`') {
+			quote = *p;
+		} else if (*p == ';') {
+			break;
+		}
+	}
+	return p;
+}
+
+static
+void assemble(Assembler *as, const char *text, size_t len)
+{
+	const char *end = text + len;
+	while (text < end) {
+		const char *line_end = memchr(text, '\n', end - text);
+		if (!line_end) line_end = end;
+		as->line = text;
+		as->line_len = line_end - text;
+
+		Cursor c = {text, comment_start(text, line_end)};
+		for (;;) {
+			// Any number of 'label:' first
+			Cursor start = c;
+			const char *name;
+			int name_len = read_name(&c, &name);
+			if (name_len && accept(&c, ':')) {
+				define_label(as, name, name_len);
+				continue;
+			}
+			c = start;
+			skip_space(&c);
+			if (c.p < c.end)
+				assemble_statement(as, &c);
+			break;
+		}
+		text = line_end + 1;
+	}
+}
+
+/* ========================================================================= */
+/* LINKING																	 */
+/* ========================================================================= */
+
+static
+size_t round_up(size_t n, size_t align)
+{
+	return (n + align - 1) / align * align;
+}
+
+// Lays the sections out in one mapping (text, then read-only data, then
+// data and bss, each starting on a new page), patches every rel32 and
+// makes the text executable and the read-only data read-only.
+static
+void link_image(Assembler *as, JitImage *image)
+{
+	for (int i = 0; i < as->fixup_count; i++) {
+		if (!table_get(&as->symbols, as->fixups[i].name))
+			fatal("Error: Undefined symbol '%s' (--run does not link other objects)", as->fixups[i].name);
+	}
+
+	size_t page = sysconf(_SC_PAGESIZE);
+	size_t offsets[SEC_COUNT];
+	offsets[SEC_TEXT] = 0;
+	offsets[SEC_RODATA] = round_up(as->sections[SEC_TEXT].len, page);
+	offsets[SEC_DATA] = round_up(offsets[SEC_RODATA] + as->sections[SEC_RODATA].len, page);
+	offsets[SEC_BSS] = round_up(offsets[SEC_DATA] + as->sections[SEC_DATA].len, 64);
+	size_t size = round_up(offsets[SEC_BSS] + as->bss_size, page);
+
+	char *base = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (base == MAP_FAILED)
+		fatal("Error: Out of memory");
+	for (int s = 0; s < SEC_BSS; s++)
+		memcpy(base + offsets[s], as->sections[s].data, as->sections[s].len);
+
+	for (int i = 0; i < as->fixup_count; i++) {
+		const Fixup *f = &as->fixups[i];
+		const JitSymbol *sym = table_get(&as->symbols, f->name);
+		long target = (long)(base + offsets[sym->section] + sym->offset) + f->addend;
+		long from = (long)(base + offsets[f->section] + f->end);
+		int32_t rel = (int32_t)(target - from);
+		if (rel != target - from) {
+			munmap(base, size);
+			fatal("Error: --run could not reach '%s' with a 32-bit offset", f->name);
+		}
+		memcpy(base + offsets[f->section] + f->at, &rel, sizeof(rel));
+	}
+
+	if (mprotect(base, offsets[SEC_RODATA], PROT_READ | PROT_EXEC) != 0 ||
+		mprotect(base + offsets[SEC_RODATA], offsets[SEC_DATA] - offsets[SEC_RODATA], PROT_READ) != 0) {
+		munmap(base, size);
+		fatal("Error: --run could not make its code executable: %s", strerror(errno));
+	}
+
+	const JitSymbol *enter = table_get(&as->symbols, intern_cstr("heliumc.run"));
+	image->base = base;
+	image->size = size;
+	image->enter = (long (*)(long *))(base + offsets[enter->section] + enter->offset);
+}
+
+/* ========================================================================= */
+/* RUNNING																	 */
+/* ========================================================================= */
+
+// Entered from C with the program's stack in rdi, laid out the way the
+// kernel leaves it for _start. Saves the registers C expects to survive a
+// call (generated code uses rbx freely), calls main(argc, argv) on the new
+// stack and returns what main returned.
+static const char run_stub[] =
+	"section .text\n"
+	"heliumc.run:\n"
+	"  push rbx\n"
+	"  push rbp\n"
+	"  push r12\n"
+	"  push r13\n"
+	"  push r14\n"
+	"  push r15\n"
+	"  mov [rel heliumc.saved_rsp], rsp\n"
+	"  mov rsp, rdi\n"
+	"  mov rdi, [rsp]\n"
+	"  lea rsi, [rsp + 8]\n"
+	"  call main\n"
+	"  push rax\n"
+	"  call heliumc.exit_hook\n"
+	"  pop rax\n"
+	"  mov rsp, [rel heliumc.saved_rsp]\n"
+	"  pop r15\n"
+	"  pop r14\n"
+	"  pop r13\n"
+	"  pop r12\n"
+	"  pop rbp\n"
+	"  pop rbx\n"
+	"  ret\n"
+	"section .bss\n"
+	"  alignb 8\n"
+	"heliumc.saved_rsp:\n"
+	"  resb 8\n";
+
+// The same size as the usual main thread stack limit
+#define RUN_STACK_SIZE (8 * 1024 * 1024)
+
+// Compiles 'input_filename' and assembles it into 'image' for jit_run().
+// Returns 0 on success, or -1 with the diagnostic in helium_error().
+int helium_jit(HeliumCompiler *compiler, const char *input_filename, JitImage *image)
+{
+	Emitter text;
+	emit_init_memory(&text);
+	if (helium_compile(compiler, input_filename, &text) != 0) {
+		emit_close(&text);
+		return -1;
+	}
+
+	// The assembler's own state is on the heap so that it is still
+	// reliable after an error unwinds here
+	Assembler *as = calloc(1, sizeof(Assembler));
+	if (!as) {
+		emit_close(&text);
+		fprintf(stderr, "Error: Out of memory\n");
+		exit(1);
+	}
+	for (int s = 0; s < SEC_BSS; s++)
+		emit_init_memory(&as->sections[s]);
+
+	HeliumCompiler *saved_compiler = hc;
+	jmp_buf *saved_jump = error_jump;
+	jmp_buf here;
+	hc = compiler;
+	error_jump = &here;
+
+	int status = 0;
+	if (setjmp(here) == 0) {
+		assemble(as, text.data, text.len);
+		if (!table_get(&as->symbols, compiler->name_main))
+			fatal("Error: --run needs a 'main' function");
+		assemble(as, run_stub, sizeof(run_stub) - 1);
+
+		// What _start would call after main, if anything. The symbol
+		// table rather than flush_at_exit says, as a cached unit skips
+		// the analysis that sets it.
+		const char *exit_hook = table_get(&as->symbols, compiler->name_flush_all) ?
+			"section .text\nheliumc.exit_hook:\n  jmp " EXIT_HOOK "\n" :
+			"section .text\nheliumc.exit_hook:\n  ret\n";
+		assemble(as, exit_hook, strlen(exit_hook));
+		link_image(as, image);
+	} else {
+		status = -1;
+	}
+	hc = saved_compiler;
+	error_jump = saved_jump;
+
+	for (int s = 0; s < SEC_BSS; s++)
+		emit_close(&as->sections[s]);
+	free(as->fixups);
+	table_free(&as->symbols);
+	free(as);
+	emit_close(&text);
+	return status;
+}
+
+// Runs main(argc, argv) from 'image' on a fresh stack and returns its exit
+// status. A program that calls exit() ends heliumc with that status instead.
+int jit_run(const JitImage *image, int argc, char **argv)
+{
+	size_t page = sysconf(_SC_PAGESIZE);
+	char *stack = mmap(NULL, RUN_STACK_SIZE, PROT_READ | PROT_WRITE,
+					   MAP_PRIVATE | MAP_ANONYMOUS | MAP_STACK | MAP_NORESERVE, -1, 0);
+	if (stack == MAP_FAILED) {
+		fprintf(stderr, "Error: Out of memory\n");
+		return 1;
+	}
+	// Running off the end faults instead of writing over something else
+	mprotect(stack, page, PROT_NONE);
+
+	// argc, argv[], NULL, envp[], NULL and an empty auxiliary vector
+	int envc = 0;
+	while (environ[envc])
+		envc++;
+	size_t words = 1 + argc + 1 + envc + 1 + 2;
+	long *top = (long *)(((unsigned long)(stack + RUN_STACK_SIZE) - words * sizeof(long)) & ~15UL);
+	long *w = top;
+	*w++ = argc;
+	for (int i = 0; i < argc; i++)
+		*w++ = (long)argv[i];
+	*w++ = 0;
+	for (int i = 0; i < envc; i++)
+		*w++ = (long)environ[i];
+	*w++ = 0;
+	*w++ = 0;
+	*w++ = 0;
+
+	long status = image->enter(top);
+	munmap(stack, RUN_STACK_SIZE);
+	return (int)(status & 255);
+}
+
+void jit_free(JitImage *image)
+{
+	if (image->base)
+		munmap(image->base, image->size);
+	image->base = NULL;
+}
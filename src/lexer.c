@@ -4,41 +4,86 @@
 /* MACROS																	 */
 /* ========================================================================= */
 
-typedef struct {
-	char name[64];
-	Token value;	// We store the token it represents
-} Macro;
-Macro macros[100];
-int macro_count = 0;
+// hc->macro_table maps an interned name to the Token it stands for.
+// Tokens live in hc->ast_arena, so the table is all there is to release.
 
-static
+// A later #define of the same name replaces the earlier one
 void add_macro(const char *name, Token value)
 {
-	strcpy(macros[macro_count].name, name);
-	macros[macro_count].value = value;
-	macro_count++;
+	Token *slot = arena_alloc(&hc->ast_arena, sizeof(Token), _Alignof(Token));
+	*slot = value;
+	table_put(&hc->macro_table, name, slot);
 }
 
 static
 Token *get_macro(const char *name)
 {
-	for (int i = 0; i < macro_count; i++) {
-		if (strcmp(macros[i].name, name) == 0)
-			return &macros[i].value;
-	}
-	return NULL;
+	return table_get(&hc->macro_table, name);
 }
 
-void free_macros(void)
+/* ========================================================================= */
+/* KEYWORDS																	 */
+/* ========================================================================= */
+
+// Perfect hash over the keyword set: every keyword lands in its own slot,
+// so recognising one costs a hash and a single memcmp.
+// When adding a keyword, pick a slot layout where keyword_hash() stays
+// collision-free (the constants were found by brute-force search and leave
+// room for 'global', 'break' and 'continue').
+typedef struct {
+	const char *name;
+	TokenType type;
+} Keyword;
+
+#define KEYWORD_SLOTS 64
+
+static const Keyword keywords[KEYWORD_SLOTS] = {
+	[ 0] = {"fn",      TOKEN_FN},
+	[ 1] = {"else",    TOKEN_ELSE},
+	[ 2] = {"syscall", TOKEN_SYSCALL},
+	[ 3] = {"extern",  TOKEN_EXTERN},
+	[ 7] = {"char",    TOKEN_CHAR_TYPE},
+	[ 8] = {"i32",     TOKEN_SIZED_TYPE},
+	[14] = {"i64",     TOKEN_SIZED_TYPE},
+	[15] = {"in",      TOKEN_IN},
+	[18] = {"u64",     TOKEN_SIZED_TYPE},
+	[20] = {"u32",     TOKEN_SIZED_TYPE},
+	[21] = {"static",  TOKEN_STATIC},
+	[26] = {"return",  TOKEN_RETURN},
+	[27] = {"ptr",     TOKEN_PTR_TYPE},
+	[28] = {"const",   TOKEN_CONST},
+	[30] = {"int",     TOKEN_INT_TYPE},
+	[32] = {"u16",     TOKEN_SIZED_TYPE},
+	[39] = {"u8",      TOKEN_SIZED_TYPE},
+	[42] = {"while",   TOKEN_WHILE},
+	[45] = {"struct",  TOKEN_STRUCT},
+	[47] = {"for",     TOKEN_FOR},
+	[51] = {"sizeof",  TOKEN_SIZEOF},
+	[56] = {"asm",     TOKEN_ASM},
+	[59] = {"i8",      TOKEN_SIZED_TYPE},
+	[60] = {"i16",     TOKEN_SIZED_TYPE},
+	[63] = {"if",      TOKEN_IF},
+};
+
+static
+unsigned int keyword_hash(const char *s, int len)
 {
-	for (int i = 0; i < macro_count; i++) {
-		// Check if the token inside the macro has an allocated name
-		if (macros[i].value.name && (
-			macros[i].value.type == TOKEN_IDENTIFIER ||
-			macros[i].value.type == TOKEN_STRING)) {
-			free(macros[i].value.name);
-		}
-	}
+	return ((unsigned char)s[0] ^ ((unsigned char)s[len - 1] * 8) ^
+			((unsigned char)s[1] * 6) ^ len) & (KEYWORD_SLOTS - 1);
+}
+
+// Token type for the identifier s[0..len), TOKEN_IDENTIFIER if it isn't a keyword
+static
+TokenType lookup_keyword(const char *s, int len)
+{
+	// Keywords are 2 to 7 characters long
+	if (len < 2 || len > 7)
+		return TOKEN_IDENTIFIER;
+
+	const Keyword *kw = &keywords[keyword_hash(s, len)];
+	if (kw->name && strncmp(kw->name, s, len) == 0 && kw->name[len] == '\0')
+		return kw->type;
+	return TOKEN_IDENTIFIER;
 }
 
 /* ========================================================================= */
@@ -48,26 +93,26 @@ void free_macros(void)
 Token get_next_token(void)
 {
 	// Skip Whitespace and count lines
-	while (source_code[src_pos] != '\0' && isspace(source_code[src_pos])) {
-		if (source_code[src_pos] == '\n') {
-			current_line++;
-			current_col = 1;
+	while (hc->source_code[hc->src_pos] != '\0' && isspace(hc->source_code[hc->src_pos])) {
+		if (hc->source_code[hc->src_pos] == '\n') {
+			hc->current_line++;
+			hc->current_col = 1;
 		} else {
-			current_col++;
+			hc->current_col++;
 		}
-		src_pos++;
+		hc->src_pos++;
 	}
 
 	// Capture the start location of this token
-	int start_line = current_line;
-	int start_col = current_col;
-	int start_offset = src_pos;
+	int start_line = hc->current_line;
+	int start_col = hc->current_col;
+	int start_offset = hc->src_pos;
 
-	if (source_code[src_pos] == '\0') {
-		return (Token){"EOF", TOKEN_EOF, 0, start_line, start_col, start_offset};
+	if (hc->source_code[hc->src_pos] == '\0') {
+		return (Token){"EOF", 0, TOKEN_EOF, start_line, start_col, start_offset};
 	}
 
-	char current = source_code[src_pos];
+	char current = hc->source_code[hc->src_pos];
 
 	// Handle Identifiers/Keywords (Allow _ at start)
 	if (isalpha(current) || current == '_') {
@@ -77,31 +122,17 @@ Token get_next_token(void)
 		t.column = start_col;
 		t.offset = start_offset;
 
-		char buffer[256];
-		int i = 0;
 		// Allow alphanumeric OR underscore in the body
-		while (isalnum(source_code[src_pos]) || source_code[src_pos] == '_') {
-			buffer[i++] = source_code[src_pos++];
-			current_col++; 
+		while (isalnum(hc->source_code[hc->src_pos]) || hc->source_code[hc->src_pos] == '_') {
+			hc->src_pos++;
+			hc->current_col++;
 		}
-		buffer[i] = '\0';
-
-		t.name = strdup(buffer);
-
-		if (strcmp(t.name, "fn")            == 0) t.type = TOKEN_FN;
-		else if (strcmp(t.name, "int")      == 0) t.type = TOKEN_INT_TYPE;
-		else if (strcmp(t.name, "ptr")      == 0) t.type = TOKEN_PTR_TYPE;
-		else if (strcmp(t.name, "char")     == 0) t.type = TOKEN_CHAR_TYPE;
-		else if (strcmp(t.name, "struct")   == 0) t.type = TOKEN_STRUCT;
-		else if (strcmp(t.name, "return")   == 0) t.type = TOKEN_RETURN;
-		else if (strcmp(t.name, "if")       == 0) t.type = TOKEN_IF;
-		else if (strcmp(t.name, "else")     == 0) t.type = TOKEN_ELSE;
-		else if (strcmp(t.name, "while")    == 0) t.type = TOKEN_WHILE;
-		else if (strcmp(t.name, "for")      == 0) t.type = TOKEN_FOR;
-		else if (strcmp(t.name, "in")       == 0) t.type = TOKEN_IN;
-		else if (strcmp(t.name, "syscall")  == 0) t.type = TOKEN_SYSCALL;
-		else if (strcmp(t.name, "sizeof")   == 0) t.type = TOKEN_SIZEOF;
-		else t.type = TOKEN_IDENTIFIER;
+		int len = hc->src_pos - start_offset;
+
+		t.name = intern(&hc->source_code[start_offset], len);
+		t.type = lookup_keyword(&hc->source_code[start_offset], len);
+		if (hc->pch_names)
+			table_put(hc->pch_names, t.name, (void *)t.name);
 
 		// CHECK MACROS
 		const Token *macro = get_macro(t.name);
@@ -113,209 +144,252 @@ Token get_next_token(void)
 			subst.column = start_col;
 			subst.offset = start_offset;
 
-			if (subst.type == TOKEN_IDENTIFIER || subst.type == TOKEN_STRING) {
-				subst.name = strdup(subst.name);
-			}
-
-			free(t.name);
-
 			return subst;
 		}
 
 		return t;
 	}
 
-	// Handle Integers
+	// Handle Integers (decimal or 0x hex, up to 64 bits)
 	if (isdigit(current)) {
 		Token t;
 		t.type = TOKEN_INT;
 		t.name = NULL;
 		t.line = start_line;
 		t.column = start_col;
-		t.value = 0;
 		t.offset = start_offset;
-		while (isdigit(source_code[src_pos])) {
-			t.value = t.value * 10 + (source_code[src_pos++] - '0');
-			current_col++;
+
+		// Accumulate unsigned so 0xFFFFFFFFFFFFFFFF wraps to -1 instead of overflowing
+		unsigned long value = 0;
+		if (current == '0' && (hc->source_code[hc->src_pos+1] == 'x' || hc->source_code[hc->src_pos+1] == 'X')) {
+			hc->src_pos += 2; hc->current_col += 2;
+			if (!isxdigit(hc->source_code[hc->src_pos]))
+				error_at(t, "Expected hex digits after '0x'");
+			while (isxdigit(hc->source_code[hc->src_pos])) {
+				char c = tolower(hc->source_code[hc->src_pos++]);
+				value = value * 16 + (isdigit(c) ? c - '0' : c - 'a' + 10);
+				hc->current_col++;
+			}
+		} else {
+			while (isdigit(hc->source_code[hc->src_pos])) {
+				value = value * 10 + (hc->source_code[hc->src_pos++] - '0');
+				hc->current_col++;
+			}
 		}
+		t.value = (long)value;
 		return t;
 	}
 
 	// Handle Symbols
-	// We increment src_pos and current_col for single chars
+	// We increment hc->src_pos and hc->current_col for single chars
 	// For multi-chars (e.g., // or ++), we handle inside.
 
 	switch (current) {
 		// Single char tokens
-		case '(': src_pos++; current_col++; return (Token){"(", TOKEN_LPAREN, 0, start_line, start_col, start_offset};
-		case ')': src_pos++; current_col++; return (Token){")", TOKEN_RPAREN, 0, start_line, start_col, start_offset};
-		case '{': src_pos++; current_col++; return (Token){"{", TOKEN_LBRACE, 0, start_line, start_col, start_offset};
-		case '}': src_pos++; current_col++; return (Token){"}", TOKEN_RBRACE, 0, start_line, start_col, start_offset};
-		case '[': src_pos++; current_col++; return (Token){"[", TOKEN_LBRACKET, 0, start_line, start_col, start_offset};
-		case ']': src_pos++; current_col++; return (Token){"]", TOKEN_RBRACKET, 0, start_line, start_col, start_offset};
-		case ',': src_pos++; current_col++; return (Token){",", TOKEN_COMMA, 0, start_line, start_col, start_offset};
-		case ';': src_pos++; current_col++; return (Token){";", TOKEN_SEMI, 0, start_line, start_col, start_offset};
-		case ':': src_pos++; current_col++; return (Token){":", TOKEN_COLON, 0, start_line, start_col, start_offset};
+		case '(': hc->src_pos++; hc->current_col++; return (Token){"(", 0, TOKEN_LPAREN, start_line, start_col, start_offset};
+		case ')': hc->src_pos++; hc->current_col++; return (Token){")", 0, TOKEN_RPAREN, start_line, start_col, start_offset};
+		case '{': hc->src_pos++; hc->current_col++; return (Token){"{", 0, TOKEN_LBRACE, start_line, start_col, start_offset};
+		case '}': hc->src_pos++; hc->current_col++; return (Token){"}", 0, TOKEN_RBRACE, start_line, start_col, start_offset};
+		case '[': hc->src_pos++; hc->current_col++; return (Token){"[", 0, TOKEN_LBRACKET, start_line, start_col, start_offset};
+		case ']': hc->src_pos++; hc->current_col++; return (Token){"]", 0, TOKEN_RBRACKET, start_line, start_col, start_offset};
+		case ',': hc->src_pos++; hc->current_col++; return (Token){",", 0, TOKEN_COMMA, start_line, start_col, start_offset};
+		case ';': hc->src_pos++; hc->current_col++; return (Token){";", 0, TOKEN_SEMI, start_line, start_col, start_offset};
+		case ':': hc->src_pos++; hc->current_col++; return (Token){":", 0, TOKEN_COLON, start_line, start_col, start_offset};
 		case '.':
-			src_pos++; current_col++;
-			if (source_code[src_pos] == '.') {
-				src_pos++; current_col++;
-				return (Token){"..", TOKEN_DOTDOT, 0, start_line, start_col, start_offset};
+			hc->src_pos++; hc->current_col++;
+			if (hc->source_code[hc->src_pos] == '.') {
+				hc->src_pos++; hc->current_col++;
+				return (Token){"..", 0, TOKEN_DOTDOT, start_line, start_col, start_offset};
 			}
-			return (Token){".", TOKEN_PERIOD, 0, start_line, start_col, start_offset};
-		case '*': src_pos++; current_col++; return (Token){"*", TOKEN_STAR, 0, start_line, start_col, start_offset};
+			return (Token){".", 0, TOKEN_PERIOD, start_line, start_col, start_offset};
+		case '*': hc->src_pos++; hc->current_col++; return (Token){"*", 0, TOKEN_STAR, start_line, start_col, start_offset};
+		case '%': hc->src_pos++; hc->current_col++; return (Token){"%", 0, TOKEN_PERCENT, start_line, start_col, start_offset};
 		case '|':
-			src_pos++; current_col++;
-			if (source_code[src_pos] == '|') {
-				src_pos++; current_col++;
-				return (Token){"||", TOKEN_OR, 0, start_line, start_col, start_offset};
+			hc->src_pos++; hc->current_col++;
+			if (hc->source_code[hc->src_pos] == '|') {
+				hc->src_pos++; hc->current_col++;
+				return (Token){"||", 0, TOKEN_OR, start_line, start_col, start_offset};
 			}
-			return (Token){"|", TOKEN_PIPE, 0, start_line, start_col, start_offset};
+			return (Token){"|", 0, TOKEN_PIPE, start_line, start_col, start_offset};
 		case '&':
-			src_pos++; current_col++;
-			if (source_code[src_pos] == '&') {
-				src_pos++; current_col++;
-				return (Token){"&&", TOKEN_AND, 0, start_line, start_col, start_offset};
+			hc->src_pos++; hc->current_col++;
+			if (hc->source_code[hc->src_pos] == '&') {
+				hc->src_pos++; hc->current_col++;
+				return (Token){"&&", 0, TOKEN_AND, start_line, start_col, start_offset};
 			}
-			return (Token){"&", TOKEN_AMP, 0, start_line, start_col, start_offset};
+			return (Token){"&", 0, TOKEN_AMP, start_line, start_col, start_offset};
 		// Division or Comment
 		case '/': 
-			if (source_code[src_pos + 1] == '/') {
+			if (hc->source_code[hc->src_pos + 1] == '/') {
 				// Comment: Skip until newline
 				// Note: We don't change line number here; the next loop of get_next_token will handle the \n
-				while (source_code[src_pos] != '\0' && source_code[src_pos] != '\n') {
-					src_pos++;
+				while (hc->source_code[hc->src_pos] != '\0' && hc->source_code[hc->src_pos] != '\n') {
+					hc->src_pos++;
 					// Col updates aren't strictly necessary inside comments, but good practice
-					current_col++; 
+					hc->current_col++; 
 				}
 				return get_next_token();    // Recursion to find real token
 			}
-			src_pos++; current_col++; 
-			return (Token){"/", TOKEN_SLASH, 0, start_line, start_col, start_offset};
+			hc->src_pos++; hc->current_col++; 
+			return (Token){"/", 0, TOKEN_SLASH, start_line, start_col, start_offset};
 		case '-': 
-			if (source_code[src_pos+1] == '>') {
-				src_pos+=2; current_col+=2; 
-				return (Token){"->", TOKEN_ARROW, 0, start_line, start_col, start_offset};
+			if (hc->source_code[hc->src_pos+1] == '>') {
+				hc->src_pos+=2; hc->current_col+=2; 
+				return (Token){"->", 0, TOKEN_ARROW, start_line, start_col, start_offset};
 			}
-			src_pos++; current_col++; 
-			return (Token){"-", TOKEN_MINUS, 0, start_line, start_col, start_offset};
+			hc->src_pos++; hc->current_col++; 
+			return (Token){"-", 0, TOKEN_MINUS, start_line, start_col, start_offset};
 		case '+': 
-			if (source_code[src_pos+1] == '+') {
-				src_pos+=2; current_col+=2; 
-				return (Token){"++", TOKEN_INC, 0, start_line, start_col, start_offset};
+			if (hc->source_code[hc->src_pos+1] == '+') {
+				hc->src_pos+=2; hc->current_col+=2; 
+				return (Token){"++", 0, TOKEN_INC, start_line, start_col, start_offset};
 			}
-			src_pos++; current_col++;
-			return (Token){"+", TOKEN_PLUS, 0, start_line, start_col, start_offset};
+			hc->src_pos++; hc->current_col++;
+			return (Token){"+", 0, TOKEN_PLUS, start_line, start_col, start_offset};
 
 		case '=':
-			if (source_code[src_pos+1] == '=') {
-				src_pos+=2; current_col+=2; 
-				return (Token){"==", TOKEN_EQ, 0, start_line, start_col, start_offset};
+			if (hc->source_code[hc->src_pos+1] == '=') {
+				hc->src_pos+=2; hc->current_col+=2; 
+				return (Token){"==", 0, TOKEN_EQ, start_line, start_col, start_offset};
 			}
-			src_pos++; current_col++;
-			return (Token){"=", TOKEN_ASSIGN, 0, start_line, start_col, start_offset};
+			hc->src_pos++; hc->current_col++;
+			return (Token){"=", 0, TOKEN_ASSIGN, start_line, start_col, start_offset};
 
 		case '!':
-			if (source_code[src_pos+1] == '=') {
-				src_pos+=2; current_col+=2; 
-				return (Token){"!=", TOKEN_NEQ, 0, start_line, start_col, start_offset};
+			if (hc->source_code[hc->src_pos+1] == '=') {
+				hc->src_pos+=2; hc->current_col+=2; 
+				return (Token){"!=", 0, TOKEN_NEQ, start_line, start_col, start_offset};
 			}
 			error_at((Token){"", 0, 0, start_line, start_col, start_offset}, "Expected '!='");
-			exit(1);
-		case '<': src_pos++; current_col++; return (Token){"<", TOKEN_LT, 0, start_line, start_col, start_offset};
-		case '>': src_pos++; current_col++; return (Token){">", TOKEN_GT, 0, start_line, start_col, start_offset};
+		case '<':
+			if (hc->source_code[hc->src_pos+1] == '<') {
+				hc->src_pos+=2; hc->current_col+=2;
+				return (Token){"<<", 0, TOKEN_SHL, start_line, start_col, start_offset};
+			}
+			hc->src_pos++; hc->current_col++;
+			return (Token){"<", 0, TOKEN_LT, start_line, start_col, start_offset};
+		case '>':
+			if (hc->source_code[hc->src_pos+1] == '>') {
+				hc->src_pos+=2; hc->current_col+=2;
+				return (Token){">>", 0, TOKEN_SHR, start_line, start_col, start_offset};
+			}
+			hc->src_pos++; hc->current_col++;
+			return (Token){">", 0, TOKEN_GT, start_line, start_col, start_offset};
 		case '"': {
 			Token t;
 			t.type = TOKEN_STRING;
+			t.value = 0;
 			t.line = start_line;
 			t.column = start_col;
+			t.offset = start_offset;
 
-			char buffer[1024];
-			int i = 0;
+			hc->src_pos++; hc->current_col++;   // Skip opening "
+			int content_start = hc->src_pos;
 
-			src_pos++; current_col++;   // Skip opening "
-			while (source_code[src_pos] != '"' && source_code[src_pos] != '\0') {
-				if (source_code[src_pos] == '\\' && source_code[src_pos+1] == 'n') {
-					buffer[i++] = '\\'; buffer[i++] = 'n';
-					src_pos += 2; current_col += 2;
+			// Escapes are kept verbatim; NASM's backtick strings decode them
+			while (hc->source_code[hc->src_pos] != '"' && hc->source_code[hc->src_pos] != '\0') {
+				if (hc->source_code[hc->src_pos] == '\\' && hc->source_code[hc->src_pos+1] == 'n') {
+					hc->src_pos += 2; hc->current_col += 2;
 				} else {
-					buffer[i++] = source_code[src_pos++];
-					current_col++;
+					hc->src_pos++;
+					hc->current_col++;
 				}
 			}
-			buffer[i] = '\0';
 
-			t.name = strdup(buffer);
+			t.name = intern(&hc->source_code[content_start], hc->src_pos - content_start);
 
-			if (source_code[src_pos] == '"') {
-				src_pos++; current_col++;   // Skip closing "
+			if (hc->source_code[hc->src_pos] == '"') {
+				hc->src_pos++; hc->current_col++;   // Skip closing "
 			}
 			return t;
 		}
 		case '#': {
-			src_pos++; // Skip '#'
+			hc->src_pos++; // Skip '#'
 			
 			// Skip whitespace
-			while (source_code[src_pos] != '\0' && isspace(source_code[src_pos]) && source_code[src_pos] != '\n') {
-				 src_pos++;
+			while (hc->source_code[hc->src_pos] != '\0' && isspace(hc->source_code[hc->src_pos]) && hc->source_code[hc->src_pos] != '\n') {
+				 hc->src_pos++;
 			}
 
 			// #file "name" line
-			if (strncmp(&source_code[src_pos], "file", 4) == 0) {
-				src_pos += 4;	// Skip "file"
+			if (strncmp(&hc->source_code[hc->src_pos], "file", 4) == 0) {
+				hc->src_pos += 4;	// Skip "file"
 				
 				// Parse Filename
-				while (source_code[src_pos] != '"' && source_code[src_pos] != '\n') src_pos++;
-				if (source_code[src_pos] == '"') {
-					src_pos++;	// Skip opening "
+				while (hc->source_code[hc->src_pos] != '"' && hc->source_code[hc->src_pos] != '\n') hc->src_pos++;
+				if (hc->source_code[hc->src_pos] == '"') {
+					hc->src_pos++;	// Skip opening "
 					
-					char new_name[256];
-					int i = 0;
-					while (source_code[src_pos] != '"' && i < 255) {
-						new_name[i++] = source_code[src_pos++];
+					int name_start = hc->src_pos;
+					while (hc->source_code[hc->src_pos] != '"' && hc->source_code[hc->src_pos] != '\n' && hc->source_code[hc->src_pos] != '\0') {
+						hc->src_pos++;
 					}
-					new_name[i] = '\0';
-					src_pos++;	// Skip closing "
 
-					if (filename_allocated) free(current_filename);
-					
 					// Update Global State
-					// (Note: In a real compiler we'd manage memory better, but strdup is fine for V1)
-					current_filename = strdup(new_name);
-					filename_allocated = 1;
+					hc->current_filename = intern(&hc->source_code[name_start], hc->src_pos - name_start);
+					if (hc->source_code[hc->src_pos] == '"') hc->src_pos++;	// Skip closing "
 				}
 
 				// Parse Line Number
-				while (!isdigit(source_code[src_pos]) && source_code[src_pos] != '\n') src_pos++;
-				if (isdigit(source_code[src_pos])) {
+				while (!isdigit(hc->source_code[hc->src_pos]) && hc->source_code[hc->src_pos] != '\n') hc->src_pos++;
+				if (isdigit(hc->source_code[hc->src_pos])) {
 					int num = 0;
-					while (isdigit(source_code[src_pos])) {
-						num = num * 10 + (source_code[src_pos++] - '0');
+					while (isdigit(hc->source_code[hc->src_pos])) {
+						num = num * 10 + (hc->source_code[hc->src_pos++] - '0');
 					}
 					// Update Global State
 					// Subtract 1 because the very next newline will increment it to the correct number
-					current_line = num - 1; 
+					hc->current_line = num - 1; 
 				}
 				
 				// Skip the rest of the line
-				while (source_code[src_pos] != '\n' && source_code[src_pos] != '\0') src_pos++;
+				while (hc->source_code[hc->src_pos] != '\n' && hc->source_code[hc->src_pos] != '\0') hc->src_pos++;
 				
 				return get_next_token(); // Recurse to get the next real token
 			}
 
+			// #pch length "path"
+			// The next 'length' bytes are an include that has a precompiled
+			// header. The marker line is consumed; lex_more() decides whether
+			// to load the header or lex the text that follows.
+			if (strncmp(&hc->source_code[hc->src_pos], "pch ", 4) == 0) {
+				hc->src_pos += 4;	// Skip "pch "
+
+				long length = 0;
+				while (isdigit(hc->source_code[hc->src_pos]))
+					length = length * 10 + (hc->source_code[hc->src_pos++] - '0');
+
+				const char *path = NULL;
+				while (hc->source_code[hc->src_pos] != '"' && hc->source_code[hc->src_pos] != '\n' && hc->source_code[hc->src_pos] != '\0') hc->src_pos++;
+				if (hc->source_code[hc->src_pos] == '"') {
+					int name_start = ++hc->src_pos;
+					while (hc->source_code[hc->src_pos] != '"' && hc->source_code[hc->src_pos] != '\n' && hc->source_code[hc->src_pos] != '\0') {
+						hc->src_pos++;
+					}
+					path = intern(&hc->source_code[name_start], hc->src_pos - name_start);
+				}
+
+				// Skip the rest of the line, newline included
+				while (hc->source_code[hc->src_pos] != '\n' && hc->source_code[hc->src_pos] != '\0') hc->src_pos++;
+				if (hc->source_code[hc->src_pos] == '\n') hc->src_pos++;
+
+				if (!path)
+					return get_next_token();
+				return (Token){path, length, TOKEN_PCH, start_line, start_col, start_offset};
+			}
+
 			// CHECK 2: #define ... (Existing logic)
-			if (strncmp(&source_code[src_pos], "define", 6) == 0) {
-				 src_pos += 6;
+			if (strncmp(&hc->source_code[hc->src_pos], "define", 6) == 0) {
+				 hc->src_pos += 6;
 				 
 				 // Get Macro Name
-				 while (source_code[src_pos] != '\0' && isspace(source_code[src_pos])) src_pos++;
+				 while (hc->source_code[hc->src_pos] != '\0' && isspace(hc->source_code[hc->src_pos])) hc->src_pos++;
 				 
-				 char name[64];
-				 int i = 0;
-				 while (isalnum(source_code[src_pos]) || source_code[src_pos] == '_') {
-					 name[i++] = source_code[src_pos++];
+				 int name_start = hc->src_pos;
+				 while (isalnum(hc->source_code[hc->src_pos]) || hc->source_code[hc->src_pos] == '_') {
+					 hc->src_pos++;
 				 }
-				 name[i] = '\0';
+				 const char *name = intern(&hc->source_code[name_start], hc->src_pos - name_start);
 				 
 				 Token value = get_next_token();
 				 
@@ -335,7 +409,7 @@ Token get_next_token(void)
 			}
 			
 			// Unknown directive? Ignore line
-			while (source_code[src_pos] != '\0' && source_code[src_pos] != '\n') src_pos++;
+			while (hc->source_code[hc->src_pos] != '\0' && hc->source_code[hc->src_pos] != '\n') hc->src_pos++;
 			return get_next_token();
 		}
 
@@ -345,17 +419,18 @@ Token get_next_token(void)
 			t.name = NULL;
 			t.line = start_line;
 			t.column = start_col;
+			t.offset = start_offset;
 
-			src_pos++; current_col++; // Skip opening '
+			hc->src_pos++; hc->current_col++; // Skip opening '
 
-			if (source_code[src_pos] == '\'') {
+			if (hc->source_code[hc->src_pos] == '\'') {
 				error_at(t, "Empty character literal");
 			}
 
 			// Handle Escape Sequences
-			if (source_code[src_pos] == '\\') {
-				src_pos++; current_col++;
-				char escape = source_code[src_pos];
+			if (hc->source_code[hc->src_pos] == '\\') {
+				hc->src_pos++; hc->current_col++;
+				char escape = hc->source_code[hc->src_pos];
 				if (escape == 'n') t.value = 10;       // \n
 				else if (escape == 't') t.value = 9;   // \t
 				else if (escape == '0') t.value = 0;   // \0
@@ -363,79 +438,130 @@ Token get_next_token(void)
 				else if (escape == '\'') t.value = 39; // \'
 				else error_at(t, "Unknown escape sequence");
 			} else {
-				t.value = (int)source_code[src_pos];
+				t.value = (int)hc->source_code[hc->src_pos];
 			}
-			src_pos++; current_col++;
+			hc->src_pos++; hc->current_col++;
 
-			if (source_code[src_pos] != '\'') {
+			if (hc->source_code[hc->src_pos] != '\'') {
 				error_at(t, "Expected closing '");
 			}
-			src_pos++; current_col++; // Skip closing '
+			hc->src_pos++; hc->current_col++; // Skip closing '
 
 			return t;
 		}
 
 		default: 
 			error_at((Token){"", 0, 0, start_line, start_col, start_offset}, "Unknown character");
-			exit(1);
 	}
 }
 
-void advance(void)
+/* ========================================================================= */
+/* TOKEN STREAM																 */
+/* ========================================================================= */
+
+// The lexer runs ahead of the parser, a batch of tokens at a time, into
+// hc->tokens. Each token is lexed exactly once: advance() is usually an
+// index increment, and peek_token() can look any distance ahead by lexing
+// further into the same buffer. Tokens the parser has moved past are
+// dropped, so the buffer stays small however long the file is.
+
+#define TOKEN_BATCH 256
+
+// Returns the index to store in the TOKEN_PCH token
+static
+int push_pch_load(ASTNode **items, int count)
 {
-	if (current_token.name)
-		if (current_token.type == TOKEN_IDENTIFIER ||
-			current_token.type == TOKEN_STRING ||
-			current_token.type == TOKEN_FN ||
-			current_token.type == TOKEN_INT_TYPE ||
-			current_token.type == TOKEN_PTR_TYPE ||
-			current_token.type == TOKEN_CHAR_TYPE ||
-			current_token.type == TOKEN_STRUCT ||
-			current_token.type == TOKEN_RETURN ||
-			current_token.type == TOKEN_IF ||
-			current_token.type == TOKEN_ELSE ||
-			current_token.type == TOKEN_WHILE ||
-			current_token.type == TOKEN_FOR ||
-			current_token.type == TOKEN_IN ||
-			current_token.type == TOKEN_SYSCALL ||
-			current_token.type == TOKEN_SIZEOF)
-			free(current_token.name);
-
-	current_token = get_next_token();
+	if (hc->pch_load_count == hc->pch_load_capacity) {
+		int capacity = hc->pch_load_capacity ? hc->pch_load_capacity * 2 : 4;
+		PchLoad *loads = realloc(hc->pch_loads, capacity * sizeof(PchLoad));
+		if (!loads)
+			fatal("Error: Out of memory");
+		hc->pch_loads = loads;
+		hc->pch_load_capacity = capacity;
+	}
+	hc->pch_loads[hc->pch_load_count] = (PchLoad){items, count};
+	return hc->pch_load_count++;
 }
 
-Token peek_next_token(void)
+// Appends a batch of tokens to hc->tokens
+static
+void lex_more(void)
 {
-	int saved_pos = src_pos;
-	int saved_line = current_line;
-	int saved_col = current_col;
-	
-	Token next = get_next_token();
-	
-	// Restore state
-	src_pos = saved_pos;
-	current_line = saved_line;
-	current_col = saved_col;
-	
-	// Cleanup peeked token memory to prevent leaks
-	if (next.name && next.type != TOKEN_EOF) {
-		if (next.type == TOKEN_IDENTIFIER ||
-			next.type == TOKEN_STRING || 
-			next.type == TOKEN_FN ||
-			next.type == TOKEN_INT_TYPE || 
-			next.type == TOKEN_PTR_TYPE ||
-			next.type == TOKEN_CHAR_TYPE || 
-			next.type == TOKEN_STRUCT ||
-			next.type == TOKEN_RETURN || 
-			next.type == TOKEN_IF ||
-			next.type == TOKEN_ELSE || 
-			next.type == TOKEN_WHILE ||
-			next.type == TOKEN_SYSCALL || 
-			next.type == TOKEN_SIZEOF ||
-			next.type == TOKEN_FOR || 
-			next.type == TOKEN_IN) {
-			free(next.name);
+	// Drop what the parser has consumed (current_token is kept as a copy)
+	if (hc->token_next > 0) {
+		int keep = hc->token_count - hc->token_next;
+		memmove(hc->tokens, hc->tokens + hc->token_next, keep * sizeof(Token));
+		memmove(hc->token_files, hc->token_files + hc->token_next, keep * sizeof(char *));
+		hc->token_count = keep;
+		hc->token_next = 0;
+	}
+
+	// Only a long peek_token() leaves the buffer full of unconsumed tokens
+	if (hc->token_count + TOKEN_BATCH > hc->token_capacity) {
+		int capacity = hc->token_capacity ? hc->token_capacity * 2 : TOKEN_BATCH;
+		Token *tokens = realloc(hc->tokens, capacity * sizeof(Token));
+		if (tokens)
+			hc->tokens = tokens;
+		const char **files = realloc(hc->token_files, capacity * sizeof(char *));
+		if (files)
+			hc->token_files = files;
+		if (!tokens || !files)
+			fatal("Error: Out of memory");
+		hc->token_capacity = capacity;
+	}
+
+	int end = hc->token_count + TOKEN_BATCH;
+	while (hc->token_count < end) {
+		Token token = get_next_token();
+
+		// A fresh precompiled header is loaded as soon as it is reached,
+		// since its macros must exist before the tokens after it are lexed.
+		// Structs lexed earlier may not be parsed yet, so their names are
+		// kept for pch_load to check against.
+		if (token.type == TOKEN_PCH) {
+			ASTNode **items;
+			int count;
+			if (!hc->use_pch || !pch_load(token, &items, &count))
+				continue;	// Lex the header's text instead
+			token.value = push_pch_load(items, count);
 		}
+		if (hc->after_struct && token.type == TOKEN_IDENTIFIER)
+			table_put(&hc->lexed_structs, token.name, (void *)token.name);
+		hc->after_struct = token.type == TOKEN_STRUCT;
+
+		hc->tokens[hc->token_count] = token;
+		hc->token_files[hc->token_count++] = hc->current_filename;
+		if (token.type == TOKEN_EOF)
+			break;
 	}
-	return next;
+}
+
+void lex_begin(int use_pch)
+{
+	hc->use_pch = use_pch;
+	hc->after_struct = 0;
+	hc->token_count = 0;
+	hc->token_next = 0;
+}
+
+void advance(void)
+{
+	// Token names are interned, so there is nothing to free
+	if (hc->token_hash)
+		cache_key_add_token(hc->token_hash, &hc->current_token);
+	hc->report.tokens++;
+
+	// Past the end the lexer keeps returning TOKEN_EOF
+	if (hc->token_next == hc->token_count)
+		lex_more();
+	hc->current_filename = hc->token_files[hc->token_next];
+	hc->current_token = hc->tokens[hc->token_next++];
+}
+
+// The token 'distance' (1 or more) places after the current one
+Token peek_token(int distance)
+{
+	while (hc->token_next + distance > hc->token_count)
+		lex_more();
+	return hc->tokens[hc->token_next + distance - 1];
 }
@@ -1,17 +1,227 @@
 #include "helium.h"
 
+#include <fcntl.h>
+#include <unistd.h>
+
+/* ========================================================================= */
+/* OPTIONS																	 */
+/* ========================================================================= */
+
+typedef struct {
+	const char **include_paths;
+	int include_path_count;
+	int jobs;
+	int show_stats;
+	int emit_pch;
+	int module;
+	int time_report;	// 1 = table, 2 = JSON
+	int run;			// --run: arguments after the input go to the program
+	const char *cache_dir;
+} Options;
+
+static
+void add_option_path(Options *options, const char *dir)
+{
+	options->include_paths = realloc(options->include_paths,
+									 (options->include_path_count + 1) * sizeof(char *));
+	if (!options->include_paths) {
+		fprintf(stderr, "Error: Out of memory\n");
+		exit(1);
+	}
+	options->include_paths[options->include_path_count++] = dir;
+}
+
+/* ========================================================================= */
+/* COMPILE ONE FILE															 */
+/* ========================================================================= */
+
+// Serializes diagnostics from concurrent --batch compilations
+static pthread_mutex_t report_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// A compiler configured from the command line
+static
+HeliumCompiler *new_compiler(const Options *options, int jobs)
+{
+	HeliumCompiler *compiler = helium_new();
+	if (!compiler) {
+		fprintf(stderr, "Error: Out of memory\n");
+		return NULL;
+	}
+	for (int i = 0; i < options->include_path_count; i++)
+		helium_add_include_path(compiler, options->include_paths[i]);
+	compiler->jobs = jobs;
+	compiler->cache_dir = options->cache_dir;
+	compiler->module = options->module;
+	compiler->report.enabled = options->time_report != 0;
+	return compiler;
+}
+
+// --stats and --time-report output for one file
+static
+void print_reports(const HeliumCompiler *compiler, const char *input_filename,
+				   const Options *options, int status)
+{
+	if (options->show_stats) {
+		fprintf(stderr, "%s: preprocessor: %ld files opened, %ld bytes read, %ld repeat includes skipped, "
+				"%ld precompiled headers loaded\n",
+				input_filename, compiler->stats.files_opened, compiler->stats.bytes_read,
+				compiler->stats.includes_skipped, compiler->stats.headers_loaded);
+		if (options->cache_dir) {
+			const CacheStats *cache = &compiler->cache_stats;
+			fprintf(stderr, "%s: cache: %ld/%ld files hit, %ld/%ld functions hit\n", input_filename,
+					cache->unit_hits, cache->unit_hits + cache->unit_misses,
+					cache->function_hits, cache->function_hits + cache->function_misses);
+		}
+	}
+	if (options->time_report && status == 0)
+		helium_write_report(compiler, input_filename, stderr, options->time_report == 2);
+}
+
+// Returns 0 on success. On failure the output file is removed.
+static
+int compile_file(const char *input_filename, const char *output_filename,
+				 const Options *options, int jobs)
+{
+	HeliumCompiler *compiler = new_compiler(options, jobs);
+	if (!compiler)
+		return 1;
+
+	int out_fd = open(output_filename, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (out_fd < 0) {
+		fprintf(stderr, "Error: Could not open output file %s\n", output_filename);
+		helium_free(compiler);
+		return 1;
+	}
+	Emitter out;
+	emit_init_fd(&out, out_fd);
+
+	int status = options->emit_pch ? helium_compile_header(compiler, input_filename, &out)
+								   : helium_compile(compiler, input_filename, &out);
+	if (status != 0)
+		out.len = 0;	// Nothing more is written for a failed compile
+	int write_failed = emit_close(&out) != 0;
+	write_failed |= close(out_fd) != 0;
+
+	pthread_mutex_lock(&report_lock);
+	if (status != 0) {
+		fputs(helium_error(compiler), stderr);
+	} else if (write_failed) {
+		fprintf(stderr, "Error: Could not write output file %s\n", output_filename);
+	}
+	print_reports(compiler, input_filename, options, status);
+	pthread_mutex_unlock(&report_lock);
+
+	if (status != 0 || write_failed)
+		unlink(output_filename);
+
+	helium_free(compiler);
+	return status != 0 || write_failed;
+}
+
 /* ========================================================================= */
-/* DEFINE GLOBALS															 */
+/* RUN MODE																	 */
 /* ========================================================================= */
 
-Token current_token;
-char *source_code;
-char *current_filename = "unknown";
-char *current_func_name = "unknown";
-int src_pos = 0;
-int current_line = 1;
-int current_col = 1;
-int filename_allocated = 0;
+// --run compiles argv[0] into memory and runs it with argv as its
+// arguments (see jit.c). Returns the program's exit status.
+static
+int run_file(int argc, char **argv, const Options *options)
+{
+	HeliumCompiler *compiler = new_compiler(options, options->jobs);
+	if (!compiler)
+		return 1;
+
+	JitImage image;
+	int status = helium_jit(compiler, argv[0], &image);
+	if (status != 0)
+		fputs(helium_error(compiler), stderr);
+	print_reports(compiler, argv[0], options, status);
+	helium_free(compiler);
+	if (status != 0)
+		return 1;
+
+	int exit_status = jit_run(&image, argc, argv);
+	jit_free(&image);
+	return exit_status;
+}
+
+/* ========================================================================= */
+/* BATCH MODE																 */
+/* ========================================================================= */
+
+// --batch compiles every input in one process, a.he -> a.s (or a.he.pch
+// with --emit-pch), on a pool of threads. Each file gets its own
+// HeliumCompiler and a single codegen thread.
+
+typedef struct {
+	char **inputs;
+	int count;
+	int next;           // Next input to claim (atomic)
+	int failures;       // Atomic
+	const Options *options;
+} BatchJobs;
+
+static
+char *output_name(const char *input, int emit_pch)
+{
+	size_t len = strlen(input);
+	if (!emit_pch && len > 3 && strcmp(input + len - 3, ".he") == 0)
+		len -= 3;
+
+	char *output = malloc(len + 5);
+	if (!output) {
+		fprintf(stderr, "Error: Out of memory\n");
+		exit(1);
+	}
+	memcpy(output, input, len);
+	strcpy(output + len, emit_pch ? ".pch" : ".s");
+	return output;
+}
+
+static
+void *batch_worker(void *arg)
+{
+	BatchJobs *jobs = arg;
+
+	for (;;) {
+		int i = __atomic_fetch_add(&jobs->next, 1, __ATOMIC_RELAXED);
+		if (i >= jobs->count) break;
+
+		char *output = output_name(jobs->inputs[i], jobs->options->emit_pch);
+		if (compile_file(jobs->inputs[i], output, jobs->options, 1) != 0)
+			__atomic_fetch_add(&jobs->failures, 1, __ATOMIC_RELAXED);
+		free(output);
+	}
+	return NULL;
+}
+
+static
+int run_batch(char **inputs, int count, const Options *options)
+{
+	BatchJobs jobs = {inputs, count, 0, 0, options};
+
+	int thread_count = options->jobs < count ? options->jobs : count;
+	pthread_t *threads = malloc(thread_count * sizeof(pthread_t));
+	if (!threads) {
+		fprintf(stderr, "Error: Out of memory\n");
+		return 1;
+	}
+
+	// The calling thread always works too, so a failed create is harmless
+	int started = 0;
+	while (started < thread_count - 1 &&
+		   pthread_create(&threads[started], NULL, batch_worker, &jobs) == 0)
+		started++;
+	batch_worker(&jobs);
+
+	for (int t = 0; t < started; t++)
+		pthread_join(threads[t], NULL);
+	free(threads);
+
+	if (jobs.failures)
+		fprintf(stderr, "%d of %d files failed to compile\n", jobs.failures, count);
+	return jobs.failures != 0;
+}
 
 /* ========================================================================= */
 /* MAIN																		 */
@@ -21,14 +231,36 @@ int main(int argc, char **argv)
 {
 	if (argc < 2) {
 		printf("Usage: %s [options] <input_file>\n", argv[0]);
+		printf("       %s --batch [options] <input_file>...\n", argv[0]);
+		printf("       %s [options] --run <input_file> [args]...\n", argv[0]);
 		printf("Options:\n");
-		printf("  -o <file>  Specify output assembly file (default: out.s)\n");
-		printf("  -V         Print version and exit\n");
+		printf("  -o <file>          Specify output assembly file (default: out.s)\n");
+		printf("  -I <dir>           Add a directory to search for #include files\n");
+		printf("  -j <n>             Use n threads (default: one per CPU)\n");
+		printf("  -c                 Compile one module of a program; functions from\n");
+		printf("                     #included files are linked from their own objects\n");
+		printf("  --batch            Compile every input file, writing each x.he to x.s\n");
+		printf("  --cache-dir <dir>  Reuse assembly generated for identical input\n");
+		printf("  --emit-pch         Write a precompiled header (default: <input>.pch)\n");
+		printf("  --run              Compile into memory and run main with the remaining\n");
+		printf("                     arguments; no assembler or linker is used\n");
+		printf("  --stats            Print preprocessor and cache statistics to stderr\n");
+		printf("  --time-report      Print time and memory spent in each phase to stderr\n");
+		printf("  --time-report=json Same, as one JSON object per file\n");
+		printf("  -V                 Print version and exit\n");
 		return 1;
 	}
 
-	char *input_filename = NULL;
-	const char *output_filename = "out.s";	// Default output
+	char **inputs = malloc(argc * sizeof(char *));
+	int input_count = 0;
+	const char *output_filename = NULL;
+	int batch = 0;
+	Options options = {NULL, 0, default_jobs(), 0, 0, 0, 0, 0, NULL};
+
+	if (!inputs) {
+		fprintf(stderr, "Error: Out of memory\n");
+		return 1;
+	}
 
 	// Parse Arguments
 	for (int i = 1; i < argc; i++) {
@@ -40,148 +272,85 @@ int main(int argc, char **argv)
 				fprintf(stderr, "Error: -o requires a filename\n");
 				return 1;
 			}
+		} else if (strcmp(argv[i], "-I") == 0) {
+			if (i + 1 < argc) {
+				add_option_path(&options, argv[++i]);
+			} else {
+				fprintf(stderr, "Error: -I requires a directory\n");
+				return 1;
+			}
+		} else if (strncmp(argv[i], "-I", 2) == 0) {
+			add_option_path(&options, argv[i] + 2);
+		} else if (strcmp(argv[i], "-j") == 0) {
+			if (i + 1 < argc && atoi(argv[i + 1]) > 0) {
+				options.jobs = atoi(argv[++i]);
+			} else {
+				fprintf(stderr, "Error: -j requires a positive thread count\n");
+				return 1;
+			}
+		} else if (strcmp(argv[i], "-c") == 0) {
+			options.module = 1;
+		} else if (strcmp(argv[i], "--batch") == 0) {
+			batch = 1;
+		} else if (strcmp(argv[i], "--cache-dir") == 0) {
+			if (i + 1 < argc) {
+				options.cache_dir = argv[++i];
+			} else {
+				fprintf(stderr, "Error: --cache-dir requires a directory\n");
+				return 1;
+			}
+		} else if (strcmp(argv[i], "--run") == 0) {
+			// The input and everything after it belong to the program
+			options.run = i + 1;
+			break;
+		} else if (strcmp(argv[i], "--emit-pch") == 0) {
+			options.emit_pch = 1;
+		} else if (strcmp(argv[i], "--time-report") == 0) {
+			options.time_report = 1;
+		} else if (strcmp(argv[i], "--time-report=json") == 0) {
+			options.time_report = 2;
+		} else if (strcmp(argv[i], "--stats") == 0) {
+			options.show_stats = 1;
 		} else if (strcmp(argv[i], "-V") == 0 || strcmp(argv[i], "--version") == 0) {
 			fprintf(stdout, "%s v%s\n", NAME, VERSION);
 			return 0;
 		} else {
-			input_filename = argv[i];
-			current_filename = input_filename;
+			inputs[input_count++] = argv[i];
 		}
 	}
 
-	if (!input_filename) {
-		fprintf(stderr, "Error: No input file specified\n");
-		return 1;
-	}
-
-	// Read Input
-	source_code = preprocess_file(input_filename);
-
-	// Prime the lexer
-	advance(); 
-
-	// Generate Output
-	// Redirect stdout to the file so our existing printf statements work
-	const FILE *out_file = freopen(output_filename, "w", stdout);
-	if (!out_file) {
-		fprintf(stderr, "Error: Could not open output file %s\n", output_filename);
-		free(source_code);
-		return 1;
-	}
-
-	// Write the assembly header (required for linking)
-	printf("section .text\n");
-
-	// List to hold all functions
-	ASTNode *func_list_head = NULL;
-	ASTNode *func_list_tail = NULL;
-
-	// Keep parsing until end of file
-	while (current_token.type != TOKEN_EOF) {
-		if (current_token.type == TOKEN_FN) {
-			ASTNode* func = parse_function();
-			optimize_ast(func);
-			
-			// Initialize reachable flag
-			func->is_reachable = 0; 
-			
-			// Store in linked list instead of generating immediately
-			if (!func_list_head) {
-				func_list_head = func;
-				func_list_tail = func;
-			} else {
-				func_list_tail->next = func;
-				func_list_tail = func;
-			}
-			
-		} else if (current_token.type == TOKEN_STRUCT) {
-			parse_struct_definition();
+	int status;
+	if (options.run) {
+		if (options.run == argc) {
+			fprintf(stderr, "Error: --run requires an input file\n");
+			status = 1;
+		} else if (input_count || output_filename || batch || options.emit_pch || options.module) {
+			fprintf(stderr, "Error: --run takes one input and cannot be used with -o, -c, --batch or --emit-pch\n");
+			status = 1;
 		} else {
-			advance();
+			status = run_file(argc - options.run, argv + options.run, &options);
 		}
-	}
-
-	// Dead Code Elimination
-	analyze_reachability(func_list_head);
-
-	// Code Generation
-	ASTNode *curr = func_list_head;
-	while (curr) {
-		// Only generate if used!
-		if (curr->is_reachable) {
-			gen_asm(curr);
+	} else if (input_count == 0) {
+		fprintf(stderr, "Error: No input file specified\n");
+		status = 1;
+	} else if (batch) {
+		if (output_filename) {
+			fprintf(stderr, "Error: -o cannot be used with --batch\n");
+			status = 1;
+		} else {
+			status = run_batch(inputs, input_count, &options);
 		}
-		
-		// Cleanup
-		ASTNode *next = curr->next;
-		
-		// Detach 'next' so free_ast doesn't delete the whole list recursively
-		curr->next = NULL; 
-		free_ast(curr);
-		
-		curr = next;
+	} else {
+		// Without --batch the last file named wins, as before
+		const char *input_filename = inputs[input_count - 1];
+		char *default_output = output_name(input_filename, options.emit_pch);
+		if (!output_filename)
+			output_filename = options.emit_pch ? default_output : "out.s";
+		status = compile_file(input_filename, output_filename, &options, options.jobs);
+		free(default_output);
 	}
 
-	// Cleanup
-	fclose(stdout); 
-	free(source_code);
-	if (filename_allocated)
-		free(current_filename);
-	free_macros();
-
-	return 0;
+	free(inputs);
+	free(options.include_paths);
+	return status;
 }
-
-/* ========================================================================= */
-/* ERROR HANDLING															 */
-/* ========================================================================= */
-
-void error_at_pos(int line_num, int col_num, int offset, const char *fmt, ...)
-{
-	// Print Header: "file:line:col: "
-	fprintf(stderr, "%s:%d:%d: \n", current_filename, line_num, col_num);
-
-	// Print the formatted message
-	va_list args;
-	va_start(args, fmt);
-	vfprintf(stderr, fmt, args);
-	va_end(args);
-
-	fprintf(stderr, "\n");
-
-	// Scan backwards from offset to find start of line
-	int line_start = offset;
-	while (line_start > 0 && source_code[line_start - 1] != '\n')
-		line_start--;
-
-	// Scan forwards from offset to find end of line
-	int line_end = offset;
-	while (source_code[line_end] != '\0' && source_code[line_end] != '\n')
-		line_end++;
-
-	// Print the Source Line
-	fprintf(stderr, "\t");
-	for (int j = line_start; j < line_end; j++)
-		fputc(source_code[j], stderr);
-	fprintf(stderr, "\n");
-
-	// Print the Caret
-	// Calculate actual column distance based on offset
-	int caret_col = offset - line_start; 
-	
-	fprintf(stderr, "\t");
-	for (int j = 0; j < caret_col; j++)
-		fputc(' ', stderr);
-	fprintf(stderr, "^\n");
-
-	exit(1);
-}
-
-void error_at(Token token, const char *message) {
-	error_at_pos(token.line, token.column, token.offset, "%s", message);
-}
-
-void error(const char *message)
-{
-	error_at(current_token, message);
-}
\ No newline at end of file
@@ -4,23 +4,17 @@
 /* AST                                                                       */
 /* ========================================================================= */
 
-// Helper to make a new node
+// Helper to make a new node. Nodes are never freed one by one; the whole
+// tree is released with arena_free(&hc->ast_arena) after code generation.
 ASTNode *create_node(NodeType type)
 {
-	ASTNode *node = malloc(sizeof(ASTNode));
-	if (!node)
-		error("Failed to create node!");
+	ASTNode *node = arena_alloc(&hc->ast_arena, sizeof(ASTNode), _Alignof(ASTNode));
+	memset(node, 0, sizeof(ASTNode));
 	node->type = type;
-	node->left = node->right = node->body = node->next = NULL;
-	node->int_value = 0;
-	node->var_name = NULL;
-	node->member_name = NULL;
-	node->increment = NULL;
-	node->line = current_token.line;
-	node->column = current_token.column;
-	node->offset = current_token.offset;
-	node->is_reachable = 0;
-	node->is_arrow_access = 0;
+	node->line = hc->current_token.line;
+	node->column = hc->current_token.column;
+	node->offset = hc->current_token.offset;
+	hc->report.nodes++;
 	return node;
 }
 
@@ -31,6 +25,7 @@ ASTNode *create_node(NodeType type)
 ASTNode *parse_expression(void);
 ASTNode *parse_block(void);
 ASTNode *parse_syscall(void);
+ASTNode *parse_asm(void);
 ASTNode *parse_statement(void);
 ASTNode *parse_struct_definition(void);
 
@@ -43,9 +38,9 @@ ASTNode *parse_if(void)
 	ASTNode *if_body = parse_block();
 
 	ASTNode *else_body = NULL;
-	if (current_token.type == TOKEN_ELSE) {
+	if (hc->current_token.type == TOKEN_ELSE) {
 		advance();
-		if (current_token.type == TOKEN_IF) {
+		if (hc->current_token.type == TOKEN_IF) {
 			else_body = parse_if(); // Recursion for 'else if'
 		} else {
 			else_body = parse_block();
@@ -78,7 +73,7 @@ ASTNode *parse_for(void)
 	advance(); // Skip 'for'
 
 	int has_parens = 0;
-	if (current_token.type == TOKEN_LPAREN) {
+	if (hc->current_token.type == TOKEN_LPAREN) {
 		has_parens = 1;
 		advance();
 	}
@@ -88,13 +83,13 @@ ASTNode *parse_for(void)
 	ASTNode *increment = NULL;
 
 	// Check if Rust-style: "identifier in" (e.g., for i in 0..10)
-	if (current_token.type == TOKEN_IDENTIFIER && peek_next_token().type == TOKEN_IN) {
-		char *var_name = strdup(current_token.name);
+	if (hc->current_token.type == TOKEN_IDENTIFIER && peek_token(1).type == TOKEN_IN) {
+		const char *var_name = hc->current_token.name;
 		advance(); // Consume identifier
 		advance(); // Consume 'in'
 
 		ASTNode *start_expr = parse_expression();
-		if (current_token.type != TOKEN_DOTDOT) error("Expected '..' in range");
+		if (hc->current_token.type != TOKEN_DOTDOT) error("Expected '..' in range");
 		advance(); // Consume '..'
 		ASTNode *end_expr = parse_expression();
 
@@ -102,35 +97,33 @@ ASTNode *parse_for(void)
 		
 		// init: int i = start_expr;
 		init = create_node(NODE_VAR_DECL);
-		init->var_name = strdup(var_name);
-		init->member_name = strdup("int");
+		init->var_name = var_name;
+		init->member_name = hc->name_int;
 		init->left = start_expr;
 
 		// condition: i < end_expr
 		condition = create_node(NODE_LT);
 		condition->left = create_node(NODE_VAR_REF);
-		condition->left->var_name = strdup(var_name);
+		condition->left->var_name = var_name;
 		condition->right = end_expr;
 
 		// increment: i++
 		increment = create_node(NODE_POST_INC);
 		increment->left = create_node(NODE_VAR_REF);
-		increment->left->var_name = strdup(var_name);
-
-		free(var_name); // Cleanup original
+		increment->left->var_name = var_name;
 	} else {
 		// --- C-STYLE --- (e.g., int i = 0; i < 10; i++)
 		init = parse_statement(); // Automatically consumes the ';'
 
 		condition = parse_expression();
-		if (current_token.type != TOKEN_SEMI) error("Expected ';'");
+		if (hc->current_token.type != TOKEN_SEMI) error("Expected ';'");
 		advance(); // consume ';'
 
 		increment = parse_expression();
 	}
 
 	if (has_parens) {
-		if (current_token.type != TOKEN_RPAREN) error("Expected ')'");
+		if (hc->current_token.type != TOKEN_RPAREN) error("Expected ')'");
 		advance();
 	}
 
@@ -150,35 +143,35 @@ static
 ASTNode *parse_factor(void)
 {
 	// Handle Integers
-	if (current_token.type == TOKEN_INT) {
+	if (hc->current_token.type == TOKEN_INT) {
 		ASTNode *node = create_node(NODE_INT);
-		node->int_value = current_token.value;
+		node->int_value = hc->current_token.value;
 		advance();
 		return node;
 	}
 
 	// Handle Characters ('a')
-	if (current_token.type == TOKEN_CHAR) {
+	if (hc->current_token.type == TOKEN_CHAR) {
 		ASTNode *node = create_node(NODE_INT);
-		node->int_value = current_token.value;
+		node->int_value = hc->current_token.value;
 		advance();
 		return node;
 	}
 
 	// Handle Variables & Member Access
-	if (current_token.type == TOKEN_IDENTIFIER) {
+	if (hc->current_token.type == TOKEN_IDENTIFIER) {
 		ASTNode *node = create_node(NODE_VAR_REF);
-		node->var_name = strdup(current_token.name);
+		node->var_name = hc->current_token.name;
 		advance();
 
 		// Check for Member Access: p.x
-		if (current_token.type == TOKEN_PERIOD) {
+		if (hc->current_token.type == TOKEN_PERIOD) {
 			advance(); // Consume '.'
-			if (current_token.type != TOKEN_IDENTIFIER) error("Expected member name");
+			if (hc->current_token.type != TOKEN_IDENTIFIER) error("Expected member name");
 
 			ASTNode *access = create_node(NODE_MEMBER_ACCESS);
 			access->left = node; // The 'p'
-			access->member_name = strdup(current_token.name); // The 'x'
+			access->member_name = hc->current_token.name; // The 'x'
 			advance();
 
 			// Allow chaining? (p.x.y) - Not for V1 (structs can't contain structs yet)
@@ -186,13 +179,13 @@ ASTNode *parse_factor(void)
 		}
 
 		// Check for Arrow Access: p->x
-		if (current_token.type == TOKEN_ARROW) {
+		if (hc->current_token.type == TOKEN_ARROW) {
 			advance(); // Consume '->'
-			if (current_token.type != TOKEN_IDENTIFIER) error("Expected member name after '->'");
+			if (hc->current_token.type != TOKEN_IDENTIFIER) error("Expected member name after '->'");
 
 			ASTNode *access = create_node(NODE_MEMBER_ACCESS);
 			access->left = node; // The pointer 'p'
-			access->member_name = strdup(current_token.name); // The member 'x'
+			access->member_name = hc->current_token.name; // The member 'x'
 			access->is_arrow_access = 1; // <--- MARK AS ARROW
 			advance();
 
@@ -200,14 +193,14 @@ ASTNode *parse_factor(void)
 		}
 
 		// Check for Function Call: add(1, 2)
-		if (current_token.type == TOKEN_LPAREN) {
+		if (hc->current_token.type == TOKEN_LPAREN) {
 			advance();  // consume '('
 
 			ASTNode *call_node = create_node(NODE_FUNC_CALL);
 			call_node->var_name = node->var_name; // Reuse name
 
 			ASTNode *current_arg = NULL;
-			while (current_token.type != TOKEN_RPAREN) {
+			while (hc->current_token.type != TOKEN_RPAREN) {
 				ASTNode *expr = parse_expression();
 
 				if (call_node->left == NULL) {
@@ -218,32 +211,30 @@ ASTNode *parse_factor(void)
 					current_arg = expr;
 				}
 
-				if (current_token.type == TOKEN_COMMA) advance();
-				else if (current_token.type != TOKEN_RPAREN) error("Expected ',' or ')'");
+				if (hc->current_token.type == TOKEN_COMMA) advance();
+				else if (hc->current_token.type != TOKEN_RPAREN) error("Expected ',' or ')'");
 			}
 			advance();  // consume ')'
 
-			free(node); // Free the original var_ref shell
 			return call_node;
 		}
 
 		// Check for Array Access: x[i]
-		if (current_token.type == TOKEN_LBRACKET) {
+		if (hc->current_token.type == TOKEN_LBRACKET) {
 			advance();  // consume '['
 			ASTNode *index = parse_expression();
-			if (current_token.type != TOKEN_RBRACKET) error("Expected ']'");
+			if (hc->current_token.type != TOKEN_RBRACKET) error("Expected ']'");
 			advance();  // consume ']'
 
 			ASTNode *array_node = create_node(NODE_ARRAY_ACCESS);
 			array_node->var_name = node->var_name;
 			array_node->left = index;
 
-			free(node);
 			return array_node;
 		}
 
 		// Post-Increment: i++
-		if (current_token.type == TOKEN_INC) {
+		if (hc->current_token.type == TOKEN_INC) {
 			advance();
 			ASTNode* inc_node = create_node(NODE_POST_INC);
 			inc_node->left = node;
@@ -254,24 +245,27 @@ ASTNode *parse_factor(void)
 	}
 
 	// Handle sizeof(Type)
-	if (current_token.type == TOKEN_SIZEOF) {
+	if (hc->current_token.type == TOKEN_SIZEOF) {
 		advance();	// Skip 'sizeof'
-		if (current_token.type != TOKEN_LPAREN) error("Expected '(' after sizeof");
+		if (hc->current_token.type != TOKEN_LPAREN) error("Expected '(' after sizeof");
 		advance();	// Skip '('
 
 		int size = 0;
 
-		if (current_token.type == TOKEN_INT_TYPE) {
+		if (hc->current_token.type == TOKEN_INT_TYPE) {
 			size = 8;
 			advance();
-		} else if (current_token.type == TOKEN_CHAR_TYPE) {
+		} else if (hc->current_token.type == TOKEN_CHAR_TYPE) {
 			size = 1;
 			advance();
-		} else if (current_token.type == TOKEN_PTR_TYPE) {
+		} else if (hc->current_token.type == TOKEN_PTR_TYPE) {
 			size = 8;
 			advance();
-		} else if (current_token.type == TOKEN_IDENTIFIER) {
-			const StructDef *sdef = get_struct(current_token.name);
+		} else if (hc->current_token.type == TOKEN_SIZED_TYPE) {
+			size = type_size(hc->current_token.name);
+			advance();
+		} else if (hc->current_token.type == TOKEN_IDENTIFIER) {
+			const StructDef *sdef = get_struct(hc->current_token.name);
 			if (sdef) {
 				size = sdef->size;
 				advance();
@@ -279,7 +273,7 @@ ASTNode *parse_factor(void)
 				error("Unknown type in sizeof");
 		}
 
-		if (current_token.type != TOKEN_RPAREN) error("Expected ')'");
+		if (hc->current_token.type != TOKEN_RPAREN) error("Expected ')'");
 		advance(); // Skip ')'
 
 		// Return a literal Integer node
@@ -289,36 +283,41 @@ ASTNode *parse_factor(void)
 	}
 
 	// Handle Parentheses
-	if (current_token.type == TOKEN_LPAREN) {
+	if (hc->current_token.type == TOKEN_LPAREN) {
 		advance();
 		ASTNode *node = parse_expression();
-		if (current_token.type != TOKEN_RPAREN) {
+		if (hc->current_token.type != TOKEN_RPAREN) {
 			error("Syntax Error: Expected ')'");
 		}
 		advance();
 		return node;
 	}
 
-	if (current_token.type == TOKEN_SYSCALL) {
+	if (hc->current_token.type == TOKEN_SYSCALL) {
 		return parse_syscall();
 	}
 
-	if (current_token.type == TOKEN_STRING) {
+	if (hc->current_token.type == TOKEN_ASM) {
+		ASTNode *node = parse_asm();
+		node->int_value = 1; // Used as a value: push rax
+		return node;
+	}
+
+	if (hc->current_token.type == TOKEN_STRING) {
 		ASTNode *node = create_node(NODE_STRING);
-		node->var_name = strdup(current_token.name);
+		node->var_name = hc->current_token.name;
 		advance();
 		return node;
 	}
 
 	error("Syntax Error: Unexpected token in factor");
-	exit(1);
 }
 
 static
 ASTNode *parse_unary(void)
 {
 	// Address Of (&x or &p.x)
-	if (current_token.type == TOKEN_AMP) {
+	if (hc->current_token.type == TOKEN_AMP) {
 		advance();
 		ASTNode *node = create_node(NODE_ADDR);
 		node->left = parse_unary();
@@ -326,7 +325,7 @@ ASTNode *parse_unary(void)
 	}
 
 	// Dereference (*x)
-	if (current_token.type == TOKEN_STAR) {
+	if (hc->current_token.type == TOKEN_STAR) {
 		advance();
 		ASTNode *node = create_node(NODE_DEREF);
 		node->left = parse_unary();
@@ -334,7 +333,7 @@ ASTNode *parse_unary(void)
 	}
 
 	// Negative Numbers (-5)
-	if (current_token.type == TOKEN_MINUS) {
+	if (hc->current_token.type == TOKEN_MINUS) {
 		advance();
 		ASTNode *node = create_node(NODE_BINOP);
 		node->op = '-';
@@ -351,9 +350,12 @@ static
 ASTNode *parse_term(void)
 {
 	ASTNode *node = parse_unary();
-	while (current_token.type == TOKEN_STAR || current_token.type == TOKEN_SLASH) {
+	while (hc->current_token.type == TOKEN_STAR || hc->current_token.type == TOKEN_SLASH ||
+		   hc->current_token.type == TOKEN_PERCENT) {
 		ASTNode *newNode = create_node(NODE_BINOP);
-		newNode->op = (current_token.type == TOKEN_STAR) ? '*' : '/';
+		if (hc->current_token.type == TOKEN_STAR) newNode->op = '*';
+		else if (hc->current_token.type == TOKEN_SLASH) newNode->op = '/';
+		else newNode->op = '%';
 		newNode->left = node;
 		advance();
 		newNode->right = parse_unary();
@@ -366,9 +368,9 @@ static
 ASTNode *parse_math(void)
 {
 	ASTNode *node = parse_term();
-	while (current_token.type == TOKEN_PLUS || current_token.type == TOKEN_MINUS) {
+	while (hc->current_token.type == TOKEN_PLUS || hc->current_token.type == TOKEN_MINUS) {
 		ASTNode *newNode = create_node(NODE_BINOP);
-		newNode->op = (current_token.type == TOKEN_PLUS) ? '+' : '-';
+		newNode->op = (hc->current_token.type == TOKEN_PLUS) ? '+' : '-';
 		newNode->left = node;
 		advance();
 		newNode->right = parse_term();
@@ -377,13 +379,14 @@ ASTNode *parse_math(void)
 	return node;
 }
 
+// Shifts: x << n, x >> n (logical for unsigned operands, arithmetic otherwise)
 static
-ASTNode *parse_bitwise(void) {
+ASTNode *parse_shift(void)
+{
 	ASTNode *node = parse_math();
-	while (current_token.type == TOKEN_AMP || current_token.type == TOKEN_PIPE) {
-		char op = (current_token.type == TOKEN_AMP) ? '&' : '|';
+	while (hc->current_token.type == TOKEN_SHL || hc->current_token.type == TOKEN_SHR) {
 		ASTNode *newNode = create_node(NODE_BINOP);
-		newNode->op = op;
+		newNode->op = (hc->current_token.type == TOKEN_SHL) ? '<' : '>';
 		newNode->left = node;
 		advance();
 		newNode->right = parse_math();
@@ -392,17 +395,32 @@ ASTNode *parse_bitwise(void) {
 	return node;
 }
 
+static
+ASTNode *parse_bitwise(void) {
+	ASTNode *node = parse_shift();
+	while (hc->current_token.type == TOKEN_AMP || hc->current_token.type == TOKEN_PIPE) {
+		char op = (hc->current_token.type == TOKEN_AMP) ? '&' : '|';
+		ASTNode *newNode = create_node(NODE_BINOP);
+		newNode->op = op;
+		newNode->left = node;
+		advance();
+		newNode->right = parse_shift();
+		node = newNode;
+	}
+	return node;
+}
+
 static
 ASTNode *parse_comparison(void)
 {
 	ASTNode *node = parse_bitwise();
-	while (current_token.type == TOKEN_GT || current_token.type == TOKEN_LT ||
-		   current_token.type == TOKEN_EQ || current_token.type == TOKEN_NEQ) {
+	while (hc->current_token.type == TOKEN_GT || hc->current_token.type == TOKEN_LT ||
+		   hc->current_token.type == TOKEN_EQ || hc->current_token.type == TOKEN_NEQ) {
 		NodeType type;
-		if (current_token.type == TOKEN_GT) type = NODE_GT;
-		if (current_token.type == TOKEN_LT) type = NODE_LT;
-		if (current_token.type == TOKEN_EQ) type = NODE_EQ;
-		if (current_token.type == TOKEN_NEQ) type = NODE_NEQ;
+		if (hc->current_token.type == TOKEN_GT) type = NODE_GT;
+		if (hc->current_token.type == TOKEN_LT) type = NODE_LT;
+		if (hc->current_token.type == TOKEN_EQ) type = NODE_EQ;
+		if (hc->current_token.type == TOKEN_NEQ) type = NODE_NEQ;
 
 		ASTNode *newNode = create_node(type);
 		newNode->left = node;
@@ -417,7 +435,7 @@ ASTNode *parse_logical_and(void)
 {
 	// AND binds tighter than OR, so it calls comparison
 	ASTNode *node = parse_comparison();
-	while (current_token.type == TOKEN_AND) {
+	while (hc->current_token.type == TOKEN_AND) {
 		ASTNode *newNode = create_node(NODE_AND);
 		newNode->left = node;
 		advance();
@@ -431,7 +449,7 @@ ASTNode *parse_logical_or(void)
 {
 	// OR has lowest precedence, so it calls AND
 	ASTNode *node = parse_logical_and();
-	while (current_token.type == TOKEN_OR) {
+	while (hc->current_token.type == TOKEN_OR) {
 		ASTNode *newNode = create_node(NODE_OR);
 		newNode->left = node;
 		advance();
@@ -447,7 +465,7 @@ ASTNode *parse_expression(void)
 	ASTNode* lhs = parse_logical_or();
 
 	// Check for Assignment
-	if (current_token.type == TOKEN_ASSIGN) {
+	if (hc->current_token.type == TOKEN_ASSIGN) {
 		advance(); // consume '='
 
 		// Check valid L-value: Var, Array, Deref, or MEMBER ACCESS
@@ -472,7 +490,6 @@ ASTNode *parse_expression(void)
 			// Normal var
 			assign->var_name = lhs->var_name;
 			assign->left = NULL;
-			free(lhs);
 		}
 
 		assign->right = parse_expression();
@@ -486,39 +503,41 @@ ASTNode *parse_struct_definition(void)
 {
 	advance(); // Skip 'struct'
 
-	if (current_token.type != TOKEN_IDENTIFIER) error("Expected struct name");
-	char *struct_name = strdup(current_token.name);
+	if (hc->current_token.type != TOKEN_IDENTIFIER) error("Expected struct name");
+	const char *struct_name = hc->current_token.name;
 	advance();
 
-	if (current_token.type != TOKEN_LBRACE) error("Expected '{'");
+	if (hc->current_token.type != TOKEN_LBRACE) error("Expected '{'");
 	advance();
 
 	// Create Entry in Registry
-	StructDef *new_struct = &struct_registry[struct_count++];
-	strcpy(new_struct->name, struct_name);
-	new_struct->member_count = 0;
-	new_struct->size = 0;
+	StructDef *new_struct = add_struct(struct_name);
 
-	while (current_token.type != TOKEN_RBRACE) {
-		if (current_token.type != TOKEN_IDENTIFIER) error("Expected member name");
-		char *mem_name = strdup(current_token.name);
+	while (hc->current_token.type != TOKEN_RBRACE) {
+		if (hc->current_token.type != TOKEN_IDENTIFIER) error("Expected member name");
+		const char *mem_name = hc->current_token.name;
 		advance();
 
-		if (current_token.type != TOKEN_COLON) error("Expected ':'");
+		if (hc->current_token.type != TOKEN_COLON) error("Expected ':'");
 		advance();
 
-		// Parse Type (int, ptr, char)
+		// Parse Type (int, ptr, char, u8, ...)
 		int mem_size = 8; // Default 8 bytes
+		StructMember *member = add_struct_member(new_struct);
+		member->type_name = hc->current_token.name;
 
-		if (current_token.type == TOKEN_CHAR_TYPE) {
+		if (hc->current_token.type == TOKEN_CHAR_TYPE) {
 			mem_size = 1;
 			advance();
-		} else if (current_token.type == TOKEN_INT_TYPE ||
-					current_token.type == TOKEN_PTR_TYPE) {
+		} else if (hc->current_token.type == TOKEN_INT_TYPE ||
+					hc->current_token.type == TOKEN_PTR_TYPE) {
 			advance();
-		} else if (current_token.type == TOKEN_IDENTIFIER) {
+		} else if (hc->current_token.type == TOKEN_SIZED_TYPE) {
+			mem_size = type_size(hc->current_token.name);
+			advance();
+		} else if (hc->current_token.type == TOKEN_IDENTIFIER) {
 			// Support nested structs (e.g. p: Point)
-			const StructDef *sub = get_struct(current_token.name);
+			const StructDef *sub = get_struct(hc->current_token.name);
 			if (sub) {
 				mem_size = sub->size;
 				advance();
@@ -530,44 +549,185 @@ ASTNode *parse_struct_definition(void)
 		}
 
 		// Add Member
-		strcpy(new_struct->members[new_struct->member_count].name, mem_name);
-		new_struct->members[new_struct->member_count].offset = new_struct->size;
-		new_struct->member_count++;
+		member->name = mem_name;
+		member->offset = new_struct->size;
 		new_struct->size += mem_size;
 
-		if (current_token.type == TOKEN_COMMA) advance();
-		free(mem_name);
+		if (hc->current_token.type == TOKEN_COMMA) advance();
 	}
 
 	advance(); // Skip '}'
 
 	// Optional semicolon
-	if (current_token.type == TOKEN_SEMI) advance();
+	if (hc->current_token.type == TOKEN_SEMI) advance();
 
-	free(struct_name);
 	return NULL; // No executable code generated
 }
 
-// Variable Declaration: int x; OR Point p;
+// Whether the current token starts a declaration (int, ptr, char, u8..i64, const, struct names)
+int is_declaration_start(void)
+{
+	return hc->current_token.type == TOKEN_INT_TYPE ||
+		   hc->current_token.type == TOKEN_PTR_TYPE ||
+		   hc->current_token.type == TOKEN_CHAR_TYPE ||
+		   hc->current_token.type == TOKEN_SIZED_TYPE ||
+		   hc->current_token.type == TOKEN_CONST ||
+		   (hc->current_token.type == TOKEN_IDENTIFIER && get_struct(hc->current_token.name));
+}
+
+// Parse one constant initializer and fold it down to a literal
 static
-ASTNode *parse_var_declaration(void)
+ASTNode *parse_constant(void)
+{
+	ASTNode *expr = parse_expression();
+	optimize_ast(expr);
+	if (expr->type != NODE_INT)
+		error_at_pos(expr->line, expr->column, expr->offset,
+					 "Global initializer must be a constant expression");
+	return expr;
+}
+
+// Bytes in a string literal once NASM has decoded its backquote escapes,
+// the terminator not included. Mirrors decode_escape in jit.c.
+static
+long string_literal_size(const char *s)
 {
-	char *type_name = NULL;
+	long count = 0;
+	while (*s) {
+		if (*s++ != '\\' || !*s) {
+			count++;
+			continue;
+		}
+		char e = *s++;
+		if (e == 'x') {
+			for (int i = 0; i < 2 && isxdigit((unsigned char)*s); i++) s++;
+			count++;
+		} else if (e == 'u' || e == 'U') {
+			unsigned long cp = 0;
+			for (int i = 0; i < (e == 'u' ? 4 : 8) && isxdigit((unsigned char)*s); i++, s++)
+				cp = cp * 16 + (isdigit((unsigned char)*s) ? *s - '0' : (tolower((unsigned char)*s) - 'a' + 10));
+			count += cp < 0x80 ? 1 : cp < 0x800 ? 2 : cp < 0x10000 ? 3 : 4;
+		} else {
+			if (e >= '0' && e <= '7')
+				for (int i = 0; i < 2 && *s >= '0' && *s <= '7'; i++) s++;
+			count++;
+		}
+	}
+	return count;
+}
+
+// Global Declaration: [const] int x = 5; OR char table[] = {1, 2, 3}; OR char msg[] = "hi";
+ASTNode *parse_global_declaration(void)
+{
+	int is_const = 0;
+	if (hc->current_token.type == TOKEN_CONST) {
+		is_const = 1;
+		advance();
+	}
 
 	// 1. Detect Type
-	if (current_token.type == TOKEN_INT_TYPE) {
-		type_name = "int";
+	const char *type_name = NULL;
+	if (hc->current_token.type == TOKEN_INT_TYPE ||
+		hc->current_token.type == TOKEN_PTR_TYPE ||
+		hc->current_token.type == TOKEN_CHAR_TYPE ||
+		hc->current_token.type == TOKEN_SIZED_TYPE ||
+		(hc->current_token.type == TOKEN_IDENTIFIER && get_struct(hc->current_token.name))) {
+		type_name = hc->current_token.name;
 		advance();
-	} else if (current_token.type == TOKEN_PTR_TYPE) {
-		type_name = "ptr";
+	} else {
+		error("Expected type specifier");
+	}
+	int is_struct = get_struct(type_name) != NULL;
+
+	if (hc->current_token.type != TOKEN_IDENTIFIER) error("Expected variable name");
+	ASTNode *node = create_node(NODE_GLOBAL_DECL);
+	node->var_name = hc->current_token.name;
+	node->member_name = type_name;
+	node->is_const = is_const;
+	advance();
+
+	// Array: int t[10]; OR int t[] = {...};
+	// int_value holds the element count, 0 means a plain scalar
+	int is_array = 0;
+	int size_given = 0;
+	if (hc->current_token.type == TOKEN_LBRACKET) {
+		is_array = 1;
 		advance();
-	} else if (current_token.type == TOKEN_CHAR_TYPE) {
-		type_name = "char";
+		if (hc->current_token.type == TOKEN_INT) {
+			if (hc->current_token.value < 1) error("Array size must be positive");
+			node->int_value = hc->current_token.value;
+			size_given = 1;
+			advance();
+		}
+		if (hc->current_token.type != TOKEN_RBRACKET) error("Expected ']'");
 		advance();
-	} else if (current_token.type == TOKEN_IDENTIFIER) {
+	}
+
+	if (hc->current_token.type == TOKEN_ASSIGN) {
+		advance();
+		if (is_struct) error("Struct globals cannot have initializers");
+
+		int count = 0;
+		if (is_array && hc->current_token.type == TOKEN_STRING) {
+			// char msg[] = "text"; (the data keeps the escapes for NASM)
+			if (type_size(type_name) != 1) error("String initializers need a 1-byte element type");
+			node->left = create_node(NODE_STRING);
+			node->left->var_name = hc->current_token.name;
+			count = string_literal_size(hc->current_token.name) + 1;
+			node->left->int_value = count; // Bytes including the terminator
+			advance();
+		} else if (is_array) {
+			if (hc->current_token.type != TOKEN_LBRACE) error("Expected '{' to start array initializer");
+			advance();
+
+			ASTNode *tail = NULL;
+			while (hc->current_token.type != TOKEN_RBRACE) {
+				ASTNode *value = parse_constant();
+				if (!node->left) node->left = value;
+				else tail->next = value;
+				tail = value;
+				count++;
+
+				if (hc->current_token.type == TOKEN_COMMA) advance();
+				else if (hc->current_token.type != TOKEN_RBRACE) error("Expected ',' or '}'");
+			}
+			advance(); // Skip '}'
+		} else {
+			node->left = parse_constant();
+		}
+
+		if (!size_given) {
+			node->int_value = count;
+		} else if (count > node->int_value) {
+			error_at_pos(node->line, node->column, node->offset,
+						 "Too many initializers for '%s'", node->var_name);
+		}
+	}
+
+	if (is_array && node->int_value == 0) error("Array size must be given or inferred from an initializer");
+	if (hc->current_token.type != TOKEN_SEMI) error("Expected ';' after declaration");
+	advance();
+
+	return node;
+}
+
+// Variable Declaration: int x; OR Point p;
+static
+ASTNode *parse_var_declaration(void)
+{
+	const char *type_name = NULL;
+
+	// 1. Detect Type (keyword tokens carry their interned spelling)
+	if (hc->current_token.type == TOKEN_INT_TYPE ||
+		hc->current_token.type == TOKEN_PTR_TYPE ||
+		hc->current_token.type == TOKEN_CHAR_TYPE ||
+		hc->current_token.type == TOKEN_SIZED_TYPE) {
+		type_name = hc->current_token.name;
+		advance();
+	} else if (hc->current_token.type == TOKEN_IDENTIFIER) {
 		// Check if it's a known struct
-		if (get_struct(current_token.name)) {
-			type_name = strdup(current_token.name);
+		if (get_struct(hc->current_token.name)) {
+			type_name = hc->current_token.name;
 			advance();
 		} else {
 			error("Unknown type specifier");
@@ -576,26 +736,25 @@ ASTNode *parse_var_declaration(void)
 		error("Expected type specifier");
 	}
 
-	if (current_token.type != TOKEN_IDENTIFIER) error("Expected variable name");
-	char *name = strdup(current_token.name);
+	if (hc->current_token.type != TOKEN_IDENTIFIER) error("Expected variable name");
+	const char *name = hc->current_token.name;
 	advance();
 
 	// Array: int x[10];
-	if (current_token.type == TOKEN_LBRACKET) {
+	if (hc->current_token.type == TOKEN_LBRACKET) {
 		advance();
-		if (current_token.type != TOKEN_INT) error("Array size must be integer literal");
-		int size = current_token.value;
+		if (hc->current_token.type != TOKEN_INT) error("Array size must be integer literal");
+		int size = hc->current_token.value;
 		advance();
-		if (current_token.type != TOKEN_RBRACKET) error("Expected ']'");
+		if (hc->current_token.type != TOKEN_RBRACKET) error("Expected ']'");
 		advance();
-		if (current_token.type != TOKEN_SEMI) error("Expected ';'");
+		if (hc->current_token.type != TOKEN_SEMI) error("Expected ';'");
 		advance();
 
 		ASTNode *node = create_node(NODE_ARRAY_DECL);
 		node->var_name = name;
 		node->int_value = size;
-
-		node->member_name = type_name ? strdup(type_name) : strdup("int");
+		node->member_name = type_name;
 		return node;
 	}
 
@@ -604,73 +763,77 @@ ASTNode *parse_var_declaration(void)
 	node->var_name = name;
 	// CRITICAL: Pass the type name to Codegen!
 	// We use member_name field to store the type name string for declarations
-	node->member_name = type_name ? strdup(type_name) : strdup("int");
+	node->member_name = type_name;
 
-	if (current_token.type == TOKEN_ASSIGN) {
+	if (hc->current_token.type == TOKEN_ASSIGN) {
 		advance();
 		node->left = parse_expression();
 	}
 
-	if (current_token.type != TOKEN_SEMI) error("Expected ';' after declaration");
+	if (hc->current_token.type != TOKEN_SEMI) error("Expected ';' after declaration");
 	advance();
 
-	if (type_name && strcmp(type_name, "int") != 0 && strcmp(type_name, "ptr") != 0 && strcmp(type_name, "char") != 0) {
-		free(type_name);
-	}
-
 	return node;
 }
 
 ASTNode *parse_statement(void)
 {
-	if (current_token.type == TOKEN_RETURN) {
+	if (hc->current_token.type == TOKEN_RETURN) {
 		advance();
 		ASTNode *node = create_node(NODE_RETURN);
 		node->left = parse_expression();
-		if (current_token.type != TOKEN_SEMI) error("Expected ';'");
+		if (hc->current_token.type != TOKEN_SEMI) error("Expected ';'");
 		advance();
 		return node;
 	}
 
 	// Struct Definition
-	if (current_token.type == TOKEN_STRUCT) {
+	if (hc->current_token.type == TOKEN_STRUCT) {
 		return parse_struct_definition();
 	}
 
-	// Variable Declarations (int, ptr, char, OR struct names)
-	if (current_token.type == TOKEN_INT_TYPE ||
-		current_token.type == TOKEN_PTR_TYPE ||
-		current_token.type == TOKEN_CHAR_TYPE) {
+	// Variable Declarations (int, ptr, char, u8..i64, OR struct names)
+	if (hc->current_token.type == TOKEN_INT_TYPE ||
+		hc->current_token.type == TOKEN_PTR_TYPE ||
+		hc->current_token.type == TOKEN_CHAR_TYPE ||
+		hc->current_token.type == TOKEN_SIZED_TYPE) {
 		return parse_var_declaration();
 	}
 
 	// Check for "Point p;" where Point is an identifier
-	if (current_token.type == TOKEN_IDENTIFIER) {
+	if (hc->current_token.type == TOKEN_IDENTIFIER) {
 		// Look ahead? No, get_struct handles lookup.
-		if (get_struct(current_token.name)) {
+		if (get_struct(hc->current_token.name)) {
 			return parse_var_declaration();
 		}
 	}
 
-	if (current_token.type == TOKEN_IF) return parse_if();
-	if (current_token.type == TOKEN_WHILE) return parse_while();
-	if (current_token.type == TOKEN_FOR) return parse_for();
+	if (hc->current_token.type == TOKEN_IF) return parse_if();
+	if (hc->current_token.type == TOKEN_WHILE) return parse_while();
+	if (hc->current_token.type == TOKEN_FOR) return parse_for();
+
+	// An asm statement ends at its '}' like a block; a ';' may follow
+	if (hc->current_token.type == TOKEN_ASM) {
+		ASTNode *node = parse_asm();
+		if (hc->current_token.type == TOKEN_SEMI) advance();
+		return node;
+	}
 
 	ASTNode *node = parse_expression();
-	if (current_token.type != TOKEN_SEMI) error("Expected ';'");
+	if (hc->current_token.type != TOKEN_SEMI) error("Expected ';'");
 	advance();
 	return node;
 }
 
 ASTNode *parse_block(void)
 {
-	if (current_token.type != TOKEN_LBRACE) error("Expected '{'");
+	if (hc->current_token.type != TOKEN_LBRACE) error("Expected '{'");
 	advance();
 
 	ASTNode *block = create_node(NODE_BLOCK);
 	ASTNode *curr = NULL;
 
-	while (current_token.type != TOKEN_RBRACE && current_token.type != TOKEN_EOF) {
+	while (hc->current_token.type != TOKEN_RBRACE && hc->current_token.type != TOKEN_EOF) {
 		ASTNode *stmt = parse_statement();
 		if (stmt) { // parse_struct_def returns NULL
 			if (!block->left) {
@@ -683,59 +846,71 @@ ASTNode *parse_block(void)
 		}
 	}
 
-	if (current_token.type != TOKEN_RBRACE) error("Expected '}'");
+	if (hc->current_token.type != TOKEN_RBRACE) error("Expected '}'");
 	advance();
 	return block;
 }
 
+// fn name(params) -> type { ... }
+// 'static fn' is only visible inside this object; 'extern fn name(...);'
+// declares a function that another object defines.
 ASTNode *parse_function(void)
 {
-	if (current_token.type != TOKEN_FN) return NULL;
+	int is_static = 0;
+	int is_extern = 0;
+	if (hc->current_token.type == TOKEN_STATIC) {
+		is_static = 1;
+		advance();
+	} else if (hc->current_token.type == TOKEN_EXTERN) {
+		is_extern = 1;
+		advance();
+	}
+
+	if (hc->current_token.type != TOKEN_FN) error("Expected 'fn'");
 	advance();
 
-	char *name = strdup(current_token.name);
+	const char *name = hc->current_token.name;
 	advance();
 
-	if (current_token.type != TOKEN_LPAREN) error("Expected '('");
+	if (hc->current_token.type != TOKEN_LPAREN) error("Expected '('");
 	advance();
 
 	ASTNode *first_param = NULL;
 	ASTNode *current_param = NULL;
 
-	while (current_token.type != TOKEN_RPAREN) {
-		if (current_token.type != TOKEN_IDENTIFIER) error("Expected parameter name");
+	while (hc->current_token.type != TOKEN_RPAREN) {
+		if (hc->current_token.type != TOKEN_IDENTIFIER) error("Expected parameter name");
 		ASTNode *param = create_node(NODE_VAR_DECL);
-		param->var_name = strdup(current_token.name);
+		param->var_name = hc->current_token.name;
 		param->left = NULL;
 		advance();
 
-		if (current_token.type != TOKEN_COLON) error("Expected ':'");
+		if (hc->current_token.type != TOKEN_COLON) error("Expected ':'");
 		advance();
 
 		// Parameter Types
 		// We use member_name to store the type string for params too
-		const char *type = "int";
-		if (current_token.type == TOKEN_INT_TYPE) { type = "int"; advance(); }
-		else if (current_token.type == TOKEN_PTR_TYPE) { type = "ptr"; advance(); }
-		else if (current_token.type == TOKEN_CHAR_TYPE) { type = "char"; advance(); }
-		else if (current_token.type == TOKEN_IDENTIFIER && get_struct(current_token.name)) {
-			type = strdup(current_token.name);
+		if (hc->current_token.type == TOKEN_INT_TYPE ||
+			hc->current_token.type == TOKEN_PTR_TYPE ||
+			hc->current_token.type == TOKEN_CHAR_TYPE ||
+			hc->current_token.type == TOKEN_SIZED_TYPE ||
+			(hc->current_token.type == TOKEN_IDENTIFIER && get_struct(hc->current_token.name))) {
+			param->member_name = hc->current_token.name;
 			advance();
 		} else {
 			error("Invalid parameter type");
 		}
-		param->member_name = strdup(type);
 
 		if (first_param == NULL) { first_param = param; current_param = param; }
 		else { current_param->next = param; current_param = param; }
 
-		if (current_token.type == TOKEN_COMMA) advance();
-		else if (current_token.type != TOKEN_RPAREN) error("Expected ',' or ')'");
+		if (hc->current_token.type == TOKEN_COMMA) advance();
+		else if (hc->current_token.type != TOKEN_RPAREN) error("Expected ',' or ')'");
 	}
 
 	advance(); // ')'
 
-	if (current_token.type == TOKEN_ARROW) {
+	if (hc->current_token.type == TOKEN_ARROW) {
 		advance();
 		// Skip return type for now, we don't enforce it strictly
 		advance();
@@ -744,7 +919,15 @@ ASTNode *parse_function(void)
 	ASTNode *func = create_node(NODE_FUNCTION);
 	func->var_name = name;
 	func->left = first_param;
-	func->body = parse_block();
+	func->is_static = is_static;
+	func->is_extern = is_extern;
+
+	if (is_extern) {
+		if (hc->current_token.type != TOKEN_SEMI) error("Expected ';' after extern declaration");
+		advance();
+	} else {
+		func->body = parse_block();
+	}
 
 	return func;
 }
@@ -752,45 +935,189 @@ ASTNode *parse_function(void)
 ASTNode *parse_syscall(void)
 {
 	advance(); // syscall
-	if (current_token.type != TOKEN_LPAREN) error("Expected '('");
+	if (hc->current_token.type != TOKEN_LPAREN) error("Expected '('");
 	advance();
 
 	ASTNode *call_node = create_node(NODE_SYSCALL);
 	ASTNode *current_arg = NULL;
 
-	while (current_token.type != TOKEN_RPAREN) {
+	while (hc->current_token.type != TOKEN_RPAREN) {
 		ASTNode *expr = parse_expression();
 		if (call_node->left == NULL) { call_node->left = expr; current_arg = expr; }
 		else { current_arg->next = expr; current_arg = expr; }
 
-		if (current_token.type == TOKEN_COMMA) advance();
-		else if (current_token.type != TOKEN_RPAREN) error("Expected ',' or ')'");
+		if (hc->current_token.type == TOKEN_COMMA) advance();
+		else if (hc->current_token.type != TOKEN_RPAREN) error("Expected ',' or ')'");
 	}
 	advance();
 	return call_node;
 }
 
-void free_ast(ASTNode *node)
+// Length of the {name} operand or {.name} label at 'text', or 0 if there
+// is none
+int asm_operand_length(const char *text)
 {
-	if (node == NULL) return;
-	free_ast(node->left);
-	free_ast(node->right);
-	free_ast(node->body);
-	free_ast(node->next);
-	free_ast(node->increment);
-	if (node->var_name) free(node->var_name);
-	if (node->member_name) free(node->member_name);
-	free(node);
+	int len = text[1] == '.' ? 2 : 1;
+	if (text[0] != '{' || !(isalpha((unsigned char)text[len]) || text[len] == '_'))
+		return 0;
+	len++;
+	while (isalnum((unsigned char)text[len]) || text[len] == '_')
+		len++;
+	return text[len] == '}' ? len + 1 : 0;
 }
 
+// One register of an in(), out() or clobber() list
+static
+ASTNode *parse_asm_register(void)
+{
+	if (hc->current_token.type != TOKEN_IDENTIFIER) error("Expected a register");
+	const char *reg = hc->current_token.name;
+	const Token *t = &hc->current_token;
+	if (!table_get(&hc->asm_register_table, reg))
+		error_at_pos(t->line, t->column, t->offset,
+					 "Unknown register '%s' (asm operands are 64-bit registers)", reg);
+	if (reg == hc->name_rsp || reg == hc->name_rbp)
+		error_at_pos(t->line, t->column, t->offset,
+					 "asm cannot use '%s', which holds the stack frame", reg);
+
+	ASTNode *operand = create_node(NODE_ASM_OPERAND);
+	operand->member_name = reg;
+	advance();
+	return operand;
+}
+
+// An asm's operand lists, in the order of its left, right and body
+enum { ASM_IN, ASM_OUT, ASM_CLOBBER };
+
+// in(reg = expr, ...), out(reg = variable, ...) or clobber(reg, ...)
+static
+ASTNode *parse_asm_operands(int kind)
+{
+	advance(); // in, out or clobber
+	if (hc->current_token.type != TOKEN_LPAREN) error("Expected '('");
+	advance();
+
+	ASTNode *first = NULL;
+	ASTNode *last = NULL;
+	while (hc->current_token.type != TOKEN_RPAREN) {
+		ASTNode *operand = parse_asm_register();
+		if (kind != ASM_CLOBBER) {
+			if (hc->current_token.type != TOKEN_ASSIGN) error("Expected '=' after the register");
+			advance();
+			if (kind == ASM_IN) {
+				operand->left = parse_expression();
+			} else {
+				if (hc->current_token.type != TOKEN_IDENTIFIER) error("Expected a variable to store into");
+				operand->var_name = hc->current_token.name;
+				advance();
+			}
+		}
+
+		if (!first) first = operand;
+		else last->next = operand;
+		last = operand;
+
+		if (hc->current_token.type == TOKEN_COMMA) advance();
+		else if (hc->current_token.type != TOKEN_RPAREN) error("Expected ',' or ')'");
+	}
+	advance();
+	return first;
+}
+
+// A line that starts with 'name:' would define a global label, which
+// ends the function's local label scope and clashes with any other
+// block that uses the same name
+static
+void check_asm_label(const char *text)
+{
+	while (*text == ' ' || *text == '\t')
+		text++;
+	if (!isalpha((unsigned char)*text) && *text != '_') return;
+	int len = 1;
+	while (isalnum((unsigned char)text[len]) || text[len] == '_')
+		len++;
+	if (text[len] == ':')
+		error_at_pos(hc->current_token.line, hc->current_token.column, hc->current_token.offset,
+					 "asm label '%.*s' must be written '{.%.*s}'", len, text, len, text);
+}
+
+// asm in(rdi = dst, rcx = n) out(rax = x) clobber(rdi, rcx) { "line" ... }
+// The lines go to the output as they are, except that {name} becomes the
+// memory operand of the variable 'name' and {.name} a label of this block
+// alone. Used as a value, asm gives rax.
+ASTNode *parse_asm(void)
+{
+	advance(); // asm
+
+	ASTNode *node = create_node(NODE_ASM);
+	ASTNode **lists[] = {&node->left, &node->right, &node->body};
+	while (hc->current_token.type != TOKEN_LBRACE) {
+		int kind;
+		if (hc->current_token.type == TOKEN_IN)
+			kind = ASM_IN;
+		else if (hc->current_token.type == TOKEN_IDENTIFIER && hc->current_token.name == hc->name_out)
+			kind = ASM_OUT;
+		else if (hc->current_token.type == TOKEN_IDENTIFIER && hc->current_token.name == hc->name_clobber)
+			kind = ASM_CLOBBER;
+		else
+			error("Expected 'in', 'out', 'clobber' or '{' after 'asm'");
+		if (*lists[kind]) error("Each of in(), out() and clobber() may appear once");
+		*lists[kind] = parse_asm_operands(kind);
+	}
+	advance(); // '{'
+
+	// The template: one string per line, with its {name} operands as
+	// variable references in order (codegen must not intern the names)
+	ASTNode *last = NULL;
+	while (hc->current_token.type == TOKEN_STRING) {
+		ASTNode *line = create_node(NODE_STRING);
+		line->var_name = hc->current_token.name;
+		check_asm_label(line->var_name);
+		ASTNode *last_operand = NULL;
+		for (const char *p = line->var_name; *p; p++) {
+			int len = asm_operand_length(p);
+			if (!len) continue;
+			if (p[1] == '.') {
+				p += len - 1;
+				continue;
+			}
+			ASTNode *operand = create_node(NODE_VAR_REF);
+			operand->var_name = intern(p + 1, len - 2);
+			if (!last_operand) line->left = operand;
+			else last_operand->next = operand;
+			last_operand = operand;
+			p += len - 1;
+		}
+
+		if (!last) node->increment = line;
+		else last->next = line;
+		last = line;
+		advance();
+	}
+	if (hc->current_token.type != TOKEN_RBRACE) error("Expected a string or '}' in asm");
+	advance();
+	return node;
+}
+
+static
+void optimize_node(ASTNode *node);
+
+// Statements, arguments and top-level items are chained through 'next'.
+// The chain is walked with a loop so only real nesting uses the C stack;
+// a block with a million statements is no deeper than one with three.
 void optimize_ast(ASTNode *node)
 {
-	if (!node) return;
+	for (; node; node = node->next)
+		optimize_node(node);
+}
+
+static
+void optimize_node(ASTNode *node)
+{
 	// Optimize Children First (Bottom-Up)
 	optimize_ast(node->left);
 	optimize_ast(node->right);
 	optimize_ast(node->body);
-	optimize_ast(node->next);
 	optimize_ast(node->increment);
 
 	// Constant Folding: BinOp(Int, Int) -> Int
@@ -798,17 +1125,34 @@ void optimize_ast(ASTNode *node)
 		if (node->left && node->left->type == NODE_INT &&
 			node->right && node->right->type == NODE_INT) {
 			
-			int v1 = node->left->int_value;
-			int v2 = node->right->int_value;
-			int res = 0;
+			long v1 = node->left->int_value;
+			long v2 = node->right->int_value;
+			long res = 0;
 			int handled = 1;
 
+			// Wrap like the hardware does instead of relying on signed overflow
 			switch (node->op) {
-				case '+': res = v1 + v2; break;
-				case '-': res = v1 - v2; break;
-				case '*': res = v1 * v2; break;
+				case '+': res = (long)((unsigned long)v1 + (unsigned long)v2); break;
+				case '-': res = (long)((unsigned long)v1 - (unsigned long)v2); break;
+				case '*': res = (long)((unsigned long)v1 * (unsigned long)v2); break;
+				// LONG_MIN / -1 overflows (and traps in C); it wraps to
+				// LONG_MIN with remainder 0
 				case '/':
-					if (v2 != 0) res = v1 / v2;
+					if (v2 == -1) res = (long)(0UL - (unsigned long)v1);
+					else if (v2 != 0) res = v1 / v2;
+					else handled = 0;
+					break;
+				case '%':
+					if (v2 == -1) res = 0;
+					else if (v2 != 0) res = v1 % v2;
+					else handled = 0;
+					break;
+				case '<':
+					if (v2 >= 0 && v2 < 64) res = (long)((unsigned long)v1 << v2);
+					else handled = 0;
+					break;
+				case '>':
+					if (v2 >= 0 && v2 < 64) res = v1 >> v2;
 					else handled = 0;
 					break;
 				case '|': res = v1 | v2; break;
@@ -822,9 +1166,7 @@ void optimize_ast(ASTNode *node)
 				node->type = NODE_INT;
 				node->int_value = res;
 
-				// Free the dead children
-				free(node->left);
-				free(node->right);
+				// Drop the dead children (their memory stays in the arena)
 				node->left = NULL;
 				node->right = NULL;
 			}
@@ -832,55 +1174,99 @@ void optimize_ast(ASTNode *node)
 	}
 }
 
-// Helper: Find a function definition in the global list
+// Functions found reachable whose bodies have not been scanned yet. A long
+// chain of calls is handled here rather than by recursing into each callee.
+typedef struct {
+	ASTNode **items;
+	int count;
+	int capacity;
+} Worklist;
+
 static
-ASTNode *find_function(ASTNode *list, const char *name)
+void mark_function(ASTNode *func, Worklist *pending)
 {
-	while (list) {
-		if (list->type == NODE_FUNCTION && strcmp(list->var_name, name) == 0)
-			return list;
-		list = list->next;
+	if (func->is_reachable) return;
+	func->is_reachable = 1;
+
+	if (pending->count == pending->capacity) {
+		int capacity = pending->capacity ? pending->capacity * 2 : 64;
+		ASTNode **items = realloc(pending->items, capacity * sizeof(ASTNode *));
+		if (!items) {
+			free(pending->items);
+			fatal("Error: Out of memory");
+		}
+		pending->items = items;
+		pending->capacity = capacity;
 	}
-	return NULL;
+	pending->items[pending->count++] = func;
 }
 
-// Recursive marker
+// Marks every function called from a statement list. Siblings are walked
+// with a loop and callees go to 'pending', so only nesting recurses.
 static
-void mark_reachable(ASTNode *node, ASTNode *all_funcs) {
-	if (!node) return;
-
-	// If we find a function call, mark the definition as reachable
-	if (node->type == NODE_FUNC_CALL) {
-		ASTNode *target = find_function(all_funcs, node->var_name);
-		
-		// If found and not yet visited, mark it and recurse into IT
-		if (target && !target->is_reachable) {
-			target->is_reachable = 1;
-			mark_reachable(target->body, all_funcs);
+void mark_reachable(ASTNode *node, const Table *functions, Worklist *pending)
+{
+	for (; node; node = node->next) {
+		// If we find a function call, mark the definition as reachable
+		if (node->type == NODE_FUNC_CALL) {
+			ASTNode *target = table_get(functions, node->var_name);
+			if (target)
+				mark_function(target, pending);
 		}
-	}
 
-	// Traverse children
-	mark_reachable(node->left, all_funcs);
-	mark_reachable(node->right, all_funcs);
-	mark_reachable(node->body, all_funcs);
-	mark_reachable(node->increment, all_funcs);
-	
-	// CAREFUL: Don't traverse 'next' if it leaves the current scope function chain
-	// But for blocks/statements, we do need 'next'. 
-	// Since functions are chained via 'next' at the top level, we handle that in analyze_reachability
-	if (node->type != NODE_FUNCTION) {
-		mark_reachable(node->next, all_funcs);
+		// Traverse children
+		mark_reachable(node->left, functions, pending);
+		mark_reachable(node->right, functions, pending);
+		mark_reachable(node->body, functions, pending);
+		mark_reachable(node->increment, functions, pending);
+
+		// Functions are chained via 'next' at the top level; that chain is
+		// handled by analyze_reachability
+		if (node->type == NODE_FUNCTION) break;
 	}
 }
 
 // Main entry point for DCE
-void analyze_reachability(ASTNode *all_funcs) {
+// With 'keep_exported' (an object for separate linking), every function
+// other objects could call is kept along with 'main'.
+void analyze_reachability(ASTNode *all_funcs, int keep_exported) {
+	// Index the functions by name so each call site is a single lookup.
+	// The first definition of a name wins, over any extern declarations.
+	Table functions = {0};
+	for (ASTNode *func = all_funcs; func; func = func->next) {
+		if (func->type != NODE_FUNCTION) continue;
+		ASTNode *seen = table_get(&functions, func->var_name);
+		if (!seen || (seen->is_extern && !func->is_extern))
+			table_put(&functions, func->var_name, func);
+	}
+
 	// Find 'main'
-	ASTNode *main_func = find_function(all_funcs, "main");
+	ASTNode *main_func = table_get(&functions, hc->name_main);
 	
-	if (main_func) {
-		main_func->is_reachable = 1;
-		mark_reachable(main_func->body, all_funcs);
+	Worklist pending = {0};
+	if (main_func)
+		mark_function(main_func, &pending);
+
+	// _start calls the exit hook after main returns
+	ASTNode *exit_hook = table_get(&functions, hc->name_flush_all);
+	hc->flush_at_exit = main_func && exit_hook;
+	if (hc->flush_at_exit)
+		mark_function(exit_hook, &pending);
+
+	if (keep_exported) {
+		for (ASTNode *func = all_funcs; func; func = func->next) {
+			if (func->is_static || func->is_extern || func->is_reachable ||
+				table_get(&functions, func->var_name) != func)
+				continue;
+			mark_function(func, &pending);
+		}
 	}
-}
\ No newline at end of file
+
+	while (pending.count > 0) {
+		ASTNode *func = pending.items[--pending.count];
+		mark_reachable(func->body, &functions, &pending);
+	}
+
+	free(pending.items);
+	table_free(&functions);
+}
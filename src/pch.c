@@ -0,0 +1,658 @@
+#include "helium.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/* ========================================================================= */
+/* PRECOMPILED HEADERS														 */
+/* ========================================================================= */
+
+// 'heliumc --emit-pch lib/std.he' parses a header once and saves the result
+// as lib/std.he.pch: its macro table, struct registry and the optimized AST
+// of its functions and globals. When the preprocessor sees that an included
+// file has a .pch, it puts a '#pch' marker in front of the included text and
+// the parser loads the blob in place of lexing and parsing that text.
+//
+// A blob is only used when it was written by a compiler built from the
+// same sources, and each file in the included text hashes the same as one
+// the blob was built from. A file the blob has but the text lacks was left
+// out by '#pragma once', so it is already part of the program: its
+// functions and globals are not loaded again.
+//
+// Definitions made before the include only matter if they touch the
+// header. The blob lists every name the header's text lexes, and is
+// refused if one of them is already a macro or struct the header doesn't
+// define itself, or if a macro or struct the header defines already exists
+// with a different definition. Otherwise the text after the marker is
+// compiled as usual.
+//
+// Layout (native byte order; string and node references are index + 1, 0
+// meaning NULL):
+//   magic, build id, context hash
+//   files:    count, then the hash of each source file's lines
+//   strings:  count, then (length, bytes) each
+//   names:    count, then one string each
+//   macros:   count, then (name, token type, token value, token name) each
+//   structs:  count, then (name, size, member count, (name, type, offset)...)
+//   nodes:    count, then one fixed-size record each
+//   items:    count, then (node, file, token hash) for each top-level
+//             function or global, in source order
+
+static const char PCH_MAGIC[8] = "HEPCH\0\0\2";
+
+// Token and node kinds are stored as numbers, so a blob is only good for
+// the compiler sources that wrote it. The Makefile passes a hash of them.
+#ifndef HELIUM_SOURCE_HASH
+#define HELIUM_SOURCE_HASH "unknown"
+#endif
+#define PCH_BUILD_ID NAME " " VERSION " " HELIUM_SOURCE_HASH
+
+#define PCH_MAX_FILES 64
+
+// One source file of an include
+typedef struct {
+	const char *path;	// As the '#file' markers name it
+	CacheKey key;		// Hash of its lines
+} PchFile;
+
+// Splits the text of an include by file, following the '#file' markers,
+// and hashes each file's lines. The marker lines are left out, and so is
+// the blank line a marker starts with after a nested include: they depend
+// on how and whether files were included rather than what they say.
+// Returns the number of files, or -1 if there are more than PCH_MAX_FILES.
+static
+int hash_files(const char *text, size_t len, PchFile *files)
+{
+	int count = 0;
+	PchFile *current = NULL;
+	const char *p = text;
+	const char *end = text + len;
+	while (p < end) {
+		const char *eol = memchr(p, '\n', end - p);
+		const char *next = eol ? eol + 1 : end;
+		if (next - p >= 6 && memcmp(p, "#file ", 6) == 0) {
+			const char *open = memchr(p, '"', next - p);
+			const char *close = open ? memchr(open + 1, '"', next - open - 1) : NULL;
+			current = NULL;
+			if (close) {
+				const char *path = intern(open + 1, close - open - 1);
+				for (int i = 0; i < count && !current; i++)
+					if (files[i].path == path)
+						current = &files[i];
+				if (!current) {
+					if (count == PCH_MAX_FILES)
+						return -1;
+					current = &files[count++];
+					current->path = path;
+					cache_key_init(&current->key);
+				}
+			}
+		} else if (next - p >= 5 && memcmp(p, "#pch ", 5) == 0) {
+			// Nested header marker
+		} else if (*p == '\n' && end - next >= 6 && memcmp(next, "#file ", 6) == 0) {
+			// Start of a '#file' marker
+		} else if (current) {
+			cache_key_add(&current->key, p, next - p);
+		}
+		p = next;
+	}
+	return count;
+}
+
+/* --- Writing --- */
+
+typedef struct {
+	Emitter *out;
+	Table string_index;		// Interned string -> index + 1
+	const char **strings;
+	int string_count;
+	int string_capacity;
+	Table node_index;		// Node -> index + 1
+	ASTNode **nodes;
+	int node_count;
+	int node_capacity;
+} PchWriter;
+
+static
+void put_u32(PchWriter *w, unsigned int value)
+{
+	emit_bytes(w->out, (const char *)&value, sizeof(value));
+}
+
+static
+void put_i64(PchWriter *w, long value)
+{
+	emit_bytes(w->out, (const char *)&value, sizeof(value));
+}
+
+static
+void put_key(PchWriter *w, const CacheKey *key)
+{
+	emit_bytes(w->out, (const char *)key, sizeof(CacheKey));
+}
+
+static
+void *grow_array(void *array, int *capacity, size_t item_size)
+{
+	*capacity = *capacity ? *capacity * 2 : 64;
+	array = realloc(array, *capacity * item_size);
+	if (!array)
+		fatal("Error: Out of memory");
+	return array;
+}
+
+static
+unsigned int string_ref(PchWriter *w, const char *s)
+{
+	if (!s) return 0;
+
+	long index = (long)table_get(&w->string_index, s);
+	if (index) return index;
+
+	if (w->string_count == w->string_capacity)
+		w->strings = grow_array(w->strings, &w->string_capacity, sizeof(char *));
+	w->strings[w->string_count++] = s;
+	table_put(&w->string_index, s, (void *)(long)w->string_count);
+	return w->string_count;
+}
+
+static
+unsigned int node_ref(PchWriter *w, ASTNode *node)
+{
+	if (!node) return 0;
+
+	long index = (long)table_get(&w->node_index, node);
+	if (index) return index;
+
+	if (w->node_count == w->node_capacity)
+		w->nodes = grow_array(w->nodes, &w->node_capacity, sizeof(ASTNode *));
+	w->nodes[w->node_count++] = node;
+	table_put(&w->node_index, node, (void *)(long)w->node_count);
+	return w->node_count;
+}
+
+static
+void put_token(PchWriter *w, const Token *token)
+{
+	put_u32(w, token->type);
+	put_i64(w, token->value);
+	put_u32(w, string_ref(w, token->name));
+}
+
+static
+int compare_names(const void *a, const void *b)
+{
+	return strcmp(*(const char *const *)a, *(const char *const *)b);
+}
+
+// A table's keys in name order. Tables hash interned pointers, so their
+// own order changes from run to run and would make blobs differ.
+static
+const char **sorted_keys(const Table *table)
+{
+	const char **keys = malloc((table->count + 1) * sizeof(char *));
+	int count = 0;
+	for (int i = 0; i < table->capacity; i++)
+		if (table->entries[i].key)
+			keys[count++] = table->entries[i].key;
+	qsort(keys, count, sizeof(char *), compare_names);
+	return keys;
+}
+
+// Top-level items are chained through 'next' by the caller, so a root's
+// own 'next' is not part of the item
+static
+void put_node(PchWriter *w, ASTNode *node, int is_root)
+{
+	put_u32(w, node->type);
+	put_u32(w, (unsigned char)node->op);
+	put_u32(w, node->is_arrow_access | node->is_const << 1 | node->is_static << 2 | node->is_extern << 3);
+	put_i64(w, node->int_value);
+	put_u32(w, string_ref(w, node->var_name));
+	put_u32(w, string_ref(w, node->member_name));
+	put_u32(w, node->line);
+	put_u32(w, node->column);
+	put_u32(w, node_ref(w, node->left));
+	put_u32(w, node_ref(w, node->right));
+	put_u32(w, node_ref(w, node->body));
+	put_u32(w, is_root ? 0 : node_ref(w, node->next));
+	put_u32(w, node_ref(w, node->increment));
+}
+
+// Sections refer to strings and nodes by index, so they are written to a
+// side buffer first and the string table goes out ahead of them. 'text' is
+// the header's preprocessed text, 'names' holds every name it lexed and
+// 'item_files' the file each item came from.
+void pch_write(Emitter *out, const char *text, const Table *names, const CacheKey *context_hash,
+			   ASTNode **items, const char **item_files, const CacheKey *item_keys, int item_count)
+{
+	PchFile files[PCH_MAX_FILES];
+	int file_count = hash_files(text, strlen(text), files);
+	if (file_count < 0)
+		fatal("Error: A precompiled header can include at most %d files", PCH_MAX_FILES);
+
+	Emitter body;
+	emit_init_memory(&body);
+
+	PchWriter w;
+	memset(&w, 0, sizeof(w));
+	w.out = &body;
+
+	// Names
+	const char **keys = sorted_keys(names);
+	put_u32(&w, names->count);
+	for (int i = 0; i < names->count; i++)
+		put_u32(&w, string_ref(&w, keys[i]));
+	free(keys);
+
+	// Macros
+	keys = sorted_keys(&hc->macro_table);
+	put_u32(&w, hc->macro_table.count);
+	for (int i = 0; i < hc->macro_table.count; i++) {
+		put_u32(&w, string_ref(&w, keys[i]));
+		put_token(&w, table_get(&hc->macro_table, keys[i]));
+	}
+	free(keys);
+
+	// Structs
+	keys = sorted_keys(&hc->struct_table);
+	put_u32(&w, hc->struct_table.count);
+	for (int i = 0; i < hc->struct_table.count; i++) {
+		const StructDef *sdef = table_get(&hc->struct_table, keys[i]);
+		put_u32(&w, string_ref(&w, sdef->name));
+		put_u32(&w, sdef->size);
+		put_u32(&w, sdef->member_count);
+		for (int m = 0; m < sdef->member_count; m++) {
+			put_u32(&w, string_ref(&w, sdef->members[m].name));
+			put_u32(&w, string_ref(&w, sdef->members[m].type_name));
+			put_u32(&w, sdef->members[m].offset);
+		}
+	}
+	free(keys);
+
+	// Nodes, breadth first: writing a node numbers its children, which are
+	// then written in turn
+	for (int i = 0; i < item_count; i++)
+		node_ref(&w, items[i]);
+	int root_count = w.node_count;
+
+	Emitter nodes;
+	emit_init_memory(&nodes);
+	w.out = &nodes;
+	for (int i = 0; i < w.node_count; i++)
+		put_node(&w, w.nodes[i], i < root_count);
+
+	// Items (roots were numbered first, in order)
+	w.out = &body;
+	put_u32(&w, w.node_count);
+	emit_bytes(&body, nodes.data, nodes.len);
+	emit_close(&nodes);
+	put_u32(&w, item_count);
+	for (int i = 0; i < item_count; i++) {
+		unsigned int file = 0;
+		for (int f = 0; f < file_count; f++)
+			if (files[f].path == item_files[i])
+				file = f;
+		put_u32(&w, i + 1);
+		put_u32(&w, file);
+		put_key(&w, &item_keys[i]);
+	}
+
+	// Header, files and string table, then everything else
+	w.out = out;
+	emit_bytes(out, PCH_MAGIC, sizeof(PCH_MAGIC));
+	put_u32(&w, sizeof(PCH_BUILD_ID));
+	emit_bytes(out, PCH_BUILD_ID, sizeof(PCH_BUILD_ID));
+	put_key(&w, context_hash);
+	put_u32(&w, file_count);
+	for (int i = 0; i < file_count; i++)
+		put_key(&w, &files[i].key);
+	put_u32(&w, w.string_count);
+	for (int i = 0; i < w.string_count; i++) {
+		size_t len = strlen(w.strings[i]);
+		put_u32(&w, len);
+		emit_bytes(out, w.strings[i], len);
+	}
+	emit_bytes(out, body.data, body.len);
+
+	emit_close(&body);
+	free(w.strings);
+	free(w.nodes);
+	table_free(&w.string_index);
+	table_free(&w.node_index);
+}
+
+/* --- Reading --- */
+
+typedef struct {
+	const char *path;
+	const char *p;
+	const char *end;
+	const char **strings;	// strings[0] is NULL
+	unsigned int string_count;
+	ASTNode *nodes;
+	unsigned int node_count;
+} PchReader;
+
+static
+void take(PchReader *r, void *dst, size_t len)
+{
+	if ((size_t)(r->end - r->p) < len)
+		fatal("Error: Corrupt precompiled header %s", r->path);
+	memcpy(dst, r->p, len);
+	r->p += len;
+}
+
+static
+unsigned int get_u32(PchReader *r)
+{
+	unsigned int value;
+	take(r, &value, sizeof(value));
+	return value;
+}
+
+static
+long get_i64(PchReader *r)
+{
+	long value;
+	take(r, &value, sizeof(value));
+	return value;
+}
+
+static
+const char *get_string(PchReader *r)
+{
+	unsigned int index = get_u32(r);
+	if (index > r->string_count)
+		fatal("Error: Corrupt precompiled header %s", r->path);
+	return r->strings[index];
+}
+
+static
+ASTNode *get_node(PchReader *r)
+{
+	unsigned int index = get_u32(r);
+	if (index > r->node_count)
+		fatal("Error: Corrupt precompiled header %s", r->path);
+	return index ? &r->nodes[index - 1] : NULL;
+}
+
+// Returns the whole file (in the AST arena) or NULL
+static
+char *read_blob(const char *path, size_t *len)
+{
+	int fd = open(path, O_RDONLY);
+	if (fd < 0) return NULL;
+
+	struct stat st;
+	char *data = NULL;
+	if (fstat(fd, &st) == 0) {
+		data = arena_alloc(&hc->ast_arena, st.st_size + 1, 16);
+		size_t done = 0;
+		while (done < (size_t)st.st_size) {
+			ssize_t n = read(fd, data + done, st.st_size - done);
+			if (n < 0 && errno == EINTR) continue;
+			if (n <= 0) break;
+			done += n;
+		}
+		*len = done;
+		if (done != (size_t)st.st_size)
+			data = NULL;
+	}
+	close(fd);
+	return data;
+}
+
+// Checks the header; returns 1 if the blob matches the text that follows,
+// marking in 'present' which of its files the text has
+static
+int pch_is_fresh(PchReader *r, size_t text_len, CacheKey *context_hash,
+				 unsigned char *present, unsigned int *file_count)
+{
+	char magic[sizeof(PCH_MAGIC)];
+	if ((size_t)(r->end - r->p) < sizeof(magic)) return 0;
+	take(r, magic, sizeof(magic));
+	if (memcmp(magic, PCH_MAGIC, sizeof(magic)) != 0) return 0;
+
+	if ((size_t)(r->end - r->p) < sizeof(unsigned int) + sizeof(PCH_BUILD_ID) + 2 * sizeof(CacheKey))
+		return 0;
+	if (get_u32(r) != sizeof(PCH_BUILD_ID) || memcmp(r->p, PCH_BUILD_ID, sizeof(PCH_BUILD_ID)) != 0)
+		return 0;
+	r->p += sizeof(PCH_BUILD_ID);
+
+	take(r, context_hash, sizeof(*context_hash));
+	*file_count = get_u32(r);
+	if (*file_count > PCH_MAX_FILES) return 0;
+	CacheKey stored[PCH_MAX_FILES];
+	take(r, stored, *file_count * sizeof(CacheKey));
+
+	const char *text = hc->source_code + hc->src_pos;
+	if (strnlen(text, text_len) != text_len) return 0;
+	PchFile files[PCH_MAX_FILES];
+	int count = hash_files(text, text_len, files);
+	if (count < 0) return 0;
+
+	// Every file in the text must be one the blob was built from
+	memset(present, 0, PCH_MAX_FILES);
+	for (int i = 0; i < count; i++) {
+		unsigned int match = 0;
+		while (match < *file_count && (present[match] || stored[match].lo != files[i].key.lo ||
+									   stored[match].hi != files[i].key.hi))
+			match++;
+		if (match == *file_count) return 0;
+		present[match] = 1;
+	}
+	return 1;
+}
+
+static
+int same_macro(const Token *a, const Token *b)
+{
+	return a->type == b->type && a->value == b->value && a->name == b->name;
+}
+
+static
+int same_struct(const StructDef *a, const StructDef *b)
+{
+	if (a->size != b->size || a->member_count != b->member_count)
+		return 0;
+	for (int i = 0; i < a->member_count; i++) {
+		const StructMember *x = &a->members[i];
+		const StructMember *y = &b->members[i];
+		if (x->name != y->name || x->type_name != y->type_name || x->offset != y->offset)
+			return 0;
+	}
+	return 1;
+}
+
+// Returns 1 if what has been defined so far leaves the header's parse as it
+// was when the blob was written (see the top of this file)
+static
+int pch_fits_context(const char **names, unsigned int name_count,
+					 const char **macro_names, const Token *macros, unsigned int macro_count,
+					 const StructDef *structs, unsigned int struct_count)
+{
+	Table own_macros = {0};
+	Table own_structs = {0};
+	int fits = 1;
+
+	for (unsigned int i = 0; i < macro_count && fits; i++) {
+		const Token *defined = table_get(&hc->macro_table, macro_names[i]);
+		fits = !defined || same_macro(defined, &macros[i]);
+		table_put(&own_macros, macro_names[i], (void *)&macros[i]);
+	}
+
+	// A struct that has been lexed but not yet parsed can't be compared
+	for (unsigned int i = 0; i < struct_count && fits; i++) {
+		const StructDef *defined = get_struct(structs[i].name);
+		if (defined)
+			fits = same_struct(defined, &structs[i]);
+		else
+			fits = !table_get(&hc->lexed_structs, structs[i].name);
+		table_put(&own_structs, structs[i].name, (void *)&structs[i]);
+	}
+
+	for (unsigned int i = 0; i < name_count && fits; i++) {
+		if (table_get(&hc->macro_table, names[i]) && !table_get(&own_macros, names[i]))
+			fits = 0;
+		if ((get_struct(names[i]) || table_get(&hc->lexed_structs, names[i])) &&
+			!table_get(&own_structs, names[i]))
+			fits = 0;
+	}
+
+	table_free(&own_macros);
+	table_free(&own_structs);
+	return fits;
+}
+
+// Called by the lexer with the TOKEN_PCH marker it just read. Loads the
+// header and skips the text it replaces, returning its top-level functions
+// and globals in source order; returns 0 if the text has to be lexed instead.
+int pch_load(Token marker, ASTNode ***items, int *item_count)
+{
+	size_t size;
+	char *blob = read_blob(marker.name, &size);
+	if (!blob) return 0;
+
+	PchReader r = {marker.name, blob, blob + size, NULL, 0, NULL, 0};
+	CacheKey context_hash;
+	unsigned char present[PCH_MAX_FILES];
+	unsigned int file_count;
+	if (!pch_is_fresh(&r, marker.value, &context_hash, present, &file_count))
+		return 0;
+
+	// Strings
+	r.string_count = get_u32(&r);
+	if (r.string_count > size)
+		fatal("Error: Corrupt precompiled header %s", r.path);
+	r.strings = arena_alloc(&hc->ast_arena, (r.string_count + 1) * sizeof(char *), _Alignof(char *));
+	r.strings[0] = NULL;
+	for (unsigned int i = 1; i <= r.string_count; i++) {
+		unsigned int len = get_u32(&r);
+		if ((size_t)(r.end - r.p) < len)
+			fatal("Error: Corrupt precompiled header %s", r.path);
+		r.strings[i] = intern(r.p, len);
+		r.p += len;
+	}
+
+	// Names, macros and structs are all read before any is defined
+	unsigned int name_count = get_u32(&r);
+	if (name_count > size)
+		fatal("Error: Corrupt precompiled header %s", r.path);
+	const char **names = arena_alloc(&hc->ast_arena, (name_count + 1) * sizeof(char *), _Alignof(char *));
+	for (unsigned int i = 0; i < name_count; i++)
+		names[i] = get_string(&r);
+
+	unsigned int macro_count = get_u32(&r);
+	if (macro_count > size)
+		fatal("Error: Corrupt precompiled header %s", r.path);
+	const char **macro_names = arena_alloc(&hc->ast_arena, (macro_count + 1) * sizeof(char *),
+										   _Alignof(char *));
+	Token *macros = arena_alloc(&hc->ast_arena, (macro_count + 1) * sizeof(Token), _Alignof(Token));
+	for (unsigned int i = 0; i < macro_count; i++) {
+		macro_names[i] = get_string(&r);
+		memset(&macros[i], 0, sizeof(Token));
+		macros[i].type = get_u32(&r);
+		macros[i].value = get_i64(&r);
+		macros[i].name = get_string(&r);
+		macros[i].line = marker.line;
+		macros[i].column = marker.column;
+		macros[i].offset = marker.offset;
+	}
+
+	unsigned int struct_count = get_u32(&r);
+	if (struct_count > size)
+		fatal("Error: Corrupt precompiled header %s", r.path);
+	StructDef *structs = arena_alloc(&hc->ast_arena, (struct_count + 1) * sizeof(StructDef),
+									 _Alignof(StructDef));
+	for (unsigned int i = 0; i < struct_count; i++) {
+		StructDef *sdef = &structs[i];
+		memset(sdef, 0, sizeof(StructDef));
+		sdef->name = get_string(&r);
+		sdef->size = get_u32(&r);
+		for (unsigned int members = get_u32(&r); members > 0; members--) {
+			StructMember *member = add_struct_member(sdef);
+			member->name = get_string(&r);
+			member->type_name = get_string(&r);
+			member->offset = get_u32(&r);
+		}
+	}
+
+	if (!pch_fits_context(names, name_count, macro_names, macros, macro_count, structs, struct_count))
+		return 0;
+
+	// Definitions that already exist are the same ones, from an earlier
+	// include of the same file
+	for (unsigned int i = 0; i < macro_count; i++)
+		if (!table_get(&hc->macro_table, macro_names[i]))
+			add_macro(macro_names[i], macros[i]);
+	for (unsigned int i = 0; i < struct_count; i++) {
+		if (get_struct(structs[i].name)) continue;
+		StructDef *sdef = add_struct(structs[i].name);
+		*sdef = structs[i];
+	}
+
+	// Nodes. Errors in them point at the #include line's marker.
+	r.node_count = get_u32(&r);
+	if (r.node_count > size)
+		fatal("Error: Corrupt precompiled header %s", r.path);
+	r.nodes = arena_alloc(&hc->ast_arena, (r.node_count + 1) * sizeof(ASTNode), _Alignof(ASTNode));
+	memset(r.nodes, 0, r.node_count * sizeof(ASTNode));
+	for (unsigned int i = 0; i < r.node_count; i++) {
+		ASTNode *node = &r.nodes[i];
+		node->type = get_u32(&r);
+		node->op = (char)get_u32(&r);
+		unsigned int flags = get_u32(&r);
+		node->is_arrow_access = flags & 1;
+		node->is_const = (flags >> 1) & 1;
+		node->is_static = (flags >> 2) & 1;
+		node->is_extern = (flags >> 3) & 1;
+		node->int_value = get_i64(&r);
+		node->var_name = get_string(&r);
+		node->member_name = get_string(&r);
+		node->line = get_u32(&r);
+		node->column = get_u32(&r);
+		node->offset = marker.offset;
+		node->left = get_node(&r);
+		node->right = get_node(&r);
+		node->body = get_node(&r);
+		node->next = get_node(&r);
+		node->increment = get_node(&r);
+	}
+
+	hc->report.nodes += r.node_count;
+
+	// Items, except those of files the program already has
+	unsigned int count = get_u32(&r);
+	if (count > r.node_count)
+		fatal("Error: Corrupt precompiled header %s", r.path);
+	*items = arena_alloc(&hc->ast_arena, (count + 1) * sizeof(ASTNode *), _Alignof(ASTNode *));
+	*item_count = 0;
+	for (unsigned int i = 0; i < count; i++) {
+		ASTNode *item = get_node(&r);
+		unsigned int file = get_u32(&r);
+		CacheKey tokens;
+		take(&r, &tokens, sizeof(tokens));
+		if (!item || file >= file_count)
+			fatal("Error: Corrupt precompiled header %s", r.path);
+		if (!present[file])
+			continue;
+		(*items)[(*item_count)++] = item;
+
+		if (hc->cache_dir && item->type == NODE_FUNCTION) {
+			CacheKey *key = arena_alloc(&hc->ast_arena, sizeof(CacheKey), _Alignof(CacheKey));
+			*key = tokens;
+			table_put(&hc->function_keys, item, key);
+		}
+	}
+
+	// The header's structs and globals join every function's cache key
+	if (hc->cache_dir)
+		cache_key_add(&hc->context_key, &context_hash, sizeof(context_hash));
+
+	hc->stats.headers_loaded++;
+	hc->src_pos += marker.value;
+	return 1;
+}
@@ -1,79 +1,273 @@
 #include "helium.h"
 
+#include <fcntl.h>
+#include <limits.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
 /* ========================================================================= */
 /* PREPROCESSOR																 */
 /* ========================================================================= */
 
-// Helper to append string to buffer, resizing if necessary
+// Input files are mapped, never read line by line. The expanded program is
+// first described as a list of spans pointing into the mappings (plus the
+// small '#file' markers for the lexer), then gathered into one buffer with
+// a single copy per span, because the lexer needs contiguous text.
+
+typedef struct Span {
+	const char *data;
+	size_t len;
+} Span;
+
+typedef struct {
+	const char *path;   // Canonical path (interned), the cache key
+	const char *data;
+	size_t size;
+	int is_mapped;
+	int pragma_once;    // Saw '#pragma once'
+	int times_included;
+} SourceFile;
+
+// hc->file_cache maps a canonical path to its SourceFile, so each file is
+// opened and mapped once; hc->spans collects the expansion in order.
+
 static
-void append_string(char **buffer, int *length, int *capacity, const char *str)
+void add_span(const char *data, size_t len)
 {
-	int str_len = strlen(str);
-	if (*length + str_len >= *capacity) {
-		*capacity = (*capacity == 0) ? 1024 : *capacity * 2;
-		while (*length + str_len >= *capacity) *capacity *= 2;
-		*buffer = realloc(*buffer, *capacity);
+	if (len == 0) return;
+	if (hc->span_count == hc->span_capacity) {
+		int capacity = hc->span_capacity ? hc->span_capacity * 2 : 64;
+		Span *spans = realloc(hc->spans, capacity * sizeof(Span));
+		if (!spans)
+			fatal("Error: Out of memory");
+		hc->spans = spans;
+		hc->span_capacity = capacity;
 	}
-	strcpy(*buffer + *length, str);
-	*length += str_len;
+	hc->spans[hc->span_count].data = data;
+	hc->spans[hc->span_count].len = len;
+	hc->span_count++;
 }
 
-// Recursive function to handle #include
-char *preprocess_file(const char *filename)
+// Markers tell the lexer which file and line the following text came from
+static
+void add_marker(const char *fmt, const char *filename, int line)
 {
-	FILE *f = fopen(filename, "r");
-	if (!f) {
-		fprintf(stderr, "Error: Could not open file %s\n", filename);
-		exit(1);
+	char marker[PATH_MAX + 64];
+	int len = snprintf(marker, sizeof(marker), fmt, filename, line);
+	char *copy = arena_alloc(&hc->ast_arena, len, 1);
+	memcpy(copy, marker, len);
+	add_span(copy, len);
+}
+
+// An include whose file has a precompiled header next to it ('<path>.pch')
+// is announced with a '#pch <length> "<header>"' marker covering its text
+static
+void mark_precompiled_include(const char *path, int first_span)
+{
+	char pch_path[PATH_MAX];
+	if (snprintf(pch_path, sizeof(pch_path), "%s.pch", path) >= (int)sizeof(pch_path) ||
+		access(pch_path, R_OK) != 0)
+		return;
+
+	size_t length = 0;
+	for (int i = first_span; i < hc->span_count; i++)
+		length += hc->spans[i].len;
+	if (length == 0) return;	// Skipped by '#pragma once'
+
+	char marker[PATH_MAX + 64];
+	int len = snprintf(marker, sizeof(marker), "#pch %zu \"%s\"\n", length, pch_path);
+	char *copy = arena_alloc(&hc->ast_arena, len, 1);
+	memcpy(copy, marker, len);
+
+	// Append, then move the marker in front of the include's spans
+	add_span(copy, len);
+	Span span = hc->spans[hc->span_count - 1];
+	memmove(&hc->spans[first_span + 1], &hc->spans[first_span],
+			(hc->span_count - 1 - first_span) * sizeof(Span));
+	hc->spans[first_span] = span;
+}
+
+static
+SourceFile *load_file(const char *filename)
+{
+	char resolved[PATH_MAX];
+	if (!realpath(filename, resolved))
+		fatal("Error: Could not open file %s", filename);
+
+	const char *key = intern_cstr(resolved);
+	SourceFile *file = table_get(&hc->file_cache, key);
+	if (file) return file;
+
+	int fd = open(resolved, O_RDONLY);
+	struct stat st;
+	if (fd < 0 || fstat(fd, &st) != 0) {
+		if (fd >= 0) close(fd);
+		fatal("Error: Could not open file %s", filename);
+	}
+
+	file = arena_alloc(&hc->ast_arena, sizeof(SourceFile), _Alignof(SourceFile));
+	memset(file, 0, sizeof(SourceFile));
+	file->path = key;
+	file->size = st.st_size;
+	file->data = "";
+
+	// mmap() rejects empty mappings; an empty file simply has no spans
+	if (file->size > 0) {
+		void *map = mmap(NULL, file->size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (map == MAP_FAILED) {
+			close(fd);
+			fatal("Error: Could not map file %s", filename);
+		}
+		file->data = map;
+		file->is_mapped = 1;
 	}
+	close(fd);
+
+	hc->stats.files_opened++;
+	hc->stats.bytes_read += file->size;
+	table_put(&hc->file_cache, key, file);
+	return file;
+}
+
+static
+int is_readable(const char *path)
+{
+	return access(path, R_OK) == 0;
+}
 
-	char *buffer = NULL;
-	int length = 0;
-	int capacity = 0;
+// Looks for 'name' as given (relative to the working directory), then next
+// to the including file, then in each -I directory
+static
+const char *resolve_include(const char *name, const char *includer)
+{
+	if (is_readable(name))
+		return intern_cstr(name);
+
+	char candidate[PATH_MAX];
+	const char *slash = strrchr(includer, '/');
+	if (slash) {
+		snprintf(candidate, sizeof(candidate), "%.*s/%s", (int)(slash - includer), includer, name);
+		if (is_readable(candidate))
+			return intern_cstr(candidate);
+	}
+
+	for (int i = 0; i < hc->include_path_count; i++) {
+		snprintf(candidate, sizeof(candidate), "%s/%s", hc->include_paths[i], name);
+		if (is_readable(candidate))
+			return intern_cstr(candidate);
+	}
+
+	fatal("%s: Error: Could not find include file \"%s\"", includer, name);
+}
+
+// Returns true if the line [p, end) begins with the given directive
+static
+int line_starts_with(const char *p, const char *end, const char *directive)
+{
+	while (p < end && (*p == ' ' || *p == '\t')) p++;
+	size_t len = strlen(directive);
+	return (size_t)(end - p) >= len && memcmp(p, directive, len) == 0;
+}
+
+static
+void preprocess_into(const char *filename)
+{
+	SourceFile *file = load_file(filename);
+	if (file->pragma_once && file->times_included > 0) {
+		hc->stats.includes_skipped++;
+		return;
+	}
+	file->times_included++;
 
 	// 1. Emit Initial Marker (#file "filename" 1)
 	// This tells the lexer "We are starting this file at line 1"
-	char marker[512];
-	snprintf(marker, sizeof(marker), "#file \"%s\" 1\n", filename);
-	append_string(&buffer, &length, &capacity, marker);
-
-	char line[1024];
-	int file_line_number = 1; // Track line numbers in THIS file
-
-	while (fgets(line, sizeof(line), f)) {
-		file_line_number++; // We are about to process this line
-		
-		// Check for #include
-		const char *include_ptr = strstr(line, "#include");
-		
-		if (include_ptr) {
-			char *start_quote = strchr(line, '"');
-			char *end_quote = strrchr(line, '"');
-			
-			if (start_quote && end_quote && end_quote > start_quote) {
-				*end_quote = '\0';
-				const char *included_filename = start_quote + 1;
-				
-				// Recursively read the included file
-				// (The child call will emit its own "start marker")
-				char *included_content = preprocess_file(included_filename);
-				
-				append_string(&buffer, &length, &capacity, included_content);
-				
+	add_marker("#file \"%s\" %d\n", filename, 1);
+
+	const char *p = file->data;
+	const char *end = file->data + file->size;
+	const char *run = p;        // Start of text not yet added as a span
+	int file_line_number = 1;   // Track line numbers in THIS file
+
+	while (p < end) {
+		const char *eol = memchr(p, '\n', end - p);
+		const char *next = eol ? eol + 1 : end;
+		file_line_number++; // Number of the line after this one
+
+		if (line_starts_with(p, next, "#pragma once")) {
+			// The lexer ignores the line itself
+			file->pragma_once = 1;
+		} else if (line_starts_with(p, next, "#include")) {
+			// The name runs from the first quote to the last one on the line
+			const char *start_quote = memchr(p, '"', next - p);
+			const char *end_quote = NULL;
+			if (start_quote) {
+				for (const char *q = next - 1; q > start_quote; q--) {
+					if (*q == '"') {
+						end_quote = q;
+						break;
+					}
+				}
+			}
+
+			if (start_quote && end_quote) {
+				add_span(run, p - run);
+
+				const char *name = intern(start_quote + 1, end_quote - start_quote - 1);
+				const char *path = resolve_include(name, filename);
+				int first_span = hc->span_count;
+				preprocess_into(path);
+				mark_precompiled_include(path, first_span);
+
 				// 2. Emit Restore Marker
 				// We just came back from an include. We must tell the lexer:
 				// "We are back in 'filename' at 'file_line_number'"
-				snprintf(marker, sizeof(marker), "\n#file \"%s\" %d\n", filename, file_line_number);
-				append_string(&buffer, &length, &capacity, marker);
-				
-				free(included_content);
-				continue; 
+				add_marker("\n#file \"%s\" %d\n", filename, file_line_number);
+				run = next;
 			}
 		}
+		p = next;
+	}
+
+	add_span(run, end - run);
+}
+
+// Expands #include directives and returns the whole program as one buffer
+char *preprocess_file(const char *filename)
+{
+	preprocess_into(filename);
+
+	size_t total = 0;
+	for (int i = 0; i < hc->span_count; i++)
+		total += hc->spans[i].len;
+
+	char *buffer = malloc(total + 1);
+	if (!buffer)
+		fatal("Error: Out of memory");
 
-		append_string(&buffer, &length, &capacity, line);
+	char *out = buffer;
+	for (int i = 0; i < hc->span_count; i++) {
+		memcpy(out, hc->spans[i].data, hc->spans[i].len);
+		out += hc->spans[i].len;
 	}
+	*out = '\0';
 
-	fclose(f);
+	// Everything has been copied out of the mappings
+	free_preprocessor(hc);
 	return buffer;
 }
+
+// Unmaps the inputs; also called when an error interrupts preprocessing
+void free_preprocessor(HeliumCompiler *compiler)
+{
+	Table *cache = &compiler->file_cache;
+	for (int i = 0; i < cache->capacity; i++) {
+		SourceFile *file = cache->entries[i].value;
+		if (file && file->is_mapped)
+			munmap((void *)file->data, file->size);
+	}
+	table_free(cache);
+	free(compiler->spans);
+	compiler->spans = NULL;
+	compiler->span_count = compiler->span_capacity = 0;
+}
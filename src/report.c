@@ -0,0 +1,119 @@
+#include "helium.h"
+
+#include <sys/resource.h>
+#ifdef __GLIBC__
+#include <malloc.h>
+#endif
+
+/* ========================================================================= */
+/* TIME REPORT																 */
+/* ========================================================================= */
+
+// --time-report: wall and CPU time per phase plus a few size counters.
+// Phases are timed with phase_begin()/phase_end() pairs, which do nothing
+// unless the report is enabled. CPU time is per thread, so parallel code
+// generation adds what each worker spent (phase_add_cpu()).
+
+static
+long elapsed_ns(const struct timespec *start, const struct timespec *end)
+{
+	return (end->tv_sec - start->tv_sec) * 1000000000L + (end->tv_nsec - start->tv_nsec);
+}
+
+static
+void sample_heap(void)
+{
+#ifdef __GLIBC__
+	struct mallinfo2 info = mallinfo2();
+	long in_use = (long)(info.uordblks + info.hblkhd);
+	if (in_use > hc->report.peak_heap)
+		hc->report.peak_heap = in_use;
+#endif
+}
+
+void phase_begin(PhaseClock *clock)
+{
+	if (!hc->report.enabled) return;
+	clock_gettime(CLOCK_MONOTONIC, &clock->wall);
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &clock->cpu);
+}
+
+void phase_end(Phase phase, const PhaseClock *clock)
+{
+	if (!hc->report.enabled) return;
+
+	struct timespec wall;
+	clock_gettime(CLOCK_MONOTONIC, &wall);
+	hc->report.phases[phase].wall_ns += elapsed_ns(&clock->wall, &wall);
+	phase_add_cpu(phase, clock);
+	sample_heap();
+}
+
+// Adds this thread's CPU time since phase_begin() (safe from any thread)
+void phase_add_cpu(Phase phase, const PhaseClock *clock)
+{
+	if (!hc->report.enabled) return;
+
+	struct timespec cpu;
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &cpu);
+	__atomic_fetch_add(&hc->report.phases[phase].cpu_ns, elapsed_ns(&clock->cpu, &cpu),
+					   __ATOMIC_RELAXED);
+}
+
+static const char *phase_names[PHASE_COUNT] = {
+	[PHASE_PREPROCESS]   = "preprocess",
+	[PHASE_PARSE]        = "parse",
+	[PHASE_OPTIMIZE]     = "optimize",
+	[PHASE_REACHABILITY] = "reachability",
+	[PHASE_CODEGEN]      = "codegen",
+};
+
+// Prints the report as a table, or as one JSON object per line
+void helium_write_report(const HeliumCompiler *compiler, const char *input_filename, FILE *out, int json)
+{
+	const CompileReport *report = &compiler->report;
+
+	struct rusage usage;
+	long max_rss_kib = getrusage(RUSAGE_SELF, &usage) == 0 ? usage.ru_maxrss : 0;
+
+	long total_wall = 0, total_cpu = 0;
+	for (int i = 0; i < PHASE_COUNT; i++) {
+		total_wall += report->phases[i].wall_ns;
+		total_cpu += report->phases[i].cpu_ns;
+	}
+
+	if (json) {
+		// File names are written as given; escape the two characters JSON requires
+		fprintf(out, "{\"file\": \"");
+		for (const char *p = input_filename; *p; p++) {
+			if (*p == '"' || *p == '\\') fputc('\\', out);
+			fputc(*p, out);
+		}
+		fprintf(out, "\", \"phases\": {");
+		for (int i = 0; i < PHASE_COUNT; i++) {
+			fprintf(out, "%s\"%s\": {\"wall_ms\": %.3f, \"cpu_ms\": %.3f}", i ? ", " : "", phase_names[i],
+					report->phases[i].wall_ns / 1e6, report->phases[i].cpu_ns / 1e6);
+		}
+		fprintf(out, "}, \"total_wall_ms\": %.3f, \"total_cpu_ms\": %.3f", total_wall / 1e6, total_cpu / 1e6);
+		fprintf(out, ", \"tokens\": %ld, \"nodes\": %ld, \"functions_emitted\": %ld, "
+				"\"functions_eliminated\": %ld, \"asm_bytes\": %ld, \"peak_heap_bytes\": %ld, "
+				"\"max_rss_kib\": %ld}\n",
+				report->tokens, report->nodes, report->functions_emitted, report->functions_eliminated,
+				report->asm_bytes, report->peak_heap, max_rss_kib);
+		return;
+	}
+
+	fprintf(out, "%s: time report\n", input_filename);
+	fprintf(out, "  %-14s %10s %10s %6s\n", "phase", "wall (ms)", "cpu (ms)", "wall%");
+	for (int i = 0; i < PHASE_COUNT; i++) {
+		fprintf(out, "  %-14s %10.3f %10.3f %5.1f%%\n", phase_names[i],
+				report->phases[i].wall_ns / 1e6, report->phases[i].cpu_ns / 1e6,
+				total_wall ? 100.0 * report->phases[i].wall_ns / total_wall : 0.0);
+	}
+	fprintf(out, "  %-14s %10.3f %10.3f\n", "total", total_wall / 1e6, total_cpu / 1e6);
+	fprintf(out, "  tokens: %ld, AST nodes: %ld\n", report->tokens, report->nodes);
+	fprintf(out, "  functions: %ld emitted, %ld eliminated\n",
+			report->functions_emitted, report->functions_eliminated);
+	fprintf(out, "  assembly: %ld bytes\n", report->asm_bytes);
+	fprintf(out, "  peak heap: %ld bytes, max RSS: %ld KiB\n", report->peak_heap, max_rss_kib);
+}
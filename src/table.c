@@ -0,0 +1,81 @@
+#include "helium.h"
+
+/* ========================================================================= */
+/* HASH TABLES																 */
+/* ========================================================================= */
+
+// Maps interned names to values. Because equal names are the same pointer
+// the key is hashed and compared as an address, never as a string.
+
+static
+unsigned int hash_key(const void *key)
+{
+	// Interned strings are at least byte-aligned and often clustered, so mix
+	// the address bits before masking (Fibonacci hashing)
+	unsigned long h = (unsigned long)key * 11400714819323198485ul;
+	return (unsigned int)(h >> 32);
+}
+
+static
+void table_grow(Table *table)
+{
+	int old_capacity = table->capacity;
+	TableEntry *old_entries = table->entries;
+
+	table->capacity = old_capacity ? old_capacity * 2 : 64;
+	table->entries = calloc(table->capacity, sizeof(TableEntry));
+	if (!table->entries)
+		fatal("Error: Out of memory");
+
+	for (int i = 0; i < old_capacity; i++) {
+		if (!old_entries[i].key) continue;
+		int slot = hash_key(old_entries[i].key) & (table->capacity - 1);
+		while (table->entries[slot].key)
+			slot = (slot + 1) & (table->capacity - 1);
+		table->entries[slot] = old_entries[i];
+	}
+	free(old_entries);
+}
+
+// Returns NULL when the key is absent
+void *table_get(const Table *table, const void *key)
+{
+	if (!table->count) return NULL;
+
+	int slot = hash_key(key) & (table->capacity - 1);
+	while (table->entries[slot].key) {
+		if (table->entries[slot].key == key)
+			return table->entries[slot].value;
+		slot = (slot + 1) & (table->capacity - 1);
+	}
+	return NULL;
+}
+
+// Inserts or replaces. Storing NULL hides a key without removing its slot.
+void table_put(Table *table, const void *key, void *value)
+{
+	// Keep the load factor at or below 1/2
+	if ((table->count + 1) * 2 > table->capacity)
+		table_grow(table);
+
+	int slot = hash_key(key) & (table->capacity - 1);
+	while (table->entries[slot].key) {
+		if (table->entries[slot].key == key) {
+			table->entries[slot].value = value;
+			return;
+		}
+		slot = (slot + 1) & (table->capacity - 1);
+	}
+
+	table->entries[slot].key = key;
+	table->entries[slot].value = value;
+	table->count++;
+}
+
+void table_free(Table *table)
+{
+	free(table->entries);
+	table->entries = NULL;
+	table->capacity = 0;
+	table->count = 0;
+}
@@ -32,19 +32,67 @@ def parse_expectations(filepath):
 				
 	return expected_exit, expected_out.strip()
 
-def run_test(filepath):
+# '// expect-stats: text' lines must each appear in the compiler's --stats output
+def parse_expected_stats(filepath):
+	with open(filepath, "r") as f:
+		return [line.split(":", 1)[-1].strip() for line in f if "// expect-stats:" in line]
+
+# '// expect-error: text' makes the test pass only if compiling fails with
+# that text in the message
+def parse_expected_error(filepath):
+	with open(filepath, "r") as f:
+		for line in f:
+			if "// expect-error:" in line:
+				return line.split(":", 1)[-1].strip()
+	return None
+
+def check_error(filepath, res):
+	expected = parse_expected_error(filepath)
+	actual = res.stderr.decode()
+	if res.returncode == 0 or expected not in actual:
+		print(f"{RED}FAIL (Wrong Error){RESET}")
+		print(f"  Expected: '{expected}'")
+		print(f"  Actual:   '{actual.strip()}'")
+		return False
+	print(f"{GREEN}PASS{RESET}")
+	return True
+
+def check_stats(filepath, stderr):
+	for expected in parse_expected_stats(filepath):
+		if expected not in stderr:
+			print(f"{RED}FAIL (Wrong Stats){RESET}")
+			print(f"  Expected: '{expected}'")
+			print(f"  Actual:   '{stderr.strip()}'")
+			return False
+	return True
+
+def run_test(filepath, jit):
 	print(f"Testing {filepath}...", end=" ")
 	sys.stdout.flush()
-	
+
+	# heliumc --run compiles into memory and runs the program itself
+	stats = ["--stats"] if parse_expected_stats(filepath) else []
+	if jit:
+		run_res = subprocess.run([COMPILER, *stats, "--run", filepath], capture_output=True)
+		if parse_expected_error(filepath) is not None:
+			return check_error(filepath, run_res)
+		if not check_stats(filepath, run_res.stderr.decode()):
+			return False
+		return check_result(filepath, run_res)
+
 	# 1. Compile
 	# We use capture_output=True so we don't spam the console unless it fails
-	compile_cmd = [COMPILER, "-o", TMP_ASM, filepath]
+	compile_cmd = [COMPILER, *stats, "-o", TMP_ASM, filepath]
 	comp_res = subprocess.run(compile_cmd, capture_output=True)
+	if parse_expected_error(filepath) is not None:
+		return check_error(filepath, comp_res)
 	
 	if comp_res.returncode != 0:
 		print(f"{RED}FAIL (Compilation Error){RESET}")
 		print(comp_res.stderr.decode())
 		return False
+	if not check_stats(filepath, comp_res.stderr.decode()):
+		return False
 
 	# 2. Assemble (NASM)
 	nasm_res = subprocess.run(["nasm", "-f", "elf64", TMP_ASM, "-o", TMP_OBJ], capture_output=True)
@@ -61,17 +109,20 @@ def run_test(filepath):
 		return False
 
 	# 4. Run the executable
-	expected_exit, expected_out = parse_expectations(filepath)
-	
 	try:
 		run_res = subprocess.run([f"./{TMP_EXE}"], capture_output=True)
-		actual_exit = run_res.returncode
-		actual_out = run_res.stdout.decode().strip()
 	except Exception as e:
 		print(f"{RED}FAIL (Runtime Error){RESET}")
 		print(e)
 		return False
 
+	return check_result(filepath, run_res)
+
+def check_result(filepath, run_res):
+	expected_exit, expected_out = parse_expectations(filepath)
+	actual_exit = run_res.returncode
+	actual_out = run_res.stdout.decode().strip()
+
 	# 5. Verify
 	if actual_exit != expected_exit:
 		print(f"{RED}FAIL (Wrong Exit Code){RESET}")
@@ -110,12 +161,13 @@ def main():
 		return
 
 	tests.sort() # Run in alphabetical order
+	jit = "--run" in sys.argv[1:]
 	passed = 0
 	total = 0
 
 	for test in tests:
 		total += 1
-		if run_test(test):
+		if run_test(test, jit):
 			passed += 1
 
 	clean_up()